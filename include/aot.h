@@ -0,0 +1,60 @@
+#ifndef aot_H
+#define aot_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+class memory;
+class rv32i;
+
+// The hart as seen by ahead-of-time translated code
+struct aot_state
+{
+    uint32_t x[32];    // x0 is never written and stays zero
+    uint32_t pc;       // set by the block on every exit
+    uint32_t executed; // instructions completed when the block exited
+    memory *mem;
+    const uint8_t *code_lines; // rv32i::code_lines, so stores can detect code
+};
+
+// A translated block: runs the block from its start with the hart in s.
+// Returns false if it stopped before a store into a line of code, which the
+// caller must then run itself.
+typedef bool (*aot_block_fn)(aot_state &s);
+
+struct aot_block
+{
+    uint32_t start; // address of the first instruction
+    uint32_t len;   // instructions in the block
+    aot_block_fn fn;
+};
+
+// A translated image: the blocks found in it, and the memory size and
+// checksum that identify the image they were translated from
+struct aot_image
+{
+    uint64_t size;
+    uint32_t checksum;
+    const aot_block *blocks;
+    size_t nblocks;
+};
+
+// A generated translation unit defines one static aot_registrar so that
+// linking it in makes its image available to the aot engine.
+struct aot_registrar
+{
+    aot_registrar(const aot_image *image);
+};
+
+// checksum of the whole of mem, as recorded in a translated image
+uint32_t aot_checksum(memory *mem);
+
+// the linked-in translation of the image now in mem, or nullptr if there is none
+const aot_image *aot_find(memory *mem);
+
+// Write a C++ translation of the image in mem to os, with instructions
+// disassembled by cpu in the comments. Returns the number of blocks translated.
+size_t aot_translate(const rv32i &cpu, memory *mem, std::ostream &os);
+
+#endif // aot_H
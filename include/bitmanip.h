@@ -0,0 +1,74 @@
+#ifndef bitmanip_H
+#define bitmanip_H
+
+#include <cstdint>
+
+// Zbb results that need more than one C++ operator. Where the compiler has
+// them, these are host intrinsics (a bit scan, popcount or byte swap) rather
+// than loops. They are shared by the handlers, the threaded engine's ops and
+// the code written by the AOT translator.
+
+inline uint32_t zbb_clz(uint32_t x)
+{
+#if defined(__GNUC__)
+    return x ? __builtin_clz(x) : 32;
+#else
+    uint32_t n = 0;
+    for (uint32_t bit = 0x80000000; bit && !(x & bit); bit >>= 1)
+        n++;
+    return n;
+#endif
+}
+
+inline uint32_t zbb_ctz(uint32_t x)
+{
+#if defined(__GNUC__)
+    return x ? __builtin_ctz(x) : 32;
+#else
+    uint32_t n = 0;
+    for (uint32_t bit = 1; bit && !(x & bit); bit <<= 1)
+        n++;
+    return n;
+#endif
+}
+
+inline uint32_t zbb_cpop(uint32_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_popcount(x);
+#else
+    uint32_t n = 0;
+    for (; x; x &= x - 1)
+        n++;
+    return n;
+#endif
+}
+
+inline uint32_t zbb_rev8(uint32_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_bswap32(x);
+#else
+    return x << 24 | (x & 0xff00) << 8 | (x >> 8 & 0xff00) | x >> 24;
+#endif
+}
+
+// compilers turn both of these into a single rotate instruction
+inline uint32_t zbb_rol(uint32_t x, uint32_t n)
+{
+    return x << (n & 31) | x >> (-n & 31);
+}
+
+inline uint32_t zbb_ror(uint32_t x, uint32_t n)
+{
+    return x >> (n & 31) | x << (-n & 31);
+}
+
+// each byte that is not zero becomes 0xff
+inline uint32_t zbb_orc_b(uint32_t x)
+{
+    uint32_t high = (((x & 0x7f7f7f7f) + 0x7f7f7f7f) | x) & 0x80808080;
+    return (high >> 7) * 0xff;
+}
+
+#endif // bitmanip_H
@@ -0,0 +1,81 @@
+#ifndef branch_H
+#define branch_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Predicts whether conditional branches are taken. See branch.cpp.
+class direction_predictor
+{
+public:
+    virtual ~direction_predictor() {}
+
+    // the guess for the branch at pc to target
+    virtual bool predict(uint32_t pc, uint32_t target) = 0;
+
+    // learn the outcome of the branch at pc just predicted
+    virtual void update(uint32_t pc, bool taken) = 0;
+};
+
+// The predictor called name (static, bimodal, gshare or tage), or nullptr
+// if there is none.
+direction_predictor *make_predictor(const std::string &name);
+
+// A front end predicting every branch and jump, fed with each as it
+// retires: a direction predictor for conditional branches, a BTB for the
+// targets of taken branches and jumps, and a return-address stack for
+// returns.
+class branch_model
+{
+public:
+    // takes ownership of p
+    branch_model(const std::string &name, direction_predictor *p);
+
+    // account for insn, len bytes long (2 if compressed), run at pc, which
+    // left the pc at next_pc
+    void retire(uint32_t insn, uint32_t len, uint32_t pc, uint32_t next_pc);
+
+    // totals, then the branches and jumps mispredicted most, each shown by
+    // disasm(pc, insn)
+    std::string render(const std::function<std::string(uint32_t, uint32_t)> &disasm) const;
+
+private:
+    struct btb_entry
+    {
+        uint32_t pc;
+        uint32_t target;
+    };
+
+    // what happened at one branch or jump
+    struct site
+    {
+        uint32_t insn;
+        uint64_t executed;
+        uint64_t taken;
+        uint64_t mispredicted;
+    };
+
+    // the BTB's target for the len byte instruction at pc, or pc + len if
+    // it has none
+    uint32_t btb_lookup(uint32_t pc, uint32_t len) const;
+
+    std::string name;
+    std::unique_ptr<direction_predictor> predictor;
+    std::vector<btb_entry> btb;
+    std::vector<uint32_t> ras; // circular, overwriting the oldest when full
+    uint32_t ras_top;
+
+    std::unordered_map<uint32_t, site> sites;
+    uint64_t branches;
+    uint64_t direction_misses;
+    uint64_t target_misses; // taken branches and jumps to the wrong target
+    uint64_t jumps;
+    uint64_t returns;
+    uint64_t return_misses;
+};
+
+#endif // branch_H
@@ -0,0 +1,94 @@
+#ifndef cache_H
+#define cache_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum cache_replacement
+{
+    replace_lru,    // least recently used
+    replace_fifo,   // first filled
+    replace_random, // pseudo-random, the same from run to run
+};
+
+// Geometry and policies of one cache level. size, ways and line must be
+// powers of two, with size at least ways * line.
+struct cache_config
+{
+    uint32_t size;
+    uint32_t ways;
+    uint32_t line;
+    cache_replacement replacement;
+    bool write_back; // write-back and write-allocate, else write-through and no write-allocate
+};
+
+// One set-associative cache level. The tags, ages and dirty bits of each
+// set are adjacent in flat arrays, so a lookup touches one or two host
+// cache lines.
+class cache_level
+{
+public:
+    cache_level(const cache_config &c);
+
+    // Look up the line holding addr, filling it on a miss if fill. Returns
+    // true on a hit. If a dirty line is evicted, sets evicted to its
+    // address and evicted_dirty to true.
+    bool access(uint32_t addr, bool write, bool fill, uint32_t &evicted, bool &evicted_dirty);
+
+    const cache_config &get_config() const;
+
+private:
+    cache_config config;
+    uint32_t line_shift;
+    uint32_t set_mask;
+    uint32_t clock;                // advances on every access, for LRU and FIFO ages
+    uint32_t random;               // xorshift state for random replacement
+    std::vector<uint32_t> tags;    // line address + 1 per way, 0 = invalid
+    std::vector<uint32_t> ages;    // clock of the last use (LRU) or fill (FIFO)
+    std::vector<uint8_t> dirty;
+};
+
+// L1 instruction and data caches backed by a unified L2
+class cache_hierarchy
+{
+public:
+    cache_hierarchy(const cache_config &l1i, const cache_config &l1d, const cache_config &l2);
+
+    void fetch(uint32_t addr, uint32_t len);  // an instruction fetch of len bytes
+    void load(uint32_t addr, uint32_t len);   // a data read of len bytes
+    void store(uint32_t addr, uint32_t len);  // a data write of len bytes
+
+    // hits and misses of every level, for fetches and data apart
+    std::string render() const;
+
+private:
+    // hits and misses at one level, per side (0 = instruction, 1 = data)
+    struct counts
+    {
+        uint64_t hits[2];
+        uint64_t misses[2];
+        uint64_t writebacks;
+    };
+
+    void access_range(int side, uint32_t addr, uint32_t len, bool write);
+    void access_line(int side, uint32_t addr, bool write);
+    void access_l2(int side, uint32_t addr, uint32_t len, bool write);
+
+    cache_level l1i;
+    cache_level l1d;
+    cache_level l2;
+    counts l1i_counts;
+    counts l1d_counts;
+    counts l2_counts;
+    uint64_t memory_reads;
+    uint64_t memory_writes;
+};
+
+// Set l1i, l1d and l2 from spec, a comma-separated list of level=geometry
+// such as "l1d=8k:2:32:lru:wt,l2=128k:8:64". A geometry is
+// size:ways:line[:lru|fifo|random[:wb|wt]]; sizes may end in k or m. Levels
+// not in spec keep the values they have. Returns false if spec is not valid.
+bool cache_configure(const std::string &spec, cache_config &l1i, cache_config &l1d, cache_config &l2);
+
+#endif // cache_H
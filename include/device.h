@@ -0,0 +1,39 @@
+#ifndef device_H
+#define device_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// A memory-mapped device (see memory::attach()). Loads and stores to its
+// pages come here instead of memory, with the offset from its base and the
+// width in bytes (1, 2 or 4), one at a time even when harts on several
+// threads share the memory.
+class device
+{
+public:
+    virtual ~device() {}
+
+    // bytes of address space the device decodes from its base
+    virtual uint32_t size() const = 0;
+
+    virtual uint32_t read(uint32_t offset, uint32_t width) = 0;
+    virtual void write(uint32_t offset, uint32_t width, uint32_t val) = 0;
+};
+
+// A plugin is a shared object defining
+//
+//     extern "C" device *rv32i_device(const char *args);
+//
+// which returns a new device configured by args (whatever followed the file
+// name on the command line, perhaps nothing), or nullptr if it can't.
+typedef device *device_plugin_fn(const char *args);
+static constexpr const char *device_plugin_symbol = "rv32i_device";
+
+// Make the device called name configured by arg (see print_usage() in
+// main.cpp): "uart", "timer", "block" or "plugin". A UART writes what the
+// program sends it to out. Returns nullptr, with a message to err, if there
+// is no such device or it can't be set up.
+device *make_device(const std::string &name, const std::string &arg, std::ostream *out, std::ostream &err);
+
+#endif // device_H
@@ -0,0 +1,54 @@
+#ifndef jit_H
+#define jit_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct translated_block;
+
+// The hart as seen by native code. While compiled blocks run, the guest
+// registers live here rather than in the registerfile; rv32i copies them
+// across whenever it switches between native code and exec_* handlers.
+struct jit_context
+{
+    uint32_t x[32];        // x0 is never written and stays zero
+    uint32_t pc;           // set by the block on every exit
+    uint32_t executed;     // instructions completed when the block exited
+    uint8_t *const *pages; // guest memory, memory::get_page_table()
+    uint8_t *code_lines;   // rv32i::code_lines, so stores can detect decoded code
+};
+
+// a compiled block: runs the block from its start with the hart in c
+typedef void (*jit_block_fn)(jit_context *c);
+
+// Native code generator for translated blocks. Only x86-64 hosts are
+// supported; elsewhere (or built with -DRV32I_NO_JIT) available() is false
+// and compile() always fails.
+class jit
+{
+public:
+    jit();
+    ~jit();
+
+    // true when native code can be generated and run on this host
+    bool available() const;
+
+    // Emit native code for block b on a guest memory of mem_size bytes.
+    // Returns nullptr if the block contains an instruction the JIT does not
+    // handle or the code buffer is full (see flush()).
+    jit_block_fn compile(const translated_block &b, uint64_t mem_size);
+
+    // discard all generated code
+    void flush();
+
+    // true when compile() failed for lack of space
+    bool is_full() const;
+
+private:
+    uint8_t *buf;   // executable code buffer
+    size_t size;    // size of buf
+    size_t used;    // bytes of buf already holding code
+    bool full;
+};
+
+#endif // jit_H
@@ -0,0 +1,36 @@
+#ifndef loader_H
+#define loader_H
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+
+class memory;
+
+// The names of addresses in a program, from the symbol table of its ELF file
+typedef std::map<uint32_t, std::string> symbol_table;
+
+// What loading a program found out about it
+struct program_info
+{
+    uint32_t entry = 0;      // where execution starts
+    bool compressed = false; // whether it was built for the C extension
+    symbol_table symbols;
+};
+
+// Whether fname is a regular file that starts like an ELF file
+bool is_elf(const std::string &fname);
+
+// Load the ELF32 RISC-V executable fname into mem: the file bytes of each
+// PT_LOAD segment at its vaddr (mapped as memory::load() does) and zeros for
+// the rest of its memory size (see memory::zero()). Sets prog from e_entry,
+// e_flags and the symbol table, if there is one. Returns false, with a
+// message to err, if the file is not such an executable or does not fit.
+bool load_elf(const std::string &fname, memory *mem, program_info &prog, std::ostream &err);
+
+// Load fname into mem as load_elf() does if it is an ELF file, and otherwise
+// as a raw image at address 0 (see memory::load_file()), starting at 0
+bool load_program(const std::string &fname, memory *mem, program_info &prog, std::ostream &err);
+
+#endif // loader_H
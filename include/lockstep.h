@@ -0,0 +1,28 @@
+#ifndef lockstep_H
+#define lockstep_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class memory;
+class rv32i;
+
+// One of the simulators run in lockstep: a hart with a memory of its own, and
+// the name it is reported by
+struct lockstep_sim
+{
+    std::string name;
+    memory *mem;
+    rv32i *cpu;
+};
+
+// Run every simulator in sims until halted or limit instructions executed
+// (0 = no limit), stopping every interval instructions to compare the pc,
+// registers, instruction count and halt state of each with the first. Their
+// memories are compared when they stop. Returns false after writing a report
+// of the first difference to os.
+bool lockstep(const std::vector<lockstep_sim> &sims, uint64_t interval, uint64_t limit, std::ostream &os);
+
+#endif // lockstep_H
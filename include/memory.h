@@ -2,19 +2,31 @@
 #define memory_H
 
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
 #include <string>
+#include <utility>
 #include <vector>
+#include "device.h"
 #include "hex.h"
 
+// Memory is kept in pages of this many bytes, allocated the first time they
+// are written, or mapped from a file by load()
+static constexpr uint32_t memory_page_shift = 12;
+static constexpr uint32_t memory_page_size = 1 << memory_page_shift;
+
 class memory
 {
 
 public:
-    memory(uint32_t siz);
+    memory(uint64_t siz); // up to 4 GiB (0x100000000)
     ~memory();
+    memory(const memory &) = delete;
+    memory &operator=(const memory &) = delete;
 
-    bool check_address(uint32_t i) const; //checks address prototype
-    uint32_t get_size() const;            //get_size prototype
+    bool check_address(uint64_t i) const; //checks address prototype
+    uint64_t get_size() const;            //get_size prototype
     uint8_t get8(uint32_t addr) const;    //get8 prototype
     uint16_t get16(uint32_t addr) const;  //get16 prototype
     uint32_t get32(uint32_t addr) const;  //get32 prototype
@@ -23,15 +35,160 @@ public:
     void set16(uint32_t addr, uint16_t val); //set16 prototype
     void set32(uint32_t addr, uint32_t val); //set32 prototype
 
+    // copy len bytes at addr, all within memory, out of or into buf
+    void read(uint32_t addr, uint8_t *buf, uint32_t len) const;
+    void write(uint32_t addr, const uint8_t *buf, uint32_t len);
+
+    // the bytes of the page holding addr, or nullptr if it has never been
+    // written (and reads as 0xa5)
+    const uint8_t *get_page(uint32_t addr) const;
+
+    // the page table itself, indexed by address >> memory_page_shift, for
+    // generated code; nullptr for a page never written
+    uint8_t *const *get_page_table() const;
+
     void dump() const; //dump prototype
 
-    bool load_file(const std::string &fname); //load_file prototype
+    void set_output(std::ostream *o, std::ostream *e); //where dump, warnings and errors go
+
+    // maps the file at address 0, copy-on-write, so no byte is copied until
+    // it is written
+    bool load_file(const std::string &fname);
+
+    // maps len bytes of the open file fd from offset at addr in the same way
+    // (copying them where offset and addr are not as far into a page), or
+    // returns false if they are not all within memory or can't be read
+    bool load(int fd, uint64_t offset, uint32_t addr, uint64_t len);
+
+    // makes len bytes at addr, all within memory, read as zero; pages wholly
+    // within them are not allocated until the program touches them
+    void zero(uint32_t addr, uint64_t len);
+
+    // maps d, which it then owns, at base (a multiple of memory_page_size) in
+    // place of whatever memory was in the pages it takes up, so that accesses
+    // to them go to d. Returns false if it would overlap another device or
+    // run past the end of the address space.
+    bool attach(uint32_t base, device *d);
+
+    // whether addr is in the pages of a device rather than memory
+    bool is_device(uint32_t addr) const;
 
 private:
     // uint8_t *mem; // the  actual  memory  buffer
 
-    std::vector<uint8_t> mem; // the actual memory buffer
-    uint32_t size;            //size prototype
+    // byte at a time accesses for addresses that are misaligned or out of
+    // range, warning once for each byte out of range
+    uint8_t get8_slow(uint32_t addr) const;
+    uint16_t get16_slow(uint32_t addr) const;
+    uint32_t get32_slow(uint32_t addr) const;
+    void set8_slow(uint32_t addr, uint8_t val);
+    void set16_slow(uint32_t addr, uint16_t val);
+    void set32_slow(uint32_t addr, uint32_t val);
+
+    // the page holding addr (which is in range), or nullptr; touch()
+    // allocates it, filled with 0xa5, if need be
+    uint8_t *find(uint32_t addr) const;
+    uint8_t *touch(uint32_t addr);
+    uint8_t *fast(uint32_t addr) const;
+    uint8_t *map(int fd, uint64_t offset, uint64_t len);
+    bool mapped(const uint8_t *p) const;
+    bool copy(int fd, uint64_t offset, uint32_t addr, uint64_t len);
+
+    // The devices attached, each from base up to end (a page boundary), and
+    // the lock that makes accesses to them one at a time. Their pages have no
+    // entry in the page table, so the fast paths never see them and the slow
+    // paths look here first.
+    struct io_region
+    {
+        uint32_t base;
+        uint64_t end;
+        std::unique_ptr<device> dev;
+    };
+    std::vector<io_region> io;
+    mutable std::mutex io_lock;
+    const io_region *io_at(uint32_t addr, uint32_t len) const;
+    uint32_t io_read(const io_region &r, uint32_t addr, uint32_t width) const;
+    void io_write(const io_region &r, uint32_t addr, uint32_t width, uint32_t val);
+
+    std::vector<uint8_t *> pages; // the actual memory, a page at a time
+    uint32_t whole_pages;         // pages wholly within memory
+    // what load() and zero() have mapped, and how many bytes of each
+    std::vector<std::pair<uint8_t *, uint64_t>> maps;
+    uint64_t size;                //size prototype
+    std::ostream *out;            //stream for dump and warnings, std::cout by default
+    std::ostream *err;            //stream for errors, std::cerr by default
 };
 
+/*****************************************
+ * Fast paths
+ *
+ * An aligned access to a page that is wholly within memory and has been
+ * written or loaded is one compare, one page table load and one native load
+ * or store of the little-endian value (device pages have no entry, so they
+ * cost nothing here). The accesses are relaxed atomics, so
+ * harts on other threads may share memory. Anything else, and every access
+ * on a big-endian host, goes to memory.cpp.
+ * **************************************/
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MEMORY_NATIVE_LE 1
+#else
+#define MEMORY_NATIVE_LE 0
+#endif
+
+inline uint8_t *memory::fast(uint32_t addr) const
+{
+    uint32_t n = addr >> memory_page_shift;
+    return n < whole_pages ? __atomic_load_n(&pages[n], __ATOMIC_ACQUIRE) : nullptr;
+}
+
+inline uint8_t memory::get8(uint32_t addr) const
+{
+    if (uint8_t *p = fast(addr))
+        return __atomic_load_n(&p[addr & (memory_page_size - 1)], __ATOMIC_RELAXED);
+    return get8_slow(addr);
+}
+
+inline uint16_t memory::get16(uint32_t addr) const
+{
+    uint8_t *p = fast(addr);
+    if (MEMORY_NATIVE_LE && !(addr & 1) && p)
+        return __atomic_load_n(reinterpret_cast<const uint16_t *>(&p[addr & (memory_page_size - 1)]), __ATOMIC_RELAXED);
+    return get16_slow(addr);
+}
+
+inline uint32_t memory::get32(uint32_t addr) const
+{
+    uint8_t *p = fast(addr);
+    if (MEMORY_NATIVE_LE && !(addr & 3) && p)
+        return __atomic_load_n(reinterpret_cast<const uint32_t *>(&p[addr & (memory_page_size - 1)]), __ATOMIC_RELAXED);
+    return get32_slow(addr);
+}
+
+inline void memory::set8(uint32_t addr, uint8_t val)
+{
+    if (uint8_t *p = fast(addr))
+        __atomic_store_n(&p[addr & (memory_page_size - 1)], val, __ATOMIC_RELAXED);
+    else
+        set8_slow(addr, val);
+}
+
+inline void memory::set16(uint32_t addr, uint16_t val)
+{
+    uint8_t *p = fast(addr);
+    if (MEMORY_NATIVE_LE && !(addr & 1) && p)
+        __atomic_store_n(reinterpret_cast<uint16_t *>(&p[addr & (memory_page_size - 1)]), val, __ATOMIC_RELAXED);
+    else
+        set16_slow(addr, val);
+}
+
+inline void memory::set32(uint32_t addr, uint32_t val)
+{
+    uint8_t *p = fast(addr);
+    if (MEMORY_NATIVE_LE && !(addr & 3) && p)
+        __atomic_store_n(reinterpret_cast<uint32_t *>(&p[addr & (memory_page_size - 1)]), val, __ATOMIC_RELAXED);
+    else
+        set32_slow(addr, val);
+}
+
 #endif // memory_H
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef pipeline_H
+#define pipeline_H
+
+#include <cstdint>
+#include <string>
+
+// Cycle-approximate model of a classic five-stage (IF/ID/EX/MEM/WB) in-order
+// pipeline, fed every instruction as it retires. See pipeline.cpp.
+class pipeline
+{
+public:
+    // forwarding: results go from EX/MEM and MEM/WB straight to EX, instead
+    // of waiting to be written back
+    pipeline(bool forwarding);
+
+    // account for insn, len bytes long (2 if compressed), run at pc, which
+    // left the pc at next_pc
+    void retire(uint32_t insn, uint32_t len, uint32_t pc, uint32_t next_pc);
+
+    uint64_t get_cycles() const;
+
+    // cycles, CPI and where the stalls came from
+    std::string render() const;
+
+private:
+    bool forwarding;
+
+    uint64_t insns;
+    uint64_t ex;         // cycle the last instruction was in EX
+    uint64_t redirect;   // bubbles before the next instruction reaches EX
+    uint64_t ready[32];  // first cycle an instruction may be in EX using each register
+    uint64_t data_stalls;
+    uint64_t load_use_stalls;
+    uint64_t branch_bubbles;
+};
+
+#endif // pipeline_H
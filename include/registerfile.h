@@ -2,6 +2,7 @@
 #define registerfile_H
 
 #include <cstdint>
+#include <ostream>
 
 class registerfile
 {
@@ -23,6 +24,6 @@ public:
      * x16 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0
      * x24 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0
      * **/
-    void dump() const;
+    void dump(std::ostream &os) const;
 };
 #endif // registerfile_H
\ No newline at end of file
@@ -2,9 +2,20 @@
 #define rv32i_H
 
 #include <cstdint>
+#include <memory>
+#include <ostream>
 #include <string>
+#include <unordered_map>
+#include <vector>
+#include "bitmanip.h"
+#include "branch.h"
+#include "cache.h"
+#include "jit.h"
+#include "loader.h"
 #include "memory.h"
+#include "pipeline.h"
 #include "registerfile.h"
+#include "vregisterfile.h"
 
 // static definitions
 static constexpr int mnemonic_width = 8;
@@ -20,6 +31,175 @@ static constexpr uint32_t opcode_load_imm = 0b0000011;
 static constexpr uint32_t opcode_alu_imm = 0b0010011;
 static constexpr uint32_t opcode_fenc_opt = 0b0001111;
 static constexpr uint32_t opcode_exc = 0b1110011;
+static constexpr uint32_t opcode_load_fp = 0b0000111;  // vector loads
+static constexpr uint32_t opcode_store_fp = 0b0100111; // vector stores
+static constexpr uint32_t opcode_vector = 0b1010111;   // vector arithmetic and vsetvl
+
+// funct7 of the RV32M multiply and divide instructions
+static constexpr uint32_t funct7_muldiv = 0b0000001;
+
+// funct7 of sfence.vma, the one opcode_exc instruction with rs2 an operand
+static constexpr uint32_t funct7_sfence_vma = 0b0001001;
+
+// CSR numbers
+static constexpr uint32_t csr_satp = 0x180;
+static constexpr uint32_t csr_mhartid = 0xf14;
+static constexpr uint32_t csr_vl = 0xc20;
+static constexpr uint32_t csr_vtype = 0xc21;
+static constexpr uint32_t csr_vlenb = 0xc22;
+
+// vtype.vill, set while vtype holds no valid setting (as after reset)
+static constexpr uint32_t vtype_vill = 1u << 31;
+
+// Sv32 virtual memory: 4 KiB pages, and the number of translations held by
+// the direct-mapped TLB
+static constexpr uint32_t page_shift = 12;
+static constexpr uint32_t tlb_entries = 256;
+
+// The kinds of memory access, each the PTE permission bit (R, W or X) it
+// needs, shifted down to bit 0
+enum access_type
+{
+    access_load = 1,
+    access_store = 2,
+    access_fetch = 4,
+};
+
+// One cached translation: virtual page vpn is physical page ppn, for the
+// accesses in perms (0 for an empty entry)
+struct tlb_entry
+{
+    uint32_t vpn;
+    uint32_t ppn;
+    uint32_t perms;
+};
+
+// bytes of stack given to each hart below the one before it (hart 0 starts
+// with x2 at the end of memory)
+static constexpr uint32_t hart_stack_size = 0x1000;
+
+// number of instructions held by one lazily allocated page of the instruction cache
+static constexpr uint32_t icache_page_insns = 1024;
+
+// RV32M results, including those the spec defines for division by zero
+// (quotient all ones, remainder the dividend) and for the one signed
+// overflow, -2^31 / -1 (quotient -2^31, remainder 0)
+inline uint32_t rv32m_mulh(uint32_t a, uint32_t b)
+{
+    return (uint64_t)((int64_t)(int32_t)a * (int32_t)b) >> 32;
+}
+inline uint32_t rv32m_mulhsu(uint32_t a, uint32_t b)
+{
+    return (uint64_t)((int64_t)(int32_t)a * (int64_t)b) >> 32;
+}
+inline uint32_t rv32m_mulhu(uint32_t a, uint32_t b)
+{
+    return ((uint64_t)a * b) >> 32;
+}
+inline uint32_t rv32m_div(uint32_t a, uint32_t b)
+{
+    if (b == 0)
+        return 0xffffffff;
+    if (a == 0x80000000 && b == 0xffffffff)
+        return a;
+    return (int32_t)a / (int32_t)b;
+}
+inline uint32_t rv32m_divu(uint32_t a, uint32_t b)
+{
+    return b ? a / b : 0xffffffff;
+}
+inline uint32_t rv32m_rem(uint32_t a, uint32_t b)
+{
+    if (b == 0)
+        return a;
+    if (a == 0x80000000 && b == 0xffffffff)
+        return 0;
+    return (int32_t)a % (int32_t)b;
+}
+inline uint32_t rv32m_remu(uint32_t a, uint32_t b)
+{
+    return b ? a % b : a;
+}
+
+class rv32i;
+struct aot_block;
+struct aot_image;
+
+// Trace policies the exec_* handlers are instantiated with. The trace_off
+// instantiations contain no rendering code at all; run() and the engines use
+// them whenever neither -i nor -r is given.
+struct trace_off
+{
+    static constexpr bool enabled = false;
+};
+struct trace_on
+{
+    static constexpr bool enabled = true;
+};
+
+// An instruction decoded once: the exec_* member function that executes it, the
+// raw instruction word (used for rendering; for a compressed instruction, the
+// 32-bit instruction it expands to), its register indices, its sign-extended
+// immediate (for whichever format the instruction uses) and its length
+struct decoded_insn
+{
+    void (rv32i::*handler)(const decoded_insn &d, std::ostream *pos);
+    uint32_t insn;
+    int32_t imm;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t fused; // 1 when handler also runs the next instruction (see fuse.cpp)
+    uint8_t len;   // bytes the pc advances past it: 4, or 2 when compressed
+};
+
+struct threaded_insn;
+struct threaded_context;
+
+// An instruction prepared for the threaded engine (see threaded.cpp): where to
+// continue to execute it, plus its operands. rd is 32 (a scratch slot) when the
+// instruction writes x0 so that no op has to test for it.
+struct threaded_insn
+{
+    union
+    {
+        const void *label;                                                  // computed goto
+        const threaded_insn *(*fn)(threaded_context &, const threaded_insn *); // call threading
+    };
+    int32_t imm;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t len;
+};
+
+// the instruction execution engines run() can use
+enum engine_type
+{
+    engine_ref,      // tick() with the predecoded instruction cache
+    engine_threaded, // direct-threaded dispatch, see threaded.cpp
+    engine_block,    // cached basic blocks chained together, see block.cpp
+    engine_jit,      // the block engine with hot blocks compiled to native code, see jit.cpp
+    engine_jitdiff,  // engine_jit checking every compiled block against the handlers
+    engine_aot,      // blocks translated ahead of time by -a and linked in, see aot.cpp
+};
+
+// number of instructions per line of the code map (see code_lines)
+static constexpr uint32_t code_line_insns = 16;
+
+// A basic block translated by the block engine (see block.cpp): the predecoded
+// instructions from start up to and including the first jal, jalr, branch,
+// ebreak (or other instruction that may stop the hart), and the blocks that
+// execution was last seen to continue to from its two exits
+struct translated_block
+{
+    uint32_t start;
+    std::vector<decoded_insn> ops;
+    uint32_t next_pc[2];
+    translated_block *next[2];
+    uint32_t runs;         // times the block has been run
+    jit_block_fn native;   // compiled code for the block, if any
+};
 
 class rv32i
 {
@@ -28,6 +208,41 @@ private:
     memory *mem;
     uint32_t pc;
     static constexpr uint32_t XLEN = 32;
+    uint32_t hartid;
+
+    // where reset() starts, and the names disasm() labels addresses with, if any
+    uint32_t entry;
+    const symbol_table *symbols;
+
+    // where traces, dumps and messages go (std::cout), and errors (std::cerr)
+    std::ostream *out;
+    std::ostream *err;
+
+    // CSR accesses, false for a missing or read-only CSR
+    bool csr_read(uint32_t csr, uint32_t &val) const;
+    bool csr_write(uint32_t csr, uint32_t val);
+
+    // Sv32 virtual memory (see vm.cpp): satp as last written, whether it
+    // turns translation on, and the TLB
+    uint32_t satp;
+    bool paging;
+    tlb_entry tlb[tlb_entries];
+    void flush_tlb();
+
+    // Translate virtual address addr in place for access a, walking the page
+    // table on a TLB miss. Returns false (with a message, halting) on a page
+    // fault. Only to be called when paging.
+    bool translate(uint32_t &addr, access_type a);
+    bool walk(uint32_t &addr, access_type a);
+
+    // The V extension (see vector.cpp): the vector registers, vl and vtype
+    vregisterfile vregs;
+    uint32_t vl;
+    uint32_t vtype;
+    void reset_vector();
+    bool vector_check(uint32_t insn, uint32_t vd, uint32_t dest8) const;
+    template <class trace> static bool predecode_vector(uint32_t insn, decoded_insn &d);
+    void model_vector_access(uint32_t insn);
 
     // Member variables from Assignment 5
     registerfile regs;
@@ -36,10 +251,116 @@ private:
     bool show_registers;
     uint64_t insn_counter;
 
+    // Predecoded instruction cache indexed by pc/4, split into pages that are
+    // allocated on first execution of an instruction within them. An entry
+    // with a null handler has not been decoded yet (or was invalidated).
+    std::vector<std::unique_ptr<decoded_insn[]>> icache;
+
+    // With the C extension (see compressed.cpp) instructions may also start
+    // 2 bytes into a word; those are cached here, indexed by pc/4 the same way
+    bool compressed;
+    std::vector<std::unique_ptr<decoded_insn[]>> icache_half;
+    decoded_insn *lookup_half(uint32_t addr);
+
+    // whether the cached handlers (and everything built from them) are the
+    // trace_on instantiations; use_trace_policy() switches and flushes
+    bool icache_traced;
+    void use_trace_policy(bool traced);
+
+    // discard everything decoded or translated from memory so far
+    void flush_decoded();
+
+    // drop the cached decoding of any instruction overlapping [addr, addr+len)
+    void invalidate(uint32_t addr, uint32_t len);
+
+    // return the instruction cache entry for addr, decoding it if needed
+    decoded_insn *lookup(uint32_t addr);
+    decoded_insn *lookup_miss(uint32_t addr);
+
+    // decode the instruction whose first halfword is lo (and, unless that is
+    // a compressed instruction, whose second is hi) into d
+    template <class trace> void predecode_at(uint16_t lo, uint16_t hi, decoded_insn &d) const;
+
+    // the cache entry for addr as a single instruction, decoded into tmp where
+    // the cache holds it fused with the next one
+    const decoded_insn *lookup_single(uint32_t addr, decoded_insn &tmp);
+
+    // Instruction fusion (see fuse.cpp): combine the entry d for addr with
+    // the next instruction where they form a known pair. insn_limit is the
+    // execution limit of the current run() (0 for none), which a fused pair
+    // must not run past.
+    uint64_t insn_limit;
+    void fuse(uint32_t addr, decoded_insn &d);
+    bool fused_second(const decoded_insn &d);
+
+    // Threaded engine state: its own per-page code cache (with extra slots at
+    // the end of each page that send execution back through a pc lookup) and
+    // the value that marks a slot as not yet prepared. With the C extension
+    // it has a slot per halfword rather than per word.
+    engine_type engine;
+    std::vector<std::unique_ptr<threaded_insn[]>> tcache;
+    threaded_insn tcache_unfilled;
+    struct threaded_engine;
+
+    // run with the threaded engine until halted or limit instructions executed
+    void run_threaded(uint64_t limit);
+
+    // One byte per code_line_insns instructions, set once any instruction in
+    // the line has been decoded. Stores test it to find out cheaply whether
+    // they may have modified decoded code. It is an anonymous mapping, so
+    // only the host pages holding lines of decoded code are ever allocated,
+    // however big memory is.
+    uint8_t *code_lines;
+    size_t code_lines_size;
+
+    // Block engine state: the translated blocks by start address and whether
+    // a store has hit decoded code since they were made (which discards them)
+    std::unordered_map<uint32_t, translated_block> blocks;
+    bool blocks_stale;
+    translated_block *translate(uint32_t addr);
+
+    // run with the block engine until halted or limit instructions executed
+    void run_blocks(uint64_t limit);
+
+    // JIT state: the code generator, the hart as compiled code sees it, and
+    // whether jctx rather than regs holds the current register values
+    jit jitter;
+    jit_context jctx;
+    bool jctx_live;
+    void jit_sync_in();
+    void jit_sync_out();
+    bool jit_compile(translated_block *b);
+
+    // run block b as compiled code, directly or checked against the handlers
+    void run_native(translated_block *b);
+    void run_native_checked(translated_block *b);
+
+    // run with the linked-in ahead-of-time translation until halted or limit
+    // instructions executed
+    const aot_image *aot; // found by set_engine, before other harts change memory
+    std::vector<const aot_block *> aot_table;
+    uint32_t aot_table_base; // address of the block in aot_table[0]
+    void run_aot(uint64_t limit);
+
+    // sampled simulation (see sample.cpp): after every sample_skip
+    // instructions run by the engine, a detailed window of sample_window
+    // instructions is measured. A sample_window of 0 turns sampling off.
+    uint64_t sample_window;
+    uint64_t sample_skip;
+    void run_sampled(uint64_t limit);
+
+    // timing, cache and branch models fed by run_modelled() with every
+    // instruction, or nullptr
+    std::unique_ptr<pipeline> timing;
+    std::unique_ptr<cache_hierarchy> caches;
+    std::unique_ptr<branch_model> branches;
+    void run_modelled(uint64_t limit);
+
 public:
     // Member functions from Assignment 4
     // Save the m argument in the mem member variable for use later when disassembling
     rv32i(memory *m);
+    ~rv32i();
 
     // This method will be used to disassemble the instructions in the simulated memory
     // To perform this task, set pc to zero and then, for each 32-bit word in the memory
@@ -50,6 +371,15 @@ public:
     // the disassembled instruction text. This function will not print anything.
     std::string decode(uint32_t insn) const;
 
+    // Bytes taken by the instruction whose first halfword is lo: 2 for a
+    // compressed one when the C extension is on, otherwise 4
+    uint32_t insn_length(uint16_t lo) const;
+
+    // The 32-bit instruction compressed instruction insn expands to, or 0
+    // (an illegal instruction) for a reserved or unsupported encoding. See
+    // compressed.cpp.
+    static uint32_t expand_compressed(uint16_t insn);
+
     // Static Member functions from Assignment 4
 
     // Extract and return the opcode field from the given instruction
@@ -88,80 +418,166 @@ public:
     // Member functions from Assignment 5
     void set_show_instructions(bool b);
     void set_show_registers(bool b);
+    void set_engine(engine_type e);
+    void set_hartid(uint32_t id);
+    void set_entry(uint32_t addr);
+    uint32_t get_entry() const;
+    void set_symbols(const symbol_table *s);
+    void set_compressed(bool b);
+    void set_vlen(uint32_t bits);
+    void set_sampling(uint64_t window, uint64_t skip);
+    void set_timing(bool enable, bool forwarding);
+    void set_caches(cache_hierarchy *c);
+    void set_branches(branch_model *b);
+    void set_output(std::ostream *o, std::ostream *e);
+    uint64_t get_insn_counter() const;
     bool is_halted() const;
+    uint32_t get_pc() const;
+    int32_t get_reg(uint32_t r) const;
     void reset();
     void dump() const;
 
+    // Write the hart (pc, registers, instruction count, halt flag) and the
+    // memory contents to a binary checkpoint file, or read them back from one
+    // made with the same memory size. Both return false (with a message) on
+    // failure. See checkpoint.cpp for the format.
+    bool save_checkpoint(const std::string &fname) const;
+    bool load_checkpoint(const std::string &fname);
+
     // function to execute individual instruction
     void tick();
+    template <class trace> void step();
 
     // function to loop through instruction set
     void run(uint64_t limit);
+    void execute(uint64_t limit);
 
     // Instruction Execution functions
+    template <class trace> static void predecode(uint32_t insn, decoded_insn &d);
     void dcex(uint32_t insn, std::ostream *);
-    void exec_illegal_insn(uint32_t insn, std::ostream *pos);
-    void exec_ebreak(uint32_t insn, std::ostream *pos);
+    template <class trace> void exec_illegal_insn(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_ebreak(const decoded_insn &d, std::ostream *pos);
     // void exec_btype(uint32_t insn, const char *mnemonic, std::ostream *pos);
     // void exec_itype_load(uint32_t insn, const char *mnemonic, std::ostream *pos);
     // void exec_stype(uint32_t insn, const char *mnemonic, std::ostream *pos);
     // void exec_itype_alu(uint32_t insn, const char *mnemonic, int32_t imm_i, std::ostream *pos);
     // void exec_rtype(uint32_t insn, const char *mnemonic, std::ostream *pos);
-    void exec_fence(uint32_t insn, std::ostream *pos);
-    void exec_ecall(uint32_t insn, std::ostream *pos);
-    void exec_error(uint32_t insn, std::ostream *pos);
+    template <class trace> void exec_fence(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sfence_vma(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_ecall(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_error(const decoded_insn &d, std::ostream *pos);
+
+    // Zicsr Instructions
+    template <class trace> void exec_csr(const decoded_insn &d, std::ostream *pos, const char *mnemonic);
+    template <class trace> void exec_csrrw(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_csrrs(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_csrrc(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_csrrwi(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_csrrsi(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_csrrci(const decoded_insn &d, std::ostream *pos);
+
+    // Fused pairs (untraced only)
+    void exec_lui_addi(const decoded_insn &d, std::ostream *pos);
+    void exec_auipc_jalr(const decoded_insn &d, std::ostream *pos);
+    void exec_auipc_lw(const decoded_insn &d, std::ostream *pos);
+    void exec_slt_beq(const decoded_insn &d, std::ostream *pos);
+    void exec_slt_bne(const decoded_insn &d, std::ostream *pos);
+    void exec_sltu_beq(const decoded_insn &d, std::ostream *pos);
+    void exec_sltu_bne(const decoded_insn &d, std::ostream *pos);
 
     // U-Type Instructions
-    void exec_lui(uint32_t insn, std::ostream *pos);
-    void exec_auipc(uint32_t insn, std::ostream *pos);
+    template <class trace> void exec_lui(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_auipc(const decoded_insn &d, std::ostream *pos);
 
     // J-Type Instructions
-    void exec_jal(uint32_t insn, std::ostream *pos);
+    template <class trace> void exec_jal(const decoded_insn &d, std::ostream *pos);
 
     // R-Type Instructions
-    void exec_add(uint32_t insn, std::ostream *pos);
-    void exec_and(uint32_t insn, std::ostream *pos);
-    void exec_or(uint32_t insn, std::ostream *pos);
-    void exec_sll(uint32_t insn, std::ostream *pos);
-    void exec_slt(uint32_t insn, std::ostream *pos);
-    void exec_sltu(uint32_t insn, std::ostream *pos);
-    void exec_sra(uint32_t insn, std::ostream *pos);
-    void exec_srl(uint32_t insn, std::ostream *pos);
-    void exec_sub(uint32_t insn, std::ostream *pos);
-    void exec_xor(uint32_t insn, std::ostream *pos);
+    template <class trace> void exec_add(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_and(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_or(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sll(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_slt(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sltu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sra(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_srl(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sub(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_xor(const decoded_insn &d, std::ostream *pos);
+
+    // RV32M Instructions
+    template <class trace> void exec_muldiv(const decoded_insn &d, std::ostream *pos, const char *mnemonic, const char *op, uint32_t res);
+    template <class trace> void exec_mul(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_mulh(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_mulhsu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_mulhu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_div(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_divu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_rem(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_remu(const decoded_insn &d, std::ostream *pos);
+
+    // Zbb and Zba Instructions
+    template <class trace> void exec_bitmanip(const decoded_insn &d, std::ostream *pos, uint32_t res);
+    template <class trace> void exec_andn(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_orn(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_xnor(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_clz(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_ctz(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_cpop(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_max(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_maxu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_min(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_minu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sext_b(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sext_h(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_zext_h(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_rol(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_ror(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_rori(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_orc_b(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_rev8(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sh1add(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sh2add(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sh3add(const decoded_insn &d, std::ostream *pos);
+
+    // Vector Instructions
+    template <class trace> void exec_vsetvl(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_vload(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_vstore(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_vop(const decoded_insn &d, std::ostream *pos);
 
     // I-Type Instructions
-    void exec_addi(uint32_t insn, std::ostream *pos);
-    void exec_andi(uint32_t insn, std::ostream *pos);
-    void exec_jalr(uint32_t insn, std::ostream *pos);
-    void exec_lb(uint32_t insn, std::ostream *pos);
-    void exec_lh(uint32_t insn, std::ostream *pos);
-    void exec_lw(uint32_t insn, std::ostream *pos);
-    void exec_lbu(uint32_t insn, std::ostream *pos);
-    void exec_lhu(uint32_t insn, std::ostream *pos);
-    void exec_ori(uint32_t insn, std::ostream *pos);
-    void exec_slli(uint32_t insn, std::ostream *pos);
-    void exec_slti(uint32_t insn, std::ostream *pos);
-    void exec_sltiu(uint32_t insn, std::ostream *pos);
-    void exec_srai(uint32_t insn, std::ostream *pos);
-    void exec_srli(uint32_t insn, std::ostream *pos);
-    void exec_xori(uint32_t insn, std::ostream *pos);
+    template <class trace> void exec_addi(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_andi(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_jalr(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_lb(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_lh(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_lw(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_lbu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_lhu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_ori(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_slli(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_slti(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sltiu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_srai(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_srli(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_xori(const decoded_insn &d, std::ostream *pos);
 
     // S-Type Instructions
-    void exec_sb(uint32_t insn, std::ostream *pos);
-    void exec_sh(uint32_t insn, std::ostream *pos);
-    void exec_sw(uint32_t insn, std::ostream *pos);
+    template <class trace> void exec_sb(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sh(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_sw(const decoded_insn &d, std::ostream *pos);
 
     // B-Type Instructions
-    void exec_beq(uint32_t insn, std::ostream *pos);
-    void exec_bge(uint32_t insn, std::ostream *pos);
-    void exec_bgeu(uint32_t insn, std::ostream *pos);
-    void exec_blt(uint32_t insn, std::ostream *pos);
-    void exec_bltu(uint32_t insn, std::ostream *pos);
-    void exec_bne(uint32_t insn, std::ostream *pos);
+    template <class trace> void exec_beq(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_bge(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_bgeu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_blt(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_bltu(const decoded_insn &d, std::ostream *pos);
+    template <class trace> void exec_bne(const decoded_insn &d, std::ostream *pos);
 
     // String render formatting
     std::string render_illegal_insn(uint32_t insn) const;
+    std::string render_compressed(uint16_t insn) const;
     std::string render_lui(uint32_t insn) const;
     std::string render_auipc(uint32_t insn) const;
     std::string render_jal(uint32_t insn) const;
@@ -171,11 +587,47 @@ public:
     std::string render_stype(uint32_t insn, const char *mnemonic) const;
     std::string render_itype_alu(uint32_t insn, const char *mnemonic, int32_t imm_i) const;
     std::string render_rtype(uint32_t insn, const char *mnemonic) const;
+    std::string render_bitmanip(uint32_t insn, const char *mnemonic, char form) const;
+    std::string render_vector(uint32_t insn) const;
     std::string render_fence(uint32_t insn) const;
+    std::string render_sfence_vma(uint32_t insn) const;
     std::string render_ecall(uint32_t insn) const;
     std::string render_ebreak(uint32_t insn) const;
     std::string render_eror(uint32_t insn) const;
+    std::string render_csr(uint32_t csr) const;
+    std::string render_csrrx(uint32_t insn, const char *mnemonic) const;
     std::string render_total_insn_exec(uint64_t total) const;
 };
 
+// Return the instruction cache entry for addr, fetching and decoding the
+// instruction there on its first execution only. Returns nullptr for addresses
+// that cannot be cached (misaligned or outside memory). This is on the path of
+// every instruction, so it lives here to be inlined.
+inline decoded_insn *rv32i::lookup(uint32_t addr)
+{
+    if ((addr & 3) || addr >= this->mem->get_size())
+        return lookup_half(addr);
+
+    uint32_t idx = addr / 4;
+    decoded_insn *page = this->icache[idx / icache_page_insns].get();
+
+    if (!page || !page[idx % icache_page_insns].handler)
+        return lookup_miss(addr);
+
+    return &page[idx % icache_page_insns];
+}
+
+// On a TLB hit, translating costs one compare; this is on the path of every
+// load and store made with paging on, so it lives here to be inlined.
+inline bool rv32i::translate(uint32_t &addr, access_type a)
+{
+    const tlb_entry &e = this->tlb[(addr >> page_shift) % tlb_entries];
+    if (e.vpn == addr >> page_shift && (e.perms & a))
+    {
+        addr = (e.ppn << page_shift) | (addr & ((1 << page_shift) - 1));
+        return true;
+    }
+    return walk(addr, a);
+}
+
 #endif // rv32i_H
\ No newline at end of file
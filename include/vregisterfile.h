@@ -0,0 +1,49 @@
+#ifndef vregisterfile_H
+#define vregisterfile_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// The 32 vector registers of the V extension, VLEN bits each. They are kept
+// back to back, v0 first, so a register group (vN .. vN+LMUL-1) is one run of
+// bytes and the element loops can run across it. Elements are stored in
+// memory order, least significant byte first.
+class vregisterfile
+{
+private:
+    std::vector<uint8_t> registers;
+    uint32_t vlenb; // VLEN / 8
+
+    // two areas the size of the largest register group (8 registers), for
+    // scalar operands repeated into every element and for results that are
+    // merged into their destination under a mask
+    std::vector<uint8_t> scratch_area;
+
+public:
+    vregisterfile();
+
+    // Set VLEN, a power of two from 32 to 65536 bits; the contents are reset
+    void set_vlen(uint32_t bits);
+    uint32_t get_vlenb() const;
+
+    // set every register to zero
+    void reset();
+
+    // the first byte of register v and the VLEN/8 * (32 - v) bytes after it
+    uint8_t *reg(uint32_t v);
+    const uint8_t *reg(uint32_t v) const;
+
+    // scratch area i (0 or 1), 8 * VLEN/8 bytes
+    uint8_t *scratch(int i);
+
+    /**
+     * Dump the registers, one per line, as their 32-bit elements with the
+     * highest numbered on the left:
+     *  v0 00000000 00000000 00000003 00000001
+     *  v1 ...
+     * **/
+    void dump(std::ostream &os) const;
+};
+
+#endif // vregisterfile_H
@@ -0,0 +1,594 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include "include/aot.h"
+#include "include/hex.h"
+#include "include/memory.h"
+#include "include/rv32i.h"
+
+/*****************************************
+ * Ahead-of-time translation
+ *
+ * -a out.cpp walks the loaded image from its entry point, following jal,
+ * branch and return targets, and writes out one C++ function per basic block
+ * it finds. The registers a block uses are locals of its function, loaded on
+ * entry and stored back on exit. Compile the file and link it with the other
+ * objects; -e aot then runs the same image through the translated blocks.
+ *
+ * A jalr target is followed when it is a constant built up within the block
+ * (auipc+jalr, lui+addi+jalr). Other jalr targets, ecall, ebreak and any pc
+ * not translated are left to the interpreter, which runs until it reaches
+ * the start of a translated block again. If the program stores into a line
+ * of translated (or decoded) code, the rest of the run is interpreted.
+ * **************************************/
+
+// longest block translated, as in the block engine
+static constexpr size_t aot_max_block_insns = 256;
+
+typedef void (rv32i::*aot_handler)(const decoded_insn &d, std::ostream *pos);
+
+static std::vector<const aot_image *> &aot_images()
+{
+    static std::vector<const aot_image *> images;
+    return images;
+}
+
+aot_registrar::aot_registrar(const aot_image *image)
+{
+    aot_images().push_back(image);
+}
+
+// FNV-1a over every byte of memory, leaving out the pages of devices
+uint32_t aot_checksum(memory *mem)
+{
+    uint8_t p[memory_page_size];
+    uint32_t h = 2166136261u;
+    for (uint64_t page = 0; page < mem->get_size(); page += memory_page_size)
+    {
+        if (mem->is_device(page))
+            continue;
+        uint32_t len = std::min<uint64_t>(memory_page_size, mem->get_size() - page);
+        mem->read(page, p, len);
+        for (uint32_t i = 0; i < len; i++)
+            h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+const aot_image *aot_find(memory *mem)
+{
+    if (aot_images().empty())
+        return nullptr;
+
+    uint32_t sum = aot_checksum(mem);
+    for (const aot_image *image : aot_images())
+        if (image->size == mem->get_size() && image->checksum == sum)
+            return image;
+    return nullptr;
+}
+
+/*****************************************
+ * Translator
+ * **************************************/
+
+static bool aot_is_branch(aot_handler h)
+{
+    return h == &rv32i::exec_beq<trace_off> || h == &rv32i::exec_bne<trace_off> ||
+           h == &rv32i::exec_blt<trace_off> || h == &rv32i::exec_bge<trace_off> ||
+           h == &rv32i::exec_bltu<trace_off> || h == &rv32i::exec_bgeu<trace_off>;
+}
+
+// instructions left to the interpreter, which end a block just before them
+// (everything aot_emit_block has no translation for: ecall, ebreak, CSR
+// accesses, sfence.vma, illegal instructions)
+static bool aot_is_interpreted(aot_handler h)
+{
+    static const aot_handler translated[] = {
+        &rv32i::exec_lui<trace_off>, &rv32i::exec_auipc<trace_off>, &rv32i::exec_jal<trace_off>,
+        &rv32i::exec_jalr<trace_off>, &rv32i::exec_beq<trace_off>, &rv32i::exec_bne<trace_off>,
+        &rv32i::exec_blt<trace_off>, &rv32i::exec_bge<trace_off>, &rv32i::exec_bltu<trace_off>,
+        &rv32i::exec_bgeu<trace_off>, &rv32i::exec_lb<trace_off>, &rv32i::exec_lh<trace_off>,
+        &rv32i::exec_lw<trace_off>, &rv32i::exec_lbu<trace_off>, &rv32i::exec_lhu<trace_off>,
+        &rv32i::exec_sb<trace_off>, &rv32i::exec_sh<trace_off>, &rv32i::exec_sw<trace_off>,
+        &rv32i::exec_addi<trace_off>, &rv32i::exec_slti<trace_off>, &rv32i::exec_sltiu<trace_off>,
+        &rv32i::exec_xori<trace_off>, &rv32i::exec_ori<trace_off>, &rv32i::exec_andi<trace_off>,
+        &rv32i::exec_slli<trace_off>, &rv32i::exec_srli<trace_off>, &rv32i::exec_srai<trace_off>,
+        &rv32i::exec_add<trace_off>, &rv32i::exec_sub<trace_off>, &rv32i::exec_sll<trace_off>,
+        &rv32i::exec_slt<trace_off>, &rv32i::exec_sltu<trace_off>, &rv32i::exec_xor<trace_off>,
+        &rv32i::exec_srl<trace_off>, &rv32i::exec_sra<trace_off>, &rv32i::exec_or<trace_off>,
+        &rv32i::exec_and<trace_off>, &rv32i::exec_fence<trace_off>, &rv32i::exec_mul<trace_off>,
+        &rv32i::exec_mulh<trace_off>, &rv32i::exec_mulhsu<trace_off>, &rv32i::exec_mulhu<trace_off>,
+        &rv32i::exec_div<trace_off>, &rv32i::exec_divu<trace_off>, &rv32i::exec_rem<trace_off>,
+        &rv32i::exec_remu<trace_off>, &rv32i::exec_andn<trace_off>, &rv32i::exec_orn<trace_off>,
+        &rv32i::exec_xnor<trace_off>, &rv32i::exec_clz<trace_off>, &rv32i::exec_ctz<trace_off>,
+        &rv32i::exec_cpop<trace_off>, &rv32i::exec_max<trace_off>, &rv32i::exec_maxu<trace_off>,
+        &rv32i::exec_min<trace_off>, &rv32i::exec_minu<trace_off>, &rv32i::exec_sext_b<trace_off>,
+        &rv32i::exec_sext_h<trace_off>, &rv32i::exec_zext_h<trace_off>, &rv32i::exec_rol<trace_off>,
+        &rv32i::exec_ror<trace_off>, &rv32i::exec_rori<trace_off>, &rv32i::exec_orc_b<trace_off>,
+        &rv32i::exec_rev8<trace_off>, &rv32i::exec_sh1add<trace_off>, &rv32i::exec_sh2add<trace_off>,
+        &rv32i::exec_sh3add<trace_off>,
+    };
+    for (aot_handler t : translated)
+        if (h == t)
+            return false;
+    return true;
+}
+
+// The instructions of the block starting at start, and the addresses
+// execution may continue at from it
+struct aot_walk
+{
+    std::vector<decoded_insn> ops;
+    std::vector<uint32_t> next;
+};
+
+static void aot_walk_block(memory *mem, uint32_t start, aot_walk &w)
+{
+    uint64_t size = mem->get_size();
+    std::map<uint32_t, uint32_t> known; // registers holding a known constant
+    uint32_t pc = start;
+
+    while (pc + 4 <= size && !mem->is_device(pc))
+    {
+        // compressed instructions (and, without the C extension, the illegal
+        // words they would be) are left to the interpreter
+        uint32_t insn = mem->get32(pc);
+        if ((insn & 3) != 3)
+            return;
+
+        decoded_insn d;
+        rv32i::predecode<trace_off>(insn, d);
+        aot_handler h = d.handler;
+
+        if (aot_is_interpreted(h))
+        {
+            // the interpreter runs a CSR access, sfence.vma or vector instruction
+            // and carries on after it
+            uint32_t opcode = rv32i::get_opcode(d.insn);
+            if (opcode == opcode_exc && (rv32i::get_funct3(d.insn) != 0 || rv32i::get_funct7(d.insn) == funct7_sfence_vma))
+                w.next.push_back(pc + 4);
+            else if ((opcode == opcode_vector || opcode == opcode_load_fp || opcode == opcode_store_fp) && h != &rv32i::exec_illegal_insn<trace_off>)
+                w.next.push_back(pc + 4);
+            return;
+        }
+
+        w.ops.push_back(d);
+
+        if (h == &rv32i::exec_jal<trace_off>)
+        {
+            w.next.push_back(pc + d.imm);
+            if (d.rd)
+                w.next.push_back(pc + 4);
+            return;
+        }
+        if (h == &rv32i::exec_jalr<trace_off>)
+        {
+            if (known.count(d.rs1))
+                w.next.push_back((known[d.rs1] + d.imm) & 0xFFFFFFFE);
+            if (d.rd)
+                w.next.push_back(pc + 4);
+            return;
+        }
+        if (aot_is_branch(h))
+        {
+            w.next.push_back(pc + d.imm);
+            w.next.push_back(pc + 4);
+            return;
+        }
+
+        // follow the constants jalr targets are made from
+        if (h == &rv32i::exec_lui<trace_off>)
+            known[d.rd] = d.imm;
+        else if (h == &rv32i::exec_auipc<trace_off>)
+            known[d.rd] = pc + d.imm;
+        else if (h == &rv32i::exec_addi<trace_off> && known.count(d.rs1))
+            known[d.rd] = known[d.rs1] + d.imm;
+        else
+            known.erase(d.rd);
+        known[0] = 0;
+
+        pc += 4;
+        if (w.ops.size() == aot_max_block_insns)
+        {
+            w.next.push_back(pc);
+            return;
+        }
+    }
+}
+
+// source text for reading register r
+static std::string aot_reg(uint32_t r)
+{
+    return r ? "x" + std::to_string(r) : "0u";
+}
+
+static std::string aot_lit(uint32_t v)
+{
+    return hex0x32(v) + "u";
+}
+
+// a memory size as a literal, which for 4 GiB needs 64 bits
+static std::string aot_size(uint64_t size)
+{
+    return size >> 32 ? "0x100000000ull" : aot_lit(size);
+}
+
+// emit rd = expr; a load into x0 is still made, for its warnings
+static void aot_assign(std::ostream &os, uint32_t rd, const std::string &expr, bool load)
+{
+    if (rd)
+        os << "    x" << rd << " = " << expr << ";\n";
+    else if (load)
+        os << "    (void)(" << expr << ");\n";
+}
+
+// emit the exit of a block: store the registers it writes, pc and count
+static void aot_exit(std::ostream &os, const std::set<uint32_t> &written, const std::string &pc, size_t executed, bool done, const char *indent)
+{
+    for (uint32_t r : written)
+        os << indent << "s.x[" << r << "] = x" << r << ";\n";
+    os << indent << "s.pc = " << pc << ";\n";
+    os << indent << "s.executed = " << executed << ";\n";
+    os << indent << "return " << (done ? "true" : "false") << ";\n";
+}
+
+// emit the function for block w starting at start
+static void aot_emit_block(std::ostream &os, const rv32i &cpu, uint32_t start, const aot_walk &w, uint64_t size, int line_shift)
+{
+    std::set<uint32_t> used, written;
+    for (const decoded_insn &d : w.ops)
+    {
+        aot_handler h = d.handler;
+        bool stores = h == &rv32i::exec_sb<trace_off> || h == &rv32i::exec_sh<trace_off> || h == &rv32i::exec_sw<trace_off>;
+        bool rtype = rv32i::get_opcode(d.insn) == opcode_rtype;
+        bool reads_rs1 = !(h == &rv32i::exec_lui<trace_off> || h == &rv32i::exec_auipc<trace_off> ||
+                           h == &rv32i::exec_jal<trace_off> || h == &rv32i::exec_fence<trace_off>);
+        bool reads_rs2 = rtype || stores || aot_is_branch(h);
+        if (d.rs1 == d.rs2 && (aot_is_branch(h) || h == &rv32i::exec_slt<trace_off> || h == &rv32i::exec_sltu<trace_off>))
+            reads_rs1 = reads_rs2 = false; // the result is known, see below
+        bool writes_rd = !(stores || aot_is_branch(h) || h == &rv32i::exec_fence<trace_off>);
+
+        if (reads_rs1 && d.rs1)
+            used.insert(d.rs1);
+        if (reads_rs2 && d.rs2)
+            used.insert(d.rs2);
+        if (writes_rd && d.rd)
+        {
+            used.insert(d.rd);
+            written.insert(d.rd);
+        }
+    }
+
+    os << "\nstatic bool block_" << hex32(start) << "(aot_state &s)\n{\n";
+    for (uint32_t r : used)
+        os << "    uint32_t x" << r << " = s.x[" << r << "];\n";
+
+    uint32_t pc = start;
+    for (size_t i = 0; i < w.ops.size(); i++, pc += 4)
+    {
+        const decoded_insn &d = w.ops[i];
+        aot_handler h = d.handler;
+        std::string a = aot_reg(d.rs1), b = aot_reg(d.rs2), imm = aot_lit(d.imm);
+        std::string sh = std::to_string(d.imm & 0x1f);
+
+        os << "    // " << hex32(pc) << ": " << cpu.decode(d.insn) << "\n";
+
+        if (h == &rv32i::exec_lui<trace_off>)
+            aot_assign(os, d.rd, imm, false);
+        else if (h == &rv32i::exec_auipc<trace_off>)
+            aot_assign(os, d.rd, aot_lit(pc + d.imm), false);
+        else if (h == &rv32i::exec_addi<trace_off>)
+            aot_assign(os, d.rd, a + " + " + imm, false);
+        else if (h == &rv32i::exec_slti<trace_off>)
+            aot_assign(os, d.rd, "(int32_t)" + a + " < (int32_t)" + imm + " ? 1u : 0u", false);
+        else if (h == &rv32i::exec_sltiu<trace_off>)
+            aot_assign(os, d.rd, a + " < " + imm + " ? 1u : 0u", false);
+        else if (h == &rv32i::exec_xori<trace_off>)
+            aot_assign(os, d.rd, a + " ^ " + imm, false);
+        else if (h == &rv32i::exec_ori<trace_off>)
+            aot_assign(os, d.rd, a + " | " + imm, false);
+        else if (h == &rv32i::exec_andi<trace_off>)
+            aot_assign(os, d.rd, a + " & " + imm, false);
+        else if (h == &rv32i::exec_slli<trace_off>)
+            aot_assign(os, d.rd, a + " << " + sh, false);
+        else if (h == &rv32i::exec_srli<trace_off>)
+            aot_assign(os, d.rd, a + " >> " + sh, false);
+        else if (h == &rv32i::exec_srai<trace_off>)
+            aot_assign(os, d.rd, "(uint32_t)((int32_t)" + a + " >> " + sh + ")", false);
+        else if (h == &rv32i::exec_add<trace_off>)
+            aot_assign(os, d.rd, a + " + " + b, false);
+        else if (h == &rv32i::exec_sub<trace_off>)
+            aot_assign(os, d.rd, a + " - " + b, false);
+        else if (h == &rv32i::exec_and<trace_off>)
+            aot_assign(os, d.rd, a + " & " + b, false);
+        else if (h == &rv32i::exec_or<trace_off>)
+            aot_assign(os, d.rd, a + " | " + b, false);
+        else if (h == &rv32i::exec_xor<trace_off>)
+            aot_assign(os, d.rd, a + " ^ " + b, false);
+        else if (h == &rv32i::exec_sll<trace_off>)
+            aot_assign(os, d.rd, a + " << (" + b + " & 0x1f)", false);
+        else if (h == &rv32i::exec_srl<trace_off>)
+            aot_assign(os, d.rd, a + " >> (" + b + " & 0x1f)", false);
+        else if (h == &rv32i::exec_sra<trace_off>)
+            aot_assign(os, d.rd, "(uint32_t)((int32_t)" + a + " >> (" + b + " & 0x1f))", false);
+        else if (h == &rv32i::exec_slt<trace_off>)
+            aot_assign(os, d.rd, d.rs1 == d.rs2 ? "0u" : "(int32_t)" + a + " < (int32_t)" + b + " ? 1u : 0u", false);
+        else if (h == &rv32i::exec_sltu<trace_off>)
+            aot_assign(os, d.rd, d.rs1 == d.rs2 ? "0u" : a + " < " + b + " ? 1u : 0u", false);
+        else if (h == &rv32i::exec_mul<trace_off>)
+            aot_assign(os, d.rd, a + " * " + b, false);
+        else if (h == &rv32i::exec_mulh<trace_off>)
+            aot_assign(os, d.rd, "(uint32_t)((uint64_t)((int64_t)(int32_t)" + a + " * (int32_t)" + b + ") >> 32)", false);
+        else if (h == &rv32i::exec_mulhsu<trace_off>)
+            aot_assign(os, d.rd, "(uint32_t)((uint64_t)((int64_t)(int32_t)" + a + " * (int64_t)" + b + ") >> 32)", false);
+        else if (h == &rv32i::exec_mulhu<trace_off>)
+            aot_assign(os, d.rd, "(uint32_t)(((uint64_t)" + a + " * " + b + ") >> 32)", false);
+        else if (h == &rv32i::exec_div<trace_off>)
+            aot_assign(os, d.rd, b + " == 0 ? 0xffffffffu : " + a + " == 0x80000000u && " + b + " == 0xffffffffu ? " + a +
+                                     " : (uint32_t)((int32_t)" + a + " / (int32_t)" + b + ")", false);
+        else if (h == &rv32i::exec_divu<trace_off>)
+            aot_assign(os, d.rd, b + " == 0 ? 0xffffffffu : " + a + " / " + b, false);
+        else if (h == &rv32i::exec_rem<trace_off>)
+            aot_assign(os, d.rd, b + " == 0 ? " + a + " : " + a + " == 0x80000000u && " + b + " == 0xffffffffu ? 0u" +
+                                     " : (uint32_t)((int32_t)" + a + " % (int32_t)" + b + ")", false);
+        else if (h == &rv32i::exec_remu<trace_off>)
+            aot_assign(os, d.rd, b + " == 0 ? " + a + " : " + a + " % " + b, false);
+        else if (h == &rv32i::exec_andn<trace_off>)
+            aot_assign(os, d.rd, a + " & ~" + b, false);
+        else if (h == &rv32i::exec_orn<trace_off>)
+            aot_assign(os, d.rd, a + " | ~" + b, false);
+        else if (h == &rv32i::exec_xnor<trace_off>)
+            aot_assign(os, d.rd, "~(" + a + " ^ " + b + ")", false);
+        else if (h == &rv32i::exec_clz<trace_off>)
+            aot_assign(os, d.rd, "zbb_clz(" + a + ")", false);
+        else if (h == &rv32i::exec_ctz<trace_off>)
+            aot_assign(os, d.rd, "zbb_ctz(" + a + ")", false);
+        else if (h == &rv32i::exec_cpop<trace_off>)
+            aot_assign(os, d.rd, "zbb_cpop(" + a + ")", false);
+        else if (h == &rv32i::exec_max<trace_off>)
+            aot_assign(os, d.rd, "(int32_t)" + a + " > (int32_t)" + b + " ? " + a + " : " + b, false);
+        else if (h == &rv32i::exec_maxu<trace_off>)
+            aot_assign(os, d.rd, a + " > " + b + " ? " + a + " : " + b, false);
+        else if (h == &rv32i::exec_min<trace_off>)
+            aot_assign(os, d.rd, "(int32_t)" + a + " < (int32_t)" + b + " ? " + a + " : " + b, false);
+        else if (h == &rv32i::exec_minu<trace_off>)
+            aot_assign(os, d.rd, a + " < " + b + " ? " + a + " : " + b, false);
+        else if (h == &rv32i::exec_sext_b<trace_off>)
+            aot_assign(os, d.rd, "(uint32_t)(int8_t)" + a, false);
+        else if (h == &rv32i::exec_sext_h<trace_off>)
+            aot_assign(os, d.rd, "(uint32_t)(int16_t)" + a, false);
+        else if (h == &rv32i::exec_zext_h<trace_off>)
+            aot_assign(os, d.rd, a + " & 0xffffu", false);
+        else if (h == &rv32i::exec_rol<trace_off>)
+            aot_assign(os, d.rd, "zbb_rol(" + a + ", " + b + ")", false);
+        else if (h == &rv32i::exec_ror<trace_off>)
+            aot_assign(os, d.rd, "zbb_ror(" + a + ", " + b + ")", false);
+        else if (h == &rv32i::exec_rori<trace_off>)
+            aot_assign(os, d.rd, "zbb_ror(" + a + ", " + sh + ")", false);
+        else if (h == &rv32i::exec_orc_b<trace_off>)
+            aot_assign(os, d.rd, "zbb_orc_b(" + a + ")", false);
+        else if (h == &rv32i::exec_rev8<trace_off>)
+            aot_assign(os, d.rd, "zbb_rev8(" + a + ")", false);
+        else if (h == &rv32i::exec_sh1add<trace_off>)
+            aot_assign(os, d.rd, "(" + a + " << 1) + " + b, false);
+        else if (h == &rv32i::exec_sh2add<trace_off>)
+            aot_assign(os, d.rd, "(" + a + " << 2) + " + b, false);
+        else if (h == &rv32i::exec_sh3add<trace_off>)
+            aot_assign(os, d.rd, "(" + a + " << 3) + " + b, false);
+        else if (h == &rv32i::exec_lb<trace_off>)
+            aot_assign(os, d.rd, "(uint32_t)(int8_t)s.mem->get8(" + a + " + " + imm + ")", true);
+        else if (h == &rv32i::exec_lbu<trace_off>)
+            aot_assign(os, d.rd, "s.mem->get8(" + a + " + " + imm + ")", true);
+        else if (h == &rv32i::exec_lh<trace_off>)
+            aot_assign(os, d.rd, "(uint32_t)(int16_t)s.mem->get16(" + a + " + " + imm + ")", true);
+        else if (h == &rv32i::exec_lhu<trace_off>)
+            aot_assign(os, d.rd, "s.mem->get16(" + a + " + " + imm + ")", true);
+        else if (h == &rv32i::exec_lw<trace_off>)
+            aot_assign(os, d.rd, "s.mem->get32(" + a + " + " + imm + ")", true);
+        else if (h == &rv32i::exec_sb<trace_off> || h == &rv32i::exec_sh<trace_off> || h == &rv32i::exec_sw<trace_off>)
+        {
+            // stores into code, and misaligned ones (which could reach into
+            // the next line), go to the interpreter
+            uint32_t len = h == &rv32i::exec_sb<trace_off> ? 1 : h == &rv32i::exec_sh<trace_off> ? 2 : 4;
+            os << "    {\n";
+            os << "        uint32_t addr = " << a << " + " << imm << ";\n";
+            os << "        if (" << (len > 1 ? "(addr & " + std::to_string(len - 1) + "u) || " : "") << "(addr < " << aot_size(size)
+               << " && s.code_lines[addr >> " << line_shift << "]))\n";
+            os << "        {\n";
+            aot_exit(os, written, aot_lit(pc), i, false, "            ");
+            os << "        }\n";
+            if (len == 1)
+                os << "        s.mem->set8(addr, (uint8_t)" << b << ");\n";
+            else if (len == 2)
+                os << "        s.mem->set16(addr, (uint16_t)" << b << ");\n";
+            else
+                os << "        s.mem->set32(addr, " << b << ");\n";
+            os << "    }\n";
+        }
+        else if (h == &rv32i::exec_fence<trace_off>)
+            os << "    std::atomic_thread_fence(std::memory_order_seq_cst);\n";
+        else if (h == &rv32i::exec_jal<trace_off>)
+        {
+            aot_assign(os, d.rd, aot_lit(pc + 4), false);
+            aot_exit(os, written, aot_lit(pc + d.imm), i + 1, true, "    ");
+        }
+        else if (h == &rv32i::exec_jalr<trace_off>)
+        {
+            os << "    uint32_t to = (" << a << " + " << imm << ") & 0xfffffffeu;\n";
+            aot_assign(os, d.rd, aot_lit(pc + 4), false);
+            aot_exit(os, written, "to", i + 1, true, "    ");
+        }
+        else if (aot_is_branch(h))
+        {
+            // comparing a register with itself has a known result (and would
+            // draw warnings from the compiler)
+            bool same = d.rs1 == d.rs2;
+            bool equal_taken = h == &rv32i::exec_beq<trace_off> || h == &rv32i::exec_bge<trace_off> || h == &rv32i::exec_bgeu<trace_off>;
+            std::string cond = h == &rv32i::exec_beq<trace_off>   ? a + " == " + b
+                               : h == &rv32i::exec_bne<trace_off> ? a + " != " + b
+                               : h == &rv32i::exec_blt<trace_off> ? "(int32_t)" + a + " < (int32_t)" + b
+                               : h == &rv32i::exec_bge<trace_off> ? "(int32_t)" + a + " >= (int32_t)" + b
+                               : h == &rv32i::exec_bltu<trace_off> ? a + " < " + b
+                                                                   : a + " >= " + b;
+            std::string to = same ? aot_lit(equal_taken ? pc + d.imm : pc + 4)
+                                  : "(" + cond + ") ? " + aot_lit(pc + d.imm) + " : " + aot_lit(pc + 4);
+            aot_exit(os, written, to, i + 1, true, "    ");
+        }
+    }
+
+    // a block cut short by its length, the end of memory or an instruction
+    // left to the interpreter continues at pc
+    const decoded_insn &last = w.ops.back();
+    if (!(last.handler == &rv32i::exec_jal<trace_off> || last.handler == &rv32i::exec_jalr<trace_off> || aot_is_branch(last.handler)))
+        aot_exit(os, written, aot_lit(pc), w.ops.size(), true, "    ");
+
+    os << "}\n";
+}
+
+size_t aot_translate(const rv32i &cpu, memory *mem, std::ostream &os)
+{
+    uint64_t size = mem->get_size();
+
+    // find the blocks reachable from the entry point
+    std::map<uint32_t, aot_walk> blocks;
+    std::vector<uint32_t> todo = {cpu.get_entry()};
+    while (!todo.empty())
+    {
+        uint32_t start = todo.back();
+        todo.pop_back();
+        if ((start & 3) || start >= size || blocks.count(start))
+            continue;
+
+        aot_walk &w = blocks[start];
+        aot_walk_block(mem, start, w);
+        for (uint32_t n : w.next)
+            todo.push_back(n);
+    }
+
+    // stores test rv32i::code_lines, of code_line_insns instructions a line
+    int line_shift = 0;
+    while ((1u << line_shift) < 4 * code_line_insns)
+        line_shift++;
+
+    os << "// Ahead-of-time translation of a " << size << " byte image, written by rv32i -a.\n";
+    os << "// Compile and link with the simulator, then run the same image with -e aot.\n\n";
+    os << "#include <atomic>\n\n";
+    os << "#include \"include/aot.h\"\n";
+    os << "#include \"include/bitmanip.h\"\n";
+    os << "#include \"include/memory.h\"\n";
+
+    size_t count = 0;
+    for (const auto &b : blocks)
+    {
+        if (b.second.ops.empty())
+            continue;
+        aot_emit_block(os, cpu, b.first, b.second, size, line_shift);
+        count++;
+    }
+
+    // (an image with nothing to translate still registers, so it is recognised)
+    if (count)
+    {
+        os << "\nstatic const aot_block blocks[] = {\n";
+        for (const auto &b : blocks)
+            if (!b.second.ops.empty())
+                os << "    {" << hex0x32(b.first) << ", " << b.second.ops.size() << ", block_" << hex32(b.first) << "},\n";
+        os << "};\n\n";
+    }
+    else
+        os << "\n";
+    os << "static const aot_image image = {" << aot_size(size) << ", " << aot_lit(aot_checksum(mem)) << ", "
+       << (count ? "blocks" : "nullptr") << ", " << count << "};\n";
+    os << "static aot_registrar registrar(&image);\n";
+
+    return count;
+}
+
+/*****************************************
+ * AOT engine
+ * **************************************/
+
+// Run with the linked-in translation of the loaded image until halted or
+// limit instructions executed, interpreting wherever there is none
+void rv32i::run_aot(uint64_t limit)
+{
+    // the block starting at each instruction, if any (kept from one call to
+    // the next, until flush_decoded())
+    const aot_image *image = this->aot;
+    std::vector<const aot_block *> &table = this->aot_table;
+    if (image && table.empty())
+    {
+        // from the first block to the last, not the whole of a possibly
+        // 4 GiB memory (an image linked at 0x80000000 starts halfway up it)
+        uint32_t lo = UINT32_MAX, hi = 0;
+        for (size_t i = 0; i < image->nblocks; i++)
+        {
+            lo = std::min(lo, image->blocks[i].start);
+            hi = std::max(hi, image->blocks[i].start);
+        }
+        this->aot_table_base = lo;
+        if (image->nblocks)
+            table.resize((hi - lo) / 4 + 1, nullptr);
+        for (size_t i = 0; i < image->nblocks; i++)
+        {
+            const aot_block &b = image->blocks[i];
+            table[(b.start - lo) / 4] = &b;
+            for (uint32_t a = b.start; a < b.start + 4 * b.len; a += 4)
+                this->code_lines[a / 4 / code_line_insns] = 1;
+        }
+    }
+
+    // s.x rather than regs holds the registers while live; the translation is
+    // dropped for good once a store hits decoded or translated code
+    aot_state s;
+    s.mem = this->mem;
+    s.code_lines = this->code_lines;
+    bool live = false;
+    this->blocks_stale = false;
+
+    // turning paging on (with a CSR access, always run by tick()) leaves the
+    // rest of the run to the reference loop
+    while (!is_halted() && !this->paging && !(limit && this->insn_counter >= limit))
+    {
+        const aot_block *b = nullptr;
+        if (this->aot && !(this->pc & 3) && (this->pc - this->aot_table_base) / 4 < table.size())
+            b = table[(this->pc - this->aot_table_base) / 4];
+
+        if (!b || (limit && this->insn_counter + b->len > limit))
+        {
+            if (live)
+            {
+                for (uint32_t i = 1; i < 32; i++)
+                    this->regs.set(i, s.x[i]);
+                live = false;
+            }
+            tick();
+            if (this->blocks_stale)
+                this->aot = nullptr;
+            continue;
+        }
+
+        if (!live)
+        {
+            for (uint32_t i = 0; i < 32; i++)
+                s.x[i] = this->regs.get(i);
+            live = true;
+        }
+
+        bool done = b->fn(s);
+        this->pc = s.pc;
+        this->insn_counter += s.executed;
+
+        // stopped before a store into translated code: let tick() run it
+        if (!done)
+            this->aot = nullptr;
+    }
+
+    if (live)
+        for (uint32_t i = 1; i < 32; i++)
+            this->regs.set(i, s.x[i]);
+}
@@ -0,0 +1,301 @@
+#include <iostream>
+#include <utility>
+
+#include "include/hex.h"
+#include "include/rv32i.h"
+
+/*****************************************
+ * Block engine
+ *
+ * Code is translated a basic block at a time into the predecoded instructions
+ * of the block, cached by start address. The instructions of a block run back
+ * to back with no per-instruction pc lookup, limit or halt test, and
+ * insn_counter advances once per block. Each block remembers the blocks its
+ * exits last led to, so going from one block to the next usually needs no
+ * lookup either.
+ *
+ * A store into a line of decoded code discards every block (the chain
+ * pointers make dropping single blocks awkward), after which the block being
+ * run stops so the modified code is retranslated before it executes.
+ *
+ * With the jit engine, a block that has run jit_threshold times is compiled
+ * to native code (see jit.cpp), which runs it from then on. Compiled blocks
+ * keep the registers in jctx, so they are only copied back to regs when an
+ * exec_* handler is next needed.
+ * **************************************/
+
+// longest block translated, so that long straight-line code is split
+static constexpr size_t max_block_insns = 256;
+
+// runs of a block before the jit engine compiles it
+static constexpr uint32_t jit_threshold = 50;
+
+// instructions that may set the pc to anything but the next instruction, or
+// stop the hart
+static bool ends_block(const decoded_insn &d)
+{
+    return d.handler == &rv32i::exec_jal<trace_off> || d.handler == &rv32i::exec_jalr<trace_off> ||
+           d.handler == &rv32i::exec_beq<trace_off> || d.handler == &rv32i::exec_bne<trace_off> ||
+           d.handler == &rv32i::exec_blt<trace_off> || d.handler == &rv32i::exec_bge<trace_off> ||
+           d.handler == &rv32i::exec_bltu<trace_off> || d.handler == &rv32i::exec_bgeu<trace_off> ||
+           d.handler == &rv32i::exec_ebreak<trace_off> || d.handler == &rv32i::exec_ecall<trace_off> ||
+           d.handler == &rv32i::exec_illegal_insn<trace_off> || d.handler == &rv32i::exec_error<trace_off> ||
+           rv32i::get_opcode(d.insn) == opcode_exc || // CSR accesses halt on a missing CSR
+           // vector instructions halt on vill, a misaligned group or an unsupported encoding
+           d.handler == &rv32i::exec_vload<trace_off> || d.handler == &rv32i::exec_vstore<trace_off> ||
+           d.handler == &rv32i::exec_vop<trace_off>;
+}
+
+// Translate the block starting at addr and add it to the cache. Returns
+// nullptr if addr itself cannot be cached.
+translated_block *rv32i::translate(uint32_t addr)
+{
+    if (!lookup(addr))
+        return nullptr;
+
+    translated_block &b = this->blocks[addr];
+    b.start = addr;
+    b.ops.clear();
+
+    uint32_t pc = addr;
+    decoded_insn single;
+    const decoded_insn *d;
+    while ((d = lookup_single(pc, single)) != nullptr)
+    {
+        b.ops.push_back(*d);
+        pc += d->len;
+
+        if (ends_block(*d) || b.ops.size() == max_block_insns)
+            break;
+    }
+
+    // exit 0 is the target of a closing jal or branch, exit 1 falls through
+    const decoded_insn &last = b.ops.back();
+    bool direct = get_opcode(last.insn) == opcode_jal || get_opcode(last.insn) == opcode_btype;
+    b.next_pc[0] = direct ? pc - last.len + last.imm : pc;
+    b.next_pc[1] = pc;
+    b.next[0] = nullptr;
+    b.next[1] = nullptr;
+    b.runs = 0;
+    b.native = nullptr;
+
+    return &b;
+}
+
+// run with the block engine until halted or limit instructions executed
+void rv32i::run_blocks(uint64_t limit)
+{
+    translated_block *b = nullptr; // the block that ran last
+
+    // turning paging on (with a CSR access, which ends a block) leaves the
+    // rest of the run to the reference loop
+    while (!is_halted() && !this->paging && !(limit && this->insn_counter >= limit))
+    {
+        if (this->blocks_stale)
+        {
+            this->blocks.clear();
+            this->jitter.flush();
+            this->blocks_stale = false;
+            b = nullptr;
+        }
+
+        // follow the chain from the last block, or find the block and chain it
+        translated_block *n;
+        int exit = (b && this->pc == b->next_pc[1]) ? 1 : 0;
+        if (b && b->next[exit] && b->next_pc[exit] == this->pc)
+        {
+            n = b->next[exit];
+        }
+        else
+        {
+            auto it = this->blocks.find(this->pc);
+            n = (it != this->blocks.end()) ? &it->second : translate(this->pc);
+            if (b)
+            {
+                b->next_pc[exit] = this->pc;
+                b->next[exit] = n;
+            }
+        }
+
+        uint64_t len = n ? n->ops.size() : 0;
+
+        // an uncacheable pc, or a block that would run past the limit, goes
+        // one instruction at a time
+        if (!n || (limit && this->insn_counter + len > limit))
+        {
+            jit_sync_out();
+            tick();
+            b = nullptr;
+            continue;
+        }
+
+        if (this->engine == engine_jit || this->engine == engine_jitdiff)
+        {
+            // compile on the threshold run (the first when checking)
+            uint32_t threshold = this->engine == engine_jitdiff ? 1 : jit_threshold;
+            if (++n->runs == threshold && !jit_compile(n))
+                continue; // the code buffer is full and everything was dropped
+
+            if (n->native)
+            {
+                if (this->engine == engine_jitdiff)
+                    run_native_checked(n);
+                else
+                    run_native(n);
+
+                // a side exit leaves pc mid-block, where no chain leads
+                b = (this->pc == n->next_pc[0] || this->pc == n->next_pc[1]) ? n : nullptr;
+                continue;
+            }
+        }
+
+        jit_sync_out();
+        this->insn_counter += len;
+        for (size_t i = 0; i < len; i++)
+        {
+            const decoded_insn &d = n->ops[i];
+            (this->*d.handler)(d, nullptr);
+
+            // a store hit translated code: count only what ran and retranslate
+            if (this->blocks_stale)
+            {
+                this->insn_counter -= len - i - 1;
+                break;
+            }
+        }
+        b = n;
+    }
+
+    jit_sync_out();
+}
+
+/*****************************************
+ * JIT support
+ * **************************************/
+
+// make jctx hold the current registers
+void rv32i::jit_sync_in()
+{
+    if (this->jctx_live)
+        return;
+
+    for (uint32_t i = 0; i < 32; i++)
+        this->jctx.x[i] = this->regs.get(i);
+    this->jctx_live = true;
+}
+
+// make regs hold the current registers again
+void rv32i::jit_sync_out()
+{
+    if (!this->jctx_live)
+        return;
+
+    for (uint32_t i = 1; i < 32; i++)
+        this->regs.set(i, this->jctx.x[i]);
+    this->jctx_live = false;
+}
+
+// Compile block b. Blocks the JIT cannot handle are left to the handlers.
+// Returns false if the code buffer was full, in which case all blocks (and
+// their code) are dropped so that only code still in use gets recompiled.
+bool rv32i::jit_compile(translated_block *b)
+{
+    b->native = this->jitter.compile(*b, this->mem->get_size());
+    if (this->jitter.is_full())
+    {
+        this->blocks_stale = true;
+        return false;
+    }
+    return true;
+}
+
+// Run the compiled code of block b. If it stops early at an instruction it
+// cannot complete (an access outside memory or a store into decoded code),
+// run that instruction with tick() instead.
+void rv32i::run_native(translated_block *b)
+{
+    jit_sync_in();
+    b->native(&this->jctx);
+    this->pc = this->jctx.pc;
+    this->insn_counter += this->jctx.executed;
+
+    if (this->jctx.executed < b->ops.size())
+    {
+        jit_sync_out();
+        tick();
+    }
+}
+
+// Run block b through the handlers and then, from the same starting state, as
+// compiled code, and halt with a report if the two disagree on the registers,
+// the pc or any byte the block stored to. Instructions the compiled code
+// leaves to the interpreter run through the handlers in both passes, so out of
+// range warnings are printed twice.
+void rv32i::run_native_checked(translated_block *b)
+{
+    jit_sync_out();
+    registerfile start_regs = this->regs;
+    uint32_t start_pc = this->pc;
+
+    // reference pass, saving the old value of each byte stored to
+    std::vector<std::pair<uint32_t, uint8_t>> journal;
+    uint32_t ran = 0;
+    while (ran < b->ops.size())
+    {
+        const decoded_insn &d = b->ops[ran++];
+        if (d.handler == &rv32i::exec_sb<trace_off> || d.handler == &rv32i::exec_sh<trace_off> || d.handler == &rv32i::exec_sw<trace_off>)
+        {
+            uint32_t addr = this->regs.get(d.rs1) + d.imm;
+            uint32_t len = d.handler == &rv32i::exec_sb<trace_off> ? 1 : d.handler == &rv32i::exec_sh<trace_off> ? 2 : 4;
+            for (uint32_t i = 0; i < len; i++)
+                if (addr + i < this->mem->get_size())
+                    journal.push_back(std::make_pair(addr + i, this->mem->get8(addr + i)));
+        }
+        (this->*d.handler)(d, nullptr);
+        if (this->blocks_stale)
+            break;
+    }
+
+    registerfile ref_regs = this->regs;
+    uint32_t ref_pc = this->pc;
+    std::vector<uint8_t> ref_bytes;
+    for (const auto &j : journal)
+        ref_bytes.push_back(this->mem->get8(j.first));
+
+    // undo the reference pass, newest store first
+    for (size_t i = journal.size(); i-- > 0;)
+        this->mem->set8(journal[i].first, journal[i].second);
+    this->regs = start_regs;
+    this->pc = start_pc;
+
+    // compiled pass, finishing through the handlers where it stopped early
+    jit_sync_in();
+    b->native(&this->jctx);
+    this->pc = this->jctx.pc;
+    uint32_t executed = this->jctx.executed;
+    jit_sync_out();
+    for (uint32_t i = executed; i < ran; i++)
+        (this->*b->ops[i].handler)(b->ops[i], nullptr);
+    this->insn_counter += ran;
+
+    bool ok = executed <= ran && this->pc == ref_pc;
+    for (uint32_t i = 1; i < 32; i++)
+        ok = ok && this->regs.get(i) == ref_regs.get(i);
+    for (size_t i = 0; i < journal.size(); i++)
+        ok = ok && this->mem->get8(journal[i].first) == ref_bytes[i];
+    if (ok)
+        return;
+
+    *this->err << "JIT mismatch in block " << hex0x32(b->start) << " (" << ran << " instructions, "
+              << executed << " compiled)" << std::endl;
+    if (this->pc != ref_pc)
+        *this->err << "    pc " << hex0x32(this->pc) << " expected " << hex0x32(ref_pc) << std::endl;
+    for (uint32_t i = 1; i < 32; i++)
+        if (this->regs.get(i) != ref_regs.get(i))
+            *this->err << "    x" << i << " " << hex0x32(this->regs.get(i)) << " expected " << hex0x32(ref_regs.get(i)) << std::endl;
+    for (size_t i = 0; i < journal.size(); i++)
+        if (this->mem->get8(journal[i].first) != ref_bytes[i])
+            *this->err << "    m8(" << hex0x32(journal[i].first) << ") " << hex0x32(this->mem->get8(journal[i].first))
+                      << " expected " << hex0x32(ref_bytes[i]) << std::endl;
+    this->halt = true;
+}
@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include "include/branch.h"
+#include "include/hex.h"
+#include "include/rv32i.h"
+
+/*****************************************
+ * Branch prediction model
+ *
+ * Conditional branches are predicted by one of
+ *
+ *   static   backward taken, forward not taken
+ *   bimodal  a 2-bit counter per branch, indexed by pc
+ *   gshare   2-bit counters indexed by pc xor the global history
+ *   tage     a bimodal base and tagged tables of 3-bit counters indexed
+ *            with ever longer global histories; the longest match predicts
+ *
+ * A taken branch or a jump must also find its target: a return (jalr
+ * through x1 or x5) pops the return-address stack, which calls (jal or jalr
+ * linking x1 or x5) push; everything else looks in a direct-mapped BTB,
+ * which learns the target of every taken branch and jump. A branch is
+ * mispredicted if its direction is wrong, or it is taken and the target is.
+ * **************************************/
+
+static constexpr uint32_t counter_bits = 12;  // log2 of bimodal and gshare counters
+static constexpr uint32_t gshare_history = 12; // outcomes gshare hashes with the pc
+static constexpr uint32_t btb_entries = 512;
+static constexpr uint32_t ras_entries = 16;
+static constexpr size_t branch_report_sites = 10; // most mispredicted branches listed
+
+// a 2-bit saturating counter, taken if 2 or 3
+static void train(uint8_t &c, bool taken)
+{
+    if (taken && c < 3)
+        c++;
+    else if (!taken && c > 0)
+        c--;
+}
+
+/*****************************************
+ * Direction predictors
+ * **************************************/
+
+class static_predictor : public direction_predictor
+{
+public:
+    bool predict(uint32_t pc, uint32_t target) override
+    {
+        return target < pc;
+    }
+    void update(uint32_t, bool) override
+    {
+    }
+};
+
+class bimodal_predictor : public direction_predictor
+{
+public:
+    bimodal_predictor() : counters(1 << counter_bits, 1)
+    {
+    }
+    bool predict(uint32_t pc, uint32_t) override
+    {
+        return this->counters[index(pc)] >= 2;
+    }
+    void update(uint32_t pc, bool taken) override
+    {
+        train(this->counters[index(pc)], taken);
+    }
+
+private:
+    static uint32_t index(uint32_t pc)
+    {
+        return (pc >> 2) & ((1 << counter_bits) - 1);
+    }
+    std::vector<uint8_t> counters;
+};
+
+class gshare_predictor : public direction_predictor
+{
+public:
+    gshare_predictor() : counters(1 << counter_bits, 1), history(0)
+    {
+    }
+    bool predict(uint32_t pc, uint32_t) override
+    {
+        return this->counters[index(pc)] >= 2;
+    }
+    void update(uint32_t pc, bool taken) override
+    {
+        train(this->counters[index(pc)], taken);
+        this->history = ((this->history << 1) | taken) & ((1 << gshare_history) - 1);
+    }
+
+private:
+    uint32_t index(uint32_t pc) const
+    {
+        return ((pc >> 2) ^ this->history) & ((1 << counter_bits) - 1);
+    }
+    std::vector<uint8_t> counters;
+    uint32_t history;
+};
+
+// TAGE with four tagged tables, their histories in a geometric series
+class tage_predictor : public direction_predictor
+{
+public:
+    tage_predictor() : base(1 << counter_bits, 1), history(0), branches(0)
+    {
+        for (table &t : this->tables)
+            t.entries.assign(1 << table_bits, entry{0, 0, 0});
+    }
+
+    bool predict(uint32_t pc, uint32_t) override
+    {
+        lookup(pc);
+        return this->prediction;
+    }
+
+    void update(uint32_t pc, bool taken) override
+    {
+        lookup(pc);
+
+        if (this->provider >= 0)
+        {
+            entry &e = this->tables[this->provider].entries[this->index[this->provider]];
+            // an entry is useful when it is right and what it overrode is not
+            if (this->prediction != this->alternative)
+            {
+                if (this->prediction == taken && e.useful < 3)
+                    e.useful++;
+                else if (this->prediction != taken && e.useful > 0)
+                    e.useful--;
+            }
+            if (taken && e.counter < 3)
+                e.counter++;
+            else if (!taken && e.counter > -4)
+                e.counter--;
+        }
+        else
+        {
+            train(this->base[base_index(pc)], taken);
+        }
+
+        // on a miss, take an entry no longer useful in a longer table, or
+        // age the candidates so that one will be
+        if (this->prediction != taken)
+        {
+            bool allocated = false;
+            for (int i = this->provider + 1; i < tables_count && !allocated; i++)
+            {
+                entry &e = this->tables[i].entries[this->index[i]];
+                if (e.useful == 0)
+                {
+                    e = entry{this->tag[i], (int8_t)(taken ? 0 : -1), 0};
+                    allocated = true;
+                }
+            }
+            if (!allocated)
+                for (int i = this->provider + 1; i < tables_count; i++)
+                    if (this->tables[i].entries[this->index[i]].useful > 0)
+                        this->tables[i].entries[this->index[i]].useful--;
+        }
+
+        // forget usefulness now and then so stale entries can be replaced
+        if (++this->branches % useful_reset == 0)
+            for (table &t : this->tables)
+                for (entry &e : t.entries)
+                    e.useful >>= 1;
+
+        this->history = (this->history << 1) | taken;
+    }
+
+private:
+    static constexpr int tables_count = 4;
+    static constexpr uint32_t table_bits = 10;
+    static constexpr uint32_t tag_bits = 9;
+    static constexpr uint64_t useful_reset = 256 * 1024;
+    static constexpr int lengths[tables_count] = {5, 12, 27, 64};
+
+    struct entry
+    {
+        uint16_t tag;
+        int8_t counter; // -4..3, taken if >= 0
+        uint8_t useful; // 0..3
+    };
+    struct table
+    {
+        std::vector<entry> entries;
+    };
+
+    static uint32_t base_index(uint32_t pc)
+    {
+        return (pc >> 2) & ((1 << counter_bits) - 1);
+    }
+
+    // the last length outcomes folded into bits bits
+    uint32_t fold(int length, uint32_t bits) const
+    {
+        uint64_t h = length < 64 ? this->history & ((1ull << length) - 1) : this->history;
+        uint32_t f = 0;
+        for (; h; h >>= bits)
+            f ^= h & ((1u << bits) - 1);
+        return f;
+    }
+
+    // find the provider and alternative predictions for pc
+    void lookup(uint32_t pc)
+    {
+        this->provider = -1;
+        this->prediction = this->alternative = this->base[base_index(pc)] >= 2;
+        for (int i = 0; i < tables_count; i++)
+        {
+            this->index[i] = ((pc >> 2) ^ (pc >> (2 + table_bits)) ^ fold(lengths[i], table_bits)) & ((1 << table_bits) - 1);
+            this->tag[i] = ((pc >> 2) ^ (fold(lengths[i], tag_bits) << 1) ^ fold(lengths[i], tag_bits - 1)) & ((1 << tag_bits) - 1);
+            const entry &e = this->tables[i].entries[this->index[i]];
+            if (e.tag == this->tag[i])
+            {
+                this->alternative = this->prediction;
+                this->prediction = e.counter >= 0;
+                this->provider = i;
+            }
+        }
+    }
+
+    std::vector<uint8_t> base;
+    table tables[tables_count];
+    uint64_t history;
+    uint64_t branches;
+
+    // from the last lookup
+    uint32_t index[tables_count];
+    uint16_t tag[tables_count];
+    int provider; // longest table that matched, or -1 for the base
+    bool prediction;
+    bool alternative; // what the next longest match (or the base) predicts
+};
+
+constexpr int tage_predictor::lengths[];
+
+direction_predictor *make_predictor(const std::string &name)
+{
+    if (name == "static")
+        return new static_predictor();
+    if (name == "bimodal")
+        return new bimodal_predictor();
+    if (name == "gshare")
+        return new gshare_predictor();
+    if (name == "tage")
+        return new tage_predictor();
+    return nullptr;
+}
+
+/*****************************************
+ * Front end
+ * **************************************/
+
+// x1 (ra) and x5 (t0) hold return addresses by convention
+static bool is_link(uint32_t r)
+{
+    return r == 1 || r == 5;
+}
+
+branch_model::branch_model(const std::string &name, direction_predictor *p)
+    : name(name), predictor(p), btb(btb_entries, btb_entry{0, 0}), ras(ras_entries, 0)
+{
+    this->ras_top = 0;
+    this->branches = 0;
+    this->direction_misses = 0;
+    this->target_misses = 0;
+    this->jumps = 0;
+    this->returns = 0;
+    this->return_misses = 0;
+}
+
+uint32_t branch_model::btb_lookup(uint32_t pc, uint32_t len) const
+{
+    const btb_entry &e = this->btb[(pc >> 2) & (btb_entries - 1)];
+    return e.pc == pc && e.target ? e.target : pc + len;
+}
+
+void branch_model::retire(uint32_t insn, uint32_t len, uint32_t pc, uint32_t next_pc)
+{
+    uint32_t opcode = rv32i::get_opcode(insn);
+    if (opcode != opcode_btype && opcode != opcode_jal && opcode != opcode_jalr)
+        return;
+
+    bool taken = next_pc != pc + len;
+    bool miss;
+
+    if (opcode == opcode_btype)
+    {
+        this->branches++;
+        bool guess = this->predictor->predict(pc, pc + rv32i::get_imm_b(insn));
+        this->predictor->update(pc, taken);
+        if (guess != taken)
+        {
+            this->direction_misses++;
+            miss = true;
+        }
+        else
+        {
+            miss = taken && btb_lookup(pc, len) != next_pc;
+            this->target_misses += miss;
+        }
+    }
+    else
+    {
+        this->jumps++;
+        uint32_t rd = rv32i::get_rd(insn);
+        uint32_t rs1 = rv32i::get_rs1(insn);
+        bool pop = opcode == opcode_jalr && is_link(rs1) && rs1 != rd;
+        bool push = is_link(rd);
+
+        uint32_t guess;
+        if (pop)
+        {
+            this->ras_top = (this->ras_top + ras_entries - 1) % ras_entries;
+            guess = this->ras[this->ras_top];
+            this->returns++;
+        }
+        else
+        {
+            guess = btb_lookup(pc, len);
+        }
+        if (push)
+        {
+            this->ras[this->ras_top] = pc + len;
+            this->ras_top = (this->ras_top + 1) % ras_entries;
+        }
+
+        miss = guess != next_pc;
+        if (miss && pop)
+            this->return_misses++;
+        else if (miss)
+            this->target_misses++;
+    }
+
+    if (taken)
+        this->btb[(pc >> 2) & (btb_entries - 1)] = btb_entry{pc, next_pc};
+
+    site &s = this->sites[pc];
+    s.insn = insn;
+    s.executed++;
+    s.taken += taken;
+    s.mispredicted += miss;
+}
+
+std::string branch_model::render(const std::function<std::string(uint32_t, uint32_t)> &disasm) const
+{
+    std::ostringstream os;
+    uint64_t misses = this->direction_misses + this->target_misses + this->return_misses;
+    uint64_t total = this->branches + this->jumps;
+
+    os << "Branch prediction (" << this->name << "): " << total << " branches and jumps, " << misses
+       << " mispredicted (" << std::fixed << std::setprecision(2) << (total ? 100.0 * misses / total : 0.0) << "%)"
+       << std::endl;
+    os << "    " << this->branches << " conditional branches, " << this->direction_misses << " wrong direction"
+       << std::endl;
+    os << "    " << this->target_misses << " wrong targets from the BTB, " << this->return_misses << " of "
+       << this->returns << " returns wrong from the return-address stack" << std::endl;
+
+    std::vector<std::pair<uint32_t, const site *>> worst;
+    for (const auto &s : this->sites)
+        if (s.second.mispredicted)
+            worst.push_back({s.first, &s.second});
+    std::sort(worst.begin(), worst.end(), [](const std::pair<uint32_t, const site *> &a, const std::pair<uint32_t, const site *> &b) {
+        return a.second->mispredicted != b.second->mispredicted ? a.second->mispredicted > b.second->mispredicted : a.first < b.first;
+    });
+    if (worst.size() > branch_report_sites)
+        worst.resize(branch_report_sites);
+
+    os << "    most mispredicted:      executed       taken  mispredicted";
+    for (const auto &w : worst)
+    {
+        const site &s = *w.second;
+        os << std::endl
+           << "    " << hex32(w.first) << std::setw(24) << s.executed << std::setw(12) << s.taken << std::setw(14)
+           << s.mispredicted << std::setw(8) << 100.0 * s.mispredicted / s.executed << "%  " << disasm(w.first, s.insn);
+    }
+    return os.str();
+}
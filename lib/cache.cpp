@@ -0,0 +1,325 @@
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "include/cache.h"
+
+/*****************************************
+ * Cache hierarchy model
+ *
+ * Split L1 instruction and data caches in front of a unified L2, fed with
+ * the address of every instruction fetch and data access. Only the tags
+ * are kept, not the data, so the model counts hits and misses but never
+ * changes what the program computes.
+ *
+ * A write-back level marks lines dirty and writes them to the level below
+ * when they are evicted; on a write miss it first reads the line in. A
+ * write-through level passes every write on to the level below and does
+ * not fill a line on a write miss. An access that straddles lines is an
+ * access to each of them.
+ * **************************************/
+
+static bool is_power_of_2(uint32_t v)
+{
+    return v && !(v & (v - 1));
+}
+
+static uint32_t log2_of(uint32_t v)
+{
+    uint32_t n = 0;
+    while (v >>= 1)
+        n++;
+    return n;
+}
+
+cache_level::cache_level(const cache_config &c)
+{
+    this->config = c;
+    this->line_shift = log2_of(c.line);
+    this->set_mask = c.size / c.line / c.ways - 1;
+    this->clock = 0;
+    this->random = 0x2545f491;
+    this->tags.assign(c.size / c.line, 0);
+    this->ages.assign(c.size / c.line, 0);
+    this->dirty.assign(c.size / c.line, 0);
+}
+
+bool cache_level::access(uint32_t addr, bool write, bool fill, uint32_t &evicted, bool &evicted_dirty)
+{
+    uint32_t tag = (addr >> this->line_shift) + 1;
+    uint32_t ways = this->config.ways;
+    uint32_t base = ((addr >> this->line_shift) & this->set_mask) * ways;
+    uint32_t *tags = &this->tags[base];
+    uint32_t *ages = &this->ages[base];
+    uint8_t *dirty = &this->dirty[base];
+    bool mark = write && this->config.write_back;
+
+    this->clock++;
+    evicted_dirty = false;
+
+    for (uint32_t w = 0; w < ways; w++)
+    {
+        if (tags[w] == tag)
+        {
+            if (this->config.replacement == replace_lru)
+                ages[w] = this->clock;
+            dirty[w] |= mark;
+            return true;
+        }
+    }
+    if (!fill)
+        return false;
+
+    // an empty way if there is one, else the victim the policy chooses
+    uint32_t victim = 0;
+    while (victim < ways && tags[victim])
+        victim++;
+    if (victim == ways)
+    {
+        if (this->config.replacement == replace_random)
+        {
+            this->random ^= this->random << 13;
+            this->random ^= this->random >> 17;
+            this->random ^= this->random << 5;
+            victim = this->random & (ways - 1);
+        }
+        else
+        {
+            // ages are compared as distances from now so the clock may wrap
+            victim = 0;
+            for (uint32_t w = 1; w < ways; w++)
+                if (this->clock - ages[w] > this->clock - ages[victim])
+                    victim = w;
+        }
+        if (dirty[victim])
+        {
+            evicted = (tags[victim] - 1) << this->line_shift;
+            evicted_dirty = true;
+        }
+    }
+
+    tags[victim] = tag;
+    ages[victim] = this->clock;
+    dirty[victim] = mark;
+    return false;
+}
+
+const cache_config &cache_level::get_config() const
+{
+    return this->config;
+}
+
+cache_hierarchy::cache_hierarchy(const cache_config &l1i, const cache_config &l1d, const cache_config &l2)
+    : l1i(l1i), l1d(l1d), l2(l2)
+{
+    this->l1i_counts = counts();
+    this->l1d_counts = counts();
+    this->l2_counts = counts();
+    this->memory_reads = 0;
+    this->memory_writes = 0;
+}
+
+void cache_hierarchy::fetch(uint32_t addr, uint32_t len)
+{
+    access_range(0, addr, len, false);
+}
+
+void cache_hierarchy::load(uint32_t addr, uint32_t len)
+{
+    access_range(1, addr, len, false);
+}
+
+void cache_hierarchy::store(uint32_t addr, uint32_t len)
+{
+    access_range(1, addr, len, true);
+}
+
+// access every L1 line that len bytes at addr touch
+void cache_hierarchy::access_range(int side, uint32_t addr, uint32_t len, bool write)
+{
+    uint32_t line = (side ? this->l1d : this->l1i).get_config().line;
+    uint32_t first = addr / line;
+    uint32_t last = (addr + len - 1) / line;
+    for (uint32_t l = first; l != last + 1; l++)
+        access_line(side, l * line, write);
+}
+
+// an access to one L1 line
+void cache_hierarchy::access_line(int side, uint32_t addr, bool write)
+{
+    cache_level &l1 = side ? this->l1d : this->l1i;
+    counts &c = side ? this->l1d_counts : this->l1i_counts;
+    const cache_config &config = l1.get_config();
+    uint32_t evicted;
+    bool evicted_dirty;
+
+    bool hit = l1.access(addr, write, !write || config.write_back, evicted, evicted_dirty);
+    if (hit)
+        c.hits[side]++;
+    else
+        c.misses[side]++;
+
+    if (evicted_dirty)
+    {
+        c.writebacks++;
+        access_l2(side, evicted, config.line, true);
+    }
+    if (write && !config.write_back)
+        access_l2(side, addr, config.line, true); // written through
+    else if (!hit)
+        access_l2(side, addr, config.line, false); // filled
+}
+
+// an access to the L2 lines that an L1 line of len bytes at addr covers
+void cache_hierarchy::access_l2(int side, uint32_t addr, uint32_t len, bool write)
+{
+    const cache_config &config = this->l2.get_config();
+    uint32_t step = config.line < len ? config.line : len;
+
+    for (uint32_t a = addr; a - addr < len; a += step)
+    {
+        uint32_t evicted;
+        bool evicted_dirty;
+        bool hit = this->l2.access(a, write, !write || config.write_back, evicted, evicted_dirty);
+        if (hit)
+            this->l2_counts.hits[side]++;
+        else
+            this->l2_counts.misses[side]++;
+
+        if (evicted_dirty)
+        {
+            this->l2_counts.writebacks++;
+            this->memory_writes++;
+        }
+        if (write && !config.write_back)
+            this->memory_writes++;
+        else if (!hit)
+            this->memory_reads++;
+    }
+}
+
+// one line of the report: the hits and misses of one side of a level
+static void render_counts(std::ostream &os, const std::string &name, uint64_t hits, uint64_t misses)
+{
+    uint64_t accesses = hits + misses;
+    os << "    " << std::left << std::setw(10) << name << std::right << std::setw(14) << accesses << std::setw(14) << hits
+       << std::setw(14) << misses << std::setw(9) << std::fixed << std::setprecision(2)
+       << (accesses ? 100.0 * misses / accesses : 0.0) << "%" << std::endl;
+}
+
+// the geometry and policies of a level, e.g. 16K 4-way 64B lines, lru, write-back
+static std::string render_config(const cache_config &c, bool writes)
+{
+    static const char *policies[] = {"lru", "fifo", "random"};
+    std::ostringstream os;
+    if (c.size % 1024)
+        os << c.size << "B";
+    else
+        os << c.size / 1024 << "K";
+    os << " " << c.ways << "-way " << c.line << "B lines, " << policies[c.replacement];
+    if (writes)
+        os << (c.write_back ? ", write-back" : ", write-through");
+    return os.str();
+}
+
+std::string cache_hierarchy::render() const
+{
+    std::ostringstream os;
+    os << "Caches: L1I " << render_config(this->l1i.get_config(), false) << std::endl;
+    os << "        L1D " << render_config(this->l1d.get_config(), true) << std::endl;
+    os << "        L2  " << render_config(this->l2.get_config(), true) << std::endl;
+    os << "                    accesses          hits        misses  miss rate" << std::endl;
+    render_counts(os, "L1I fetch", this->l1i_counts.hits[0], this->l1i_counts.misses[0]);
+    render_counts(os, "L1D data", this->l1d_counts.hits[1], this->l1d_counts.misses[1]);
+    render_counts(os, "L2 fetch", this->l2_counts.hits[0], this->l2_counts.misses[0]);
+    render_counts(os, "L2 data", this->l2_counts.hits[1], this->l2_counts.misses[1]);
+    os << "    " << this->l1d_counts.writebacks << " L1D and " << this->l2_counts.writebacks << " L2 write-backs, "
+       << this->memory_reads << " line reads and " << this->memory_writes << " writes to memory";
+    return os.str();
+}
+
+/*****************************************
+ * Configuration
+ * **************************************/
+
+// a size such as 4096, 4k or 1m
+static bool parse_size(const std::string &s, uint32_t &v)
+{
+    size_t end;
+    unsigned long n;
+    try
+    {
+        n = std::stoul(s, &end, 10);
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+    std::string suffix = s.substr(end);
+    if (suffix == "k" || suffix == "K")
+        n <<= 10;
+    else if (suffix == "m" || suffix == "M")
+        n <<= 20;
+    else if (!suffix.empty())
+        return false;
+    if (n > 0x80000000ul)
+        return false;
+    v = (uint32_t)n;
+    return true;
+}
+
+// size:ways:line[:lru|fifo|random[:wb|wt]]
+static bool parse_level(const std::string &spec, cache_config &c)
+{
+    std::vector<std::string> fields;
+    std::istringstream is(spec);
+    std::string f;
+    while (std::getline(is, f, ':'))
+        fields.push_back(f);
+    if (fields.size() < 3 || fields.size() > 5)
+        return false;
+
+    cache_config n = c;
+    if (!parse_size(fields[0], n.size) || !parse_size(fields[1], n.ways) || !parse_size(fields[2], n.line))
+        return false;
+    if (fields.size() > 3)
+    {
+        if (fields[3] == "lru")
+            n.replacement = replace_lru;
+        else if (fields[3] == "fifo")
+            n.replacement = replace_fifo;
+        else if (fields[3] == "random")
+            n.replacement = replace_random;
+        else
+            return false;
+    }
+    if (fields.size() > 4)
+    {
+        if (fields[4] != "wb" && fields[4] != "wt")
+            return false;
+        n.write_back = fields[4] == "wb";
+    }
+
+    if (!is_power_of_2(n.size) || !is_power_of_2(n.ways) || !is_power_of_2(n.line) || n.line < 4 ||
+        n.size / n.line < n.ways)
+        return false;
+    c = n;
+    return true;
+}
+
+bool cache_configure(const std::string &spec, cache_config &l1i, cache_config &l1d, cache_config &l2)
+{
+    std::istringstream is(spec);
+    std::string level;
+    while (std::getline(is, level, ','))
+    {
+        size_t eq = level.find('=');
+        if (eq == std::string::npos)
+            return false;
+        std::string name = level.substr(0, eq);
+        cache_config *c = name == "l1i" ? &l1i : name == "l1d" ? &l1d : name == "l2" ? &l2 : nullptr;
+        if (!c || !parse_level(level.substr(eq + 1), *c))
+            return false;
+    }
+    return true;
+}
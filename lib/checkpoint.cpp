@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "include/hex.h"
+#include "include/rv32i.h"
+
+/*****************************************
+ * Checkpoints
+ *
+ * A checkpoint file holds, all little-endian:
+ *
+ *     "RV32CKPT"          magic
+ *     u32 version         checkpoint_version
+ *     u32 pc
+ *     u64 insn_counter
+ *     u8  halt
+ *     u32 satp
+ *     u32 x1 .. x31
+ *     u32 vl
+ *     u32 vtype
+ *     u32 vlenb
+ *     v0 .. v31           vlenb bytes each
+ *     u64 memory size
+ *     memory, one record per checkpoint_page bytes (the last may be short):
+ *         u8 0, u8 value  every byte of the page is value
+ *         u8 1, bytes     the page as it is
+ *
+ * Untouched memory is all one fill value, so it takes two bytes a page, and
+ * pages never written are not even looked at.
+ * **************************************/
+
+static const char checkpoint_magic[8] = {'R', 'V', '3', '2', 'C', 'K', 'P', 'T'};
+static constexpr uint32_t checkpoint_version = 4;
+static constexpr uint32_t checkpoint_page = memory_page_size;
+
+static void put(std::ostream &os, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        os.put((char)(v >> (8 * i)));
+}
+
+static uint64_t get(std::istream &is, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v |= (uint64_t)(uint8_t)is.get() << (8 * i);
+    return v;
+}
+
+bool rv32i::save_checkpoint(const std::string &fname) const
+{
+    std::ofstream out(fname, std::ios::out | std::ios::binary);
+    if (!out)
+    {
+        *this->err << "Can't open file " << fname << " for writing" << std::endl;
+        return false;
+    }
+
+    out.write(checkpoint_magic, sizeof(checkpoint_magic));
+    put(out, checkpoint_version, 4);
+    put(out, this->pc, 4);
+    put(out, this->insn_counter, 8);
+    put(out, this->halt, 1);
+    put(out, this->satp, 4);
+    for (uint32_t i = 1; i < 32; i++)
+        put(out, (uint32_t)this->regs.get(i), 4);
+    put(out, this->vl, 4);
+    put(out, this->vtype, 4);
+    put(out, this->vregs.get_vlenb(), 4);
+    out.write(reinterpret_cast<const char *>(this->vregs.reg(0)), 32 * this->vregs.get_vlenb());
+
+    uint64_t size = this->mem->get_size();
+    put(out, size, 8);
+    for (uint64_t page = 0; page < size; page += checkpoint_page)
+    {
+        uint32_t len = std::min<uint64_t>(checkpoint_page, size - page);
+        const uint8_t *p = this->mem->get_page(page);
+        bool uniform = !p || std::count(p, p + len, p[0]) == (std::ptrdiff_t)len;
+
+        put(out, uniform ? 0 : 1, 1);
+        if (uniform)
+            put(out, p ? p[0] : 0xa5, 1);
+        else
+            out.write(reinterpret_cast<const char *>(p), len);
+    }
+
+    if (!out)
+    {
+        *this->err << "Can't write checkpoint " << fname << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool rv32i::load_checkpoint(const std::string &fname)
+{
+    std::ifstream in(fname, std::ios::in | std::ios::binary);
+    if (!in)
+    {
+        *this->err << "Can't open file " << fname << " for reading" << std::endl;
+        return false;
+    }
+
+    char magic[sizeof(checkpoint_magic)];
+    in.read(magic, sizeof(magic));
+    if (!in || memcmp(magic, checkpoint_magic, sizeof(magic)) != 0)
+    {
+        *this->err << fname << " is not a checkpoint" << std::endl;
+        return false;
+    }
+    uint32_t version = get(in, 4);
+    if (version != checkpoint_version)
+    {
+        *this->err << fname << " is a version " << version << " checkpoint, expected version " << checkpoint_version << std::endl;
+        return false;
+    }
+
+    uint32_t pc = get(in, 4);
+    uint64_t count = get(in, 8);
+    bool halt = get(in, 1) != 0;
+    uint32_t satp = get(in, 4);
+    uint32_t x[32];
+    for (uint32_t i = 1; i < 32; i++)
+        x[i] = get(in, 4);
+
+    uint32_t vl = get(in, 4);
+    uint32_t vtype = get(in, 4);
+    uint32_t vlenb = get(in, 4);
+    if (in && vlenb != this->vregs.get_vlenb())
+    {
+        *this->err << fname << " was saved with VLEN " << 8 * vlenb << ", use -v" << 8 * vlenb << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> v(32 * vlenb);
+    in.read(reinterpret_cast<char *>(v.data()), v.size());
+
+    uint64_t size = get(in, 8);
+    if (in && size != this->mem->get_size())
+    {
+        *this->err << fname << " was saved with 0x" << std::hex << size << " bytes of memory, use -m"
+                  << size << std::dec << std::endl;
+        return false;
+    }
+
+    // read memory aside first so a bad file leaves the simulator as it was:
+    // the fill value of each uniform page, and the bytes of the others
+    std::vector<uint8_t> fill(size / checkpoint_page + 1);
+    std::vector<std::vector<uint8_t>> data(fill.size());
+    for (uint64_t page = 0; in && page < size; page += checkpoint_page)
+    {
+        uint32_t len = std::min<uint64_t>(checkpoint_page, size - page);
+        if (get(in, 1) == 0)
+            fill[page / checkpoint_page] = get(in, 1);
+        else
+        {
+            data[page / checkpoint_page].resize(len);
+            in.read(reinterpret_cast<char *>(data[page / checkpoint_page].data()), len);
+        }
+    }
+    if (!in)
+    {
+        *this->err << "Checkpoint " << fname << " is truncated" << std::endl;
+        return false;
+    }
+
+    // a page of 0xa5 that was never written can stay that way, and the pages
+    // of devices keep their registers
+    for (uint64_t page = 0; page < size; page += checkpoint_page)
+    {
+        uint32_t len = std::min<uint64_t>(checkpoint_page, size - page);
+        std::vector<uint8_t> &bytes = data[page / checkpoint_page];
+        if ((bytes.empty() && fill[page / checkpoint_page] == 0xa5 && !this->mem->get_page(page)) || this->mem->is_device(page))
+            continue;
+        if (bytes.empty())
+            bytes.assign(len, fill[page / checkpoint_page]);
+        this->mem->write(page, bytes.data(), len);
+    }
+    this->pc = pc;
+    this->insn_counter = count;
+    this->halt = halt;
+    for (uint32_t i = 1; i < 32; i++)
+        this->regs.set(i, x[i]);
+    this->vl = vl;
+    this->vtype = vtype;
+    memcpy(this->vregs.reg(0), v.data(), v.size());
+    csr_write(csr_satp, satp);
+
+    // whatever was decoded from the old memory contents no longer applies
+    flush_decoded();
+    this->jctx_live = false;
+    return true;
+}
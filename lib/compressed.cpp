@@ -0,0 +1,187 @@
+#include "include/rv32i.h"
+
+/*****************************************
+ * RV32C compressed instructions
+ *
+ * With the C extension on (-C), a halfword whose two low bits are not both
+ * set is a whole 16-bit instruction, and instructions need only be 2-byte
+ * aligned. Every compressed instruction is shorthand for a 32-bit one, so it
+ * is expanded once, when it is decoded into the instruction cache, and from
+ * then on runs with the same handler as the instruction it expands to; the
+ * only difference is the length of 2 in its cache entry, by which the
+ * handlers step the pc and form return addresses.
+ *
+ * The floating-point loads and stores (c.flw, c.fld and the rest) have no
+ * 32-bit equivalent here and, like the reserved encodings, expand to 0, an
+ * illegal instruction.
+ * **************************************/
+
+// the 32-bit instruction formats, from their fields
+static uint32_t enc_r(uint32_t opcode, uint32_t rd, uint32_t funct3, uint32_t rs1, uint32_t rs2, uint32_t funct7)
+{
+    return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t enc_i(uint32_t opcode, uint32_t rd, uint32_t funct3, uint32_t rs1, int32_t imm)
+{
+    return (uint32_t)imm << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t enc_s(uint32_t opcode, uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm)
+{
+    return ((uint32_t)imm >> 5 & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | ((uint32_t)imm & 0x1f) << 7 | opcode;
+}
+
+static uint32_t enc_b(uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm)
+{
+    uint32_t i = imm;
+    return (i >> 12 & 1) << 31 | (i >> 5 & 0x3f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+           (i >> 1 & 0xf) << 8 | (i >> 11 & 1) << 7 | opcode_btype;
+}
+
+static uint32_t enc_j(uint32_t rd, int32_t imm)
+{
+    uint32_t i = imm;
+    return (i >> 20 & 1) << 31 | (i >> 1 & 0x3ff) << 21 | (i >> 11 & 1) << 20 | (i >> 12 & 0xff) << 12 | rd << 7 | opcode_jal;
+}
+
+// bits hi..lo of insn, moved down to bit 0
+static uint32_t bits(uint16_t insn, int hi, int lo)
+{
+    return (insn >> lo) & ((1 << (hi - lo + 1)) - 1);
+}
+
+// value, an n-bit two's complement number, sign-extended
+static int32_t sext(uint32_t value, int n)
+{
+    return (int32_t)(value << (32 - n)) >> (32 - n);
+}
+
+// the 6-bit immediate of c.addi, c.li, c.andi and c.lui, from bits 12 and 6..2
+static int32_t imm6(uint16_t insn)
+{
+    return sext(bits(insn, 12, 12) << 5 | bits(insn, 6, 2), 6);
+}
+
+// the offset of c.j and c.jal
+static int32_t imm_cj(uint16_t insn)
+{
+    uint32_t i = bits(insn, 12, 12) << 11 | bits(insn, 11, 11) << 4 | bits(insn, 10, 9) << 8 | bits(insn, 8, 8) << 10 |
+                 bits(insn, 7, 7) << 6 | bits(insn, 6, 6) << 7 | bits(insn, 5, 3) << 1 | bits(insn, 2, 2) << 5;
+    return sext(i, 12);
+}
+
+// the offset of c.beqz and c.bnez
+static int32_t imm_cb(uint16_t insn)
+{
+    uint32_t i = bits(insn, 12, 12) << 8 | bits(insn, 11, 10) << 3 | bits(insn, 6, 5) << 6 | bits(insn, 4, 3) << 1 |
+                 bits(insn, 2, 2) << 5;
+    return sext(i, 9);
+}
+
+// the offset of c.lw and c.sw
+static int32_t imm_clw(uint16_t insn)
+{
+    return bits(insn, 12, 10) << 3 | bits(insn, 6, 6) << 2 | bits(insn, 5, 5) << 6;
+}
+
+// the 3-bit register fields, which name x8..x15
+static uint32_t reg_c(uint16_t insn, int lo)
+{
+    return 8 + bits(insn, lo + 2, lo);
+}
+
+uint32_t rv32i::expand_compressed(uint16_t insn)
+{
+    uint32_t rd = bits(insn, 11, 7);
+    uint32_t rs2 = bits(insn, 6, 2);
+    uint32_t rd_c = reg_c(insn, 2); // rd' (or rs2') of the quadrant 0 formats
+    uint32_t rs1_c = reg_c(insn, 7);
+
+    switch (bits(insn, 1, 0) << 3 | bits(insn, 15, 13))
+    {
+    // quadrant 0
+    case 0b00000: // c.addi4spn rd',uimm
+    {
+        int32_t imm = bits(insn, 12, 11) << 4 | bits(insn, 10, 7) << 6 | bits(insn, 6, 6) << 2 | bits(insn, 5, 5) << 3;
+        return imm ? enc_i(opcode_alu_imm, rd_c, 0b000, 2, imm) : 0;
+    }
+    case 0b00010: // c.lw rd',uimm(rs1')
+        return enc_i(opcode_load_imm, rd_c, 0b010, rs1_c, imm_clw(insn));
+    case 0b00110: // c.sw rs2',uimm(rs1')
+        return enc_s(opcode_stype, 0b010, rs1_c, rd_c, imm_clw(insn));
+
+    // quadrant 1
+    case 0b01000: // c.addi rd,imm (c.nop when rd is x0)
+        return enc_i(opcode_alu_imm, rd, 0b000, rd, imm6(insn));
+    case 0b01001: // c.jal offset
+        return enc_j(1, imm_cj(insn));
+    case 0b01010: // c.li rd,imm
+        return enc_i(opcode_alu_imm, rd, 0b000, 0, imm6(insn));
+    case 0b01011:
+        if (rd == 2) // c.addi16sp imm
+        {
+            uint32_t i = bits(insn, 12, 12) << 9 | bits(insn, 6, 6) << 4 | bits(insn, 5, 5) << 6 |
+                         bits(insn, 4, 3) << 7 | bits(insn, 2, 2) << 5;
+            return i ? enc_i(opcode_alu_imm, 2, 0b000, 2, sext(i, 10)) : 0;
+        }
+        else // c.lui rd,imm
+        {
+            int32_t imm = imm6(insn);
+            return imm ? (uint32_t)imm << 12 | rd << 7 | opcode_lui : 0;
+        }
+    case 0b01100:
+        switch (bits(insn, 11, 10))
+        {
+        case 0b00: // c.srli rs1',shamt (shamt[5] must be 0 in RV32C)
+            return bits(insn, 12, 12) ? 0 : enc_i(opcode_alu_imm, rs1_c, 0b101, rs1_c, rs2);
+        case 0b01: // c.srai rs1',shamt
+            return bits(insn, 12, 12) ? 0 : enc_i(opcode_alu_imm, rs1_c, 0b101, rs1_c, 0x400 | rs2);
+        case 0b10: // c.andi rs1',imm
+            return enc_i(opcode_alu_imm, rs1_c, 0b111, rs1_c, imm6(insn));
+        default:
+        {
+            if (bits(insn, 12, 12)) // c.subw and c.addw are RV64C only
+                return 0;
+            static const uint32_t funct3[] = {0b000, 0b100, 0b110, 0b111}; // c.sub, c.xor, c.or, c.and
+            uint32_t op = bits(insn, 6, 5);
+            return enc_r(opcode_rtype, rs1_c, funct3[op], rs1_c, rd_c, op == 0 ? 0b0100000 : 0);
+        }
+        }
+    case 0b01101: // c.j offset
+        return enc_j(0, imm_cj(insn));
+    case 0b01110: // c.beqz rs1',offset
+        return enc_b(0b000, rs1_c, 0, imm_cb(insn));
+    case 0b01111: // c.bnez rs1',offset
+        return enc_b(0b001, rs1_c, 0, imm_cb(insn));
+
+    // quadrant 2
+    case 0b10000: // c.slli rd,shamt
+        return bits(insn, 12, 12) ? 0 : enc_i(opcode_alu_imm, rd, 0b001, rd, rs2);
+    case 0b10010: // c.lwsp rd,uimm(x2)
+    {
+        int32_t imm = bits(insn, 12, 12) << 5 | bits(insn, 6, 4) << 2 | bits(insn, 3, 2) << 6;
+        return rd ? enc_i(opcode_load_imm, rd, 0b010, 2, imm) : 0;
+    }
+    case 0b10100:
+        if (!bits(insn, 12, 12))
+        {
+            if (rs2) // c.mv rd,rs2
+                return enc_r(opcode_rtype, rd, 0b000, 0, rs2, 0);
+            return rd ? enc_i(opcode_jalr, 0, 0b000, rd, 0) : 0; // c.jr rs1
+        }
+        if (rs2) // c.add rd,rs2
+            return enc_r(opcode_rtype, rd, 0b000, rd, rs2, 0);
+        if (rd) // c.jalr rs1
+            return enc_i(opcode_jalr, 1, 0b000, rd, 0);
+        return 0x00100073; // c.ebreak
+    case 0b10110: // c.swsp rs2,uimm(x2)
+    {
+        int32_t imm = bits(insn, 12, 9) << 2 | bits(insn, 8, 7) << 6;
+        return enc_s(opcode_stype, 0b010, 2, rs2, imm);
+    }
+
+    default:
+        return 0;
+    }
+}
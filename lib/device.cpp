@@ -0,0 +1,291 @@
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "include/device.h"
+
+/*****************************************
+ * Memory-mapped devices
+ *
+ *   uart    a 16550 as far as a program polling it needs
+ *   timer   the mtime and mtimecmp registers of a CLINT
+ *   block   a disk of 512-byte sectors kept in a file
+ *   plugin  whatever device a shared object makes (see device.h)
+ *
+ * The hart takes no interrupts, so programs poll all of them.
+ * **************************************/
+
+static constexpr uint32_t uart_rbr = 0; // UART registers
+static constexpr uint32_t uart_thr = 0;
+static constexpr uint32_t uart_lsr = 5;
+static constexpr uint32_t lsr_data_ready = 0x01;
+static constexpr uint32_t lsr_thr_empty = 0x20;
+static constexpr uint32_t lsr_idle = 0x40;
+static constexpr uint32_t clint_mtimecmp = 0x4000; // timer registers
+static constexpr uint32_t clint_mtime = 0xbff8;
+static constexpr uint32_t sector_size = 512; // block device registers
+static constexpr uint32_t block_sector = 0;
+static constexpr uint32_t block_command = 4;
+static constexpr uint32_t block_status = 8;
+static constexpr uint32_t block_sectors = 0xc;
+
+// The transmit holding register at 0 writes the character to out, the
+// receive buffer at the same offset reads the next byte of the input (from
+// the file given, if any), and the line status register at 5 has data ready
+// (bit 0) while there is input and the transmitter always empty (bits 5 and
+// 6). The other registers read as zero.
+class uart : public device
+{
+public:
+    uart(std::ostream *o, const std::string &in) : out(o), input(in), next(0)
+    {
+    }
+    uint32_t size() const override
+    {
+        return 8;
+    }
+    uint32_t read(uint32_t offset, uint32_t) override
+    {
+        if (offset == uart_rbr)
+            return this->next < this->input.size() ? (uint8_t)this->input[this->next++] : 0;
+        if (offset == uart_lsr)
+            return (this->next < this->input.size() ? lsr_data_ready : 0) | lsr_thr_empty | lsr_idle;
+        return 0;
+    }
+    void write(uint32_t offset, uint32_t, uint32_t val) override
+    {
+        if (offset == uart_thr)
+            this->out->put((char)val).flush();
+    }
+
+private:
+    std::ostream *out;
+    std::string input;
+    size_t next;
+};
+
+// mtimecmp for hart 0 at 0x4000 and mtime at 0xbff8, 64 bits each, at the
+// offsets a CLINT has them (msip at 0 reads as zero). mtime counts the reads
+// of its low word, so a program waiting on it sees time pass however fast it
+// is simulated, and every run of it sees the same times.
+class timer : public device
+{
+public:
+    timer() : mtime(0), mtimecmp(~(uint64_t)0)
+    {
+    }
+    uint32_t size() const override
+    {
+        return 0x10000;
+    }
+    uint32_t read(uint32_t offset, uint32_t) override
+    {
+        switch (offset)
+        {
+        case clint_mtime:
+            return this->mtime++;
+        case clint_mtime + 4:
+            return this->mtime >> 32;
+        case clint_mtimecmp:
+            return this->mtimecmp;
+        case clint_mtimecmp + 4:
+            return this->mtimecmp >> 32;
+        }
+        return 0;
+    }
+    void write(uint32_t offset, uint32_t, uint32_t val) override
+    {
+        switch (offset)
+        {
+        case clint_mtime:
+            this->mtime = (this->mtime & ~(uint64_t)0xffffffff) | val;
+            break;
+        case clint_mtime + 4:
+            this->mtime = (this->mtime & 0xffffffff) | (uint64_t)val << 32;
+            break;
+        case clint_mtimecmp:
+            this->mtimecmp = (this->mtimecmp & ~(uint64_t)0xffffffff) | val;
+            break;
+        case clint_mtimecmp + 4:
+            this->mtimecmp = (this->mtimecmp & 0xffffffff) | (uint64_t)val << 32;
+            break;
+        }
+    }
+
+private:
+    uint64_t mtime;
+    uint64_t mtimecmp;
+};
+
+// The file as a disk of 512-byte sectors: a program writes the sector number
+// to 0 and a command to 4 (1: read the sector into the buffer, 2: write the
+// buffer to the sector), then reads the status at 8 (0: done, 1: no such
+// sector, 2: the file is read-only or can't be written). 0xc holds the number
+// of sectors and the buffer is at 0x200.
+class block_device : public device
+{
+public:
+    block_device(int f, bool w, uint64_t bytes) : fd(f), writable(w), sectors(bytes / sector_size), sector(0), status(0), buffer(sector_size, 0)
+    {
+    }
+    ~block_device()
+    {
+        close(this->fd);
+    }
+    uint32_t size() const override
+    {
+        return 2 * sector_size;
+    }
+    uint32_t read(uint32_t offset, uint32_t width) override
+    {
+        if (offset >= sector_size)
+        {
+            uint32_t val = 0;
+            for (uint32_t i = width; i-- > 0;)
+                val = val << 8 | this->buffer[(offset - sector_size + i) % sector_size];
+            return val;
+        }
+        switch (offset)
+        {
+        case block_sector:
+            return this->sector;
+        case block_status:
+            return this->status;
+        case block_sectors:
+            return this->sectors;
+        }
+        return 0;
+    }
+    void write(uint32_t offset, uint32_t width, uint32_t val) override
+    {
+        if (offset >= sector_size)
+        {
+            for (uint32_t i = 0; i < width; i++)
+                this->buffer[(offset - sector_size + i) % sector_size] = val >> 8 * i;
+        }
+        else if (offset == block_sector)
+            this->sector = val;
+        else if (offset == block_command)
+            command(val);
+    }
+
+private:
+    void command(uint32_t c)
+    {
+        off_t at = (off_t)this->sector * sector_size;
+        if (this->sector >= this->sectors)
+            this->status = 1;
+        else if (c == 1)
+            this->status = pread(this->fd, this->buffer.data(), sector_size, at) == sector_size ? 0 : 1;
+        else if (c == 2)
+            this->status = this->writable && pwrite(this->fd, this->buffer.data(), sector_size, at) == sector_size ? 0 : 2;
+    }
+
+    int fd;
+    bool writable;
+    uint32_t sectors;
+    uint32_t sector;
+    uint32_t status;
+    std::vector<uint8_t> buffer;
+};
+
+// A device from a plugin, which keeps the plugin loaded as long as it exists
+class plugin_device : public device
+{
+public:
+    plugin_device(void *h, device *d) : handle(h), dev(d)
+    {
+    }
+    ~plugin_device()
+    {
+        delete this->dev;
+        dlclose(this->handle);
+    }
+    uint32_t size() const override
+    {
+        return this->dev->size();
+    }
+    uint32_t read(uint32_t offset, uint32_t width) override
+    {
+        return this->dev->read(offset, width);
+    }
+    void write(uint32_t offset, uint32_t width, uint32_t val) override
+    {
+        this->dev->write(offset, width, val);
+    }
+
+private:
+    void *handle;
+    device *dev;
+};
+
+device *make_device(const std::string &name, const std::string &arg, std::ostream *out, std::ostream &err)
+{
+    if (name == "uart")
+    {
+        // what the program reads, if anything
+        std::string input;
+        if (!arg.empty())
+        {
+            std::ifstream in(arg, std::ios::in | std::ios::binary);
+            if (!in)
+            {
+                err << "Can't open UART input " << arg << std::endl;
+                return nullptr;
+            }
+            input.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        return new uart(out, input);
+    }
+    if (name == "timer")
+        return new timer();
+    if (name == "block")
+    {
+        bool writable = true;
+        int fd = open(arg.c_str(), O_RDWR);
+        if (fd < 0)
+        {
+            writable = false;
+            fd = open(arg.c_str(), O_RDONLY);
+        }
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            err << "Can't open block device file " << arg << std::endl;
+            return nullptr;
+        }
+        return new block_device(fd, writable, st.st_size);
+    }
+    if (name == "plugin")
+    {
+        // the file name, then the arguments to the plugin after a colon
+        size_t colon = arg.find(':');
+        std::string file = arg.substr(0, colon);
+        std::string args = colon == std::string::npos ? "" : arg.substr(colon + 1);
+        // a path, not a name for dlopen() to look for in the library path
+        std::string path = file.find('/') == std::string::npos ? "./" + file : file;
+        void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!handle)
+        {
+            err << "Can't load device plugin " << file << ": " << dlerror() << std::endl;
+            return nullptr;
+        }
+        device_plugin_fn *fn = reinterpret_cast<device_plugin_fn *>(dlsym(handle, device_plugin_symbol));
+        device *d = fn ? fn(args.c_str()) : nullptr;
+        if (!d)
+        {
+            err << "Device plugin " << file << (fn ? " made no device" : " has no rv32i_device()") << std::endl;
+            dlclose(handle);
+            return nullptr;
+        }
+        return new plugin_device(handle, d);
+    }
+    err << "No device called " << name << std::endl;
+    return nullptr;
+}
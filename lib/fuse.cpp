@@ -0,0 +1,171 @@
+#include <iostream>
+
+#include "include/rv32i.h"
+
+/*****************************************
+ * Instruction fusion
+ *
+ * Some pairs of instructions are so common in compiled code that the
+ * instruction cache holds the first of them fused with the second: one
+ * handler runs both, saving a dispatch. The pairs are
+ *
+ *     lui   rd,U;    addi rd,rd,I    load a 32-bit constant
+ *     auipc rd,U;    jalr r,I(rd)    call or jump anywhere
+ *     auipc rd,U;    lw   r,I(rd)    load a pc-relative word
+ *     slt   rd,a,b;  beq/bne rd,x0   compare and branch (also sltu)
+ *
+ * The second instruction keeps its own cache entry, so a jump straight to it
+ * runs it alone. A fused handler counts both instructions, and runs only the
+ * first when the execution limit falls between them. Fusion is done for the
+ * trace_off handlers only, so traced runs print every instruction as before.
+ *
+ * A fused entry keeps the raw word of the first instruction in insn and packs
+ * what the pair needs into the remaining fields:
+ *
+ *     lui+addi    rd, imm = U + I
+ *     auipc+jalr  rd, rs2 = jalr rd, imm = U + I
+ *     auipc+lw    rd, rs2 = lw rd, imm = U + I
+ *     slt+branch  rd, rs1, rs2 of the slt, imm = branch offset
+ * **************************************/
+
+// Fuse the instruction decoded into d at addr with the one after it, if the
+// two form one of the pairs above.
+void rv32i::fuse(uint32_t addr, decoded_insn &d)
+{
+    // a pair must be in one page, which paging maps as a whole, and be two
+    // 32-bit instructions
+    if (!d.rd || d.len != 4 || (uint64_t)addr + 8 > this->mem->get_size() || ((addr + 4) & ((1 << page_shift) - 1)) == 0)
+        return;
+
+    uint32_t next = this->mem->get32(addr + 4);
+    if (insn_length(next) != 4)
+        return;
+
+    decoded_insn n;
+    predecode<trace_off>(next, n);
+
+    auto h = d.handler;
+    auto f = h;
+
+    if (h == &rv32i::exec_lui<trace_off>)
+    {
+        if (n.handler == &rv32i::exec_addi<trace_off> && n.rd == d.rd && n.rs1 == d.rd)
+            f = &rv32i::exec_lui_addi;
+    }
+    else if (h == &rv32i::exec_auipc<trace_off>)
+    {
+        if (n.handler == &rv32i::exec_jalr<trace_off> && n.rs1 == d.rd)
+            f = &rv32i::exec_auipc_jalr;
+        else if (n.handler == &rv32i::exec_lw<trace_off> && n.rs1 == d.rd)
+            f = &rv32i::exec_auipc_lw;
+    }
+    else if (h == &rv32i::exec_slt<trace_off> || h == &rv32i::exec_sltu<trace_off>)
+    {
+        bool tests_rd = (n.rs1 == d.rd && n.rs2 == 0) || (n.rs1 == 0 && n.rs2 == d.rd);
+        bool slt = h == &rv32i::exec_slt<trace_off>;
+        if (tests_rd && n.handler == &rv32i::exec_beq<trace_off>)
+            f = slt ? &rv32i::exec_slt_beq : &rv32i::exec_sltu_beq;
+        else if (tests_rd && n.handler == &rv32i::exec_bne<trace_off>)
+            f = slt ? &rv32i::exec_slt_bne : &rv32i::exec_sltu_bne;
+    }
+
+    if (f == h)
+        return;
+
+    if (h == &rv32i::exec_auipc<trace_off>)
+        d.rs2 = n.rd;
+    if (f == &rv32i::exec_lui_addi || f == &rv32i::exec_auipc_jalr || f == &rv32i::exec_auipc_lw)
+        d.imm += n.imm;
+    else
+        d.imm = n.imm;
+    d.handler = f;
+    d.fused = 1;
+}
+
+// Count the second instruction of a fused pair. Returns false if the limit
+// has been reached after the first, which has then been run on its own.
+bool rv32i::fused_second(const decoded_insn &d)
+{
+    if (this->insn_counter == this->insn_limit)
+    {
+        decoded_insn first;
+        predecode<trace_off>(d.insn, first);
+        (this->*first.handler)(first, nullptr);
+        return false;
+    }
+
+    this->insn_counter++;
+    return true;
+}
+
+void rv32i::exec_lui_addi(const decoded_insn &d, std::ostream *)
+{
+    if (!fused_second(d))
+        return;
+
+    this->regs.set(d.rd, d.imm);
+    this->pc = this->pc + 8;
+}
+
+void rv32i::exec_auipc_jalr(const decoded_insn &d, std::ostream *)
+{
+    if (!fused_second(d))
+        return;
+
+    this->regs.set(d.rd, this->pc + (d.insn & 0xfffff000));
+    this->regs.set(d.rs2, this->pc + 8);
+    this->pc = (this->pc + d.imm) & 0xFFFFFFFE;
+}
+
+void rv32i::exec_auipc_lw(const decoded_insn &d, std::ostream *)
+{
+    if (!fused_second(d))
+        return;
+
+    uint32_t addr = this->pc + d.imm;
+    this->regs.set(d.rd, this->pc + (d.insn & 0xfffff000));
+    if (this->paging && !translate(addr, access_load))
+        return;
+    this->regs.set(d.rs2, this->mem->get32(addr));
+    this->pc = this->pc + 8;
+}
+
+void rv32i::exec_slt_beq(const decoded_insn &d, std::ostream *)
+{
+    if (!fused_second(d))
+        return;
+
+    bool lt = this->regs.get(d.rs1) < this->regs.get(d.rs2);
+    this->regs.set(d.rd, lt ? 1 : 0);
+    this->pc = this->pc + (lt ? 8 : 4 + d.imm);
+}
+
+void rv32i::exec_slt_bne(const decoded_insn &d, std::ostream *)
+{
+    if (!fused_second(d))
+        return;
+
+    bool lt = this->regs.get(d.rs1) < this->regs.get(d.rs2);
+    this->regs.set(d.rd, lt ? 1 : 0);
+    this->pc = this->pc + (lt ? 4 + d.imm : 8);
+}
+
+void rv32i::exec_sltu_beq(const decoded_insn &d, std::ostream *)
+{
+    if (!fused_second(d))
+        return;
+
+    bool lt = (uint32_t)this->regs.get(d.rs1) < (uint32_t)this->regs.get(d.rs2);
+    this->regs.set(d.rd, lt ? 1 : 0);
+    this->pc = this->pc + (lt ? 8 : 4 + d.imm);
+}
+
+void rv32i::exec_sltu_bne(const decoded_insn &d, std::ostream *)
+{
+    if (!fused_second(d))
+        return;
+
+    bool lt = (uint32_t)this->regs.get(d.rs1) < (uint32_t)this->regs.get(d.rs2);
+    this->regs.set(d.rd, lt ? 1 : 0);
+    this->pc = this->pc + (lt ? 4 + d.imm : 8);
+}
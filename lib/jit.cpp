@@ -0,0 +1,566 @@
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <sys/mman.h>
+
+#include "include/jit.h"
+#include "include/rv32i.h"
+
+/*****************************************
+ * x86-64 code generation for translated blocks
+ *
+ * A compiled block is a function taking the jit_context in rdi. Each guest
+ * instruction loads its operands from the context into eax/ecx, computes, and
+ * stores the result back, so there is no register allocation to get wrong.
+ * rsi holds the guest page table and r8 the code line map for the whole
+ * block.
+ *
+ * Loads and stores check the address inline against the memory size and its
+ * alignment, stores also check the code line map, and both look the page up
+ * in the page table. When a check fails, or the page has not been allocated,
+ * the block leaves through a side exit that records the pc and the number of
+ * instructions completed, and the interpreter runs the instruction instead
+ * (printing the warning, or discarding the decoded code it overwrites).
+ * **************************************/
+
+// size of the executable code buffer
+static constexpr size_t jit_buffer_size = 16 << 20;
+
+// shift from an address to its line in rv32i::code_lines
+static constexpr int code_line_shift = 6;
+static_assert(4 * code_line_insns == 1 << code_line_shift, "code_line_shift does not match code_line_insns");
+
+#if defined(__x86_64__) && !defined(RV32I_NO_JIT)
+
+// x86 condition codes
+enum x86_cc
+{
+    cc_b = 0x2,
+    cc_ae = 0x3,
+    cc_e = 0x4,
+    cc_ne = 0x5,
+    cc_a = 0x7,
+    cc_l = 0xc,
+    cc_ge = 0xd,
+};
+
+// x86 register numbers used by the generated code
+enum x86_reg
+{
+    eax = 0,
+    ecx = 1,
+    edx = 2,
+};
+
+// Appends machine code to a byte vector. Only the handful of instruction forms
+// the JIT needs are provided, always with 32-bit displacements off rdi for
+// context fields.
+class x86_emitter
+{
+public:
+    std::vector<uint8_t> code;
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void imm32(uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            byte(v >> (8 * i));
+    }
+
+    // modrm for [rdi + disp32] with reg r
+    void ctx_operand(int r, uint32_t disp)
+    {
+        byte(0x80 | (r << 3) | 7);
+        imm32(disp);
+    }
+
+    // r32 = guest register g
+    void load_reg(int r, uint32_t g)
+    {
+        byte(0x8b);
+        ctx_operand(r, offsetof(jit_context, x) + 4 * g);
+    }
+
+    // guest register g = r32 (writes to x0 are dropped)
+    void store_reg(uint32_t g, int r)
+    {
+        if (g == 0)
+            return;
+        byte(0x89);
+        ctx_operand(r, offsetof(jit_context, x) + 4 * g);
+    }
+
+    // context field at disp = imm32
+    void store_imm(uint32_t disp, uint32_t v)
+    {
+        byte(0xc7);
+        ctx_operand(0, disp);
+        imm32(v);
+    }
+
+    // r32 = imm32
+    void mov_imm(int r, uint32_t v)
+    {
+        byte(0xb8 + r);
+        imm32(v);
+    }
+
+    // eax = eax <op> ecx, for the 01/29/21/09/31/39 family (add, sub, and, or, xor, cmp)
+    void alu_ecx(uint8_t op)
+    {
+        byte(op);
+        byte(0xc8);
+    }
+
+    // eax = eax <op> imm32, digit selects the operation of the 81 group
+    void alu_imm(int digit, uint32_t v)
+    {
+        byte(0x81);
+        byte(0xc0 | (digit << 3));
+        imm32(v);
+    }
+
+    // shift eax by imm8 (or by cl when by_cl), digit 4 = shl, 5 = shr, 7 = sar
+    void shift(int digit, bool by_cl, uint8_t n)
+    {
+        byte(by_cl ? 0xd3 : 0xc1);
+        byte(0xc0 | (digit << 3));
+        if (!by_cl)
+            byte(n);
+    }
+
+    // eax = the low 32 bits of eax * ecx, or with high the high 32 bits
+    // of the signed or unsigned 64-bit product
+    void mul_ecx(bool high, bool is_signed)
+    {
+        if (!high)
+        {
+            byte(0x0f); // imul eax, ecx
+            byte(0xaf);
+            byte(0xc1);
+            return;
+        }
+        byte(0xf7); // imul/mul ecx
+        byte(is_signed ? 0xe9 : 0xe1);
+        byte(0x89); // mov eax, edx
+        byte(0xd0);
+    }
+
+    // eax = condition cc ? 1 : 0
+    void setcc(int cc)
+    {
+        byte(0x0f);
+        byte(0x90 + cc);
+        byte(0xc0);
+        byte(0x0f);
+        byte(0xb6);
+        byte(0xc0);
+    }
+
+    // jcc rel32 to a label fixed up later; returns the offset of the rel32
+    size_t jcc(int cc)
+    {
+        byte(0x0f);
+        byte(0x80 + cc);
+        imm32(0);
+        return code.size() - 4;
+    }
+
+    // point the rel32 at offset at to the current position
+    void bind(size_t at)
+    {
+        uint32_t rel = code.size() - (at + 4);
+        memcpy(&code[at], &rel, 4);
+    }
+};
+
+// the exit of a block: pc to continue at and instructions completed
+static void emit_exit(x86_emitter &e, uint32_t pc, uint32_t executed)
+{
+    e.store_imm(offsetof(jit_context, pc), pc);
+    e.store_imm(offsetof(jit_context, executed), executed);
+    e.byte(0xc3); // ret
+}
+
+// emit eax = rs1 + imm and a bounds check for an access of len bytes,
+// recording the jump to the side exit in exits. A misaligned access, which
+// could reach into the next page or code line, leaves too.
+static void emit_address(x86_emitter &e, const decoded_insn &d, uint32_t len, uint64_t mem_size, std::vector<size_t> &exits)
+{
+    e.load_reg(eax, d.rs1);
+    e.alu_imm(0, d.imm);
+    e.alu_imm(7, (uint32_t)(mem_size - len));
+    exits.push_back(e.jcc(cc_a));
+    if (len > 1)
+    {
+        e.byte(0xa8); // test al, len - 1
+        e.byte(len - 1);
+        exits.push_back(e.jcc(cc_ne));
+    }
+}
+
+// emit rdx = the page holding the address in eax, leaving through a side exit
+// if it has not been allocated (the interpreter reads it as 0xa5 or allocates
+// it), and eax = the offset in the page
+static void emit_page(x86_emitter &e, std::vector<size_t> &exits)
+{
+    e.byte(0x89); // mov edx, eax
+    e.byte(0xc2);
+    e.byte(0xc1); // shr edx, memory_page_shift
+    e.byte(0xea);
+    e.byte(memory_page_shift);
+    e.byte(0x48); // mov rdx, [rsi + rdx * 8]
+    e.byte(0x8b);
+    e.byte(0x14);
+    e.byte(0xd6);
+    e.byte(0x48); // test rdx, rdx
+    e.byte(0x85);
+    e.byte(0xd2);
+    exits.push_back(e.jcc(cc_e));
+    e.alu_imm(4, memory_page_size - 1);
+}
+
+// Emit one instruction that does not end the block. Returns false for
+// instructions the JIT does not handle.
+static bool emit_insn(x86_emitter &e, const decoded_insn &d, uint32_t pc, uint64_t mem_size, std::vector<size_t> &exits)
+{
+    auto h = d.handler;
+
+    if (h == &rv32i::exec_lui<trace_off> || h == &rv32i::exec_auipc<trace_off>)
+    {
+        if (d.rd)
+            e.store_imm(offsetof(jit_context, x) + 4 * d.rd, d.imm + (h == &rv32i::exec_auipc<trace_off> ? pc : 0));
+        return true;
+    }
+
+    if (h == &rv32i::exec_fence<trace_off>)
+    {
+        e.byte(0x0f); // mfence, as exec_fence orders memory for other harts
+        e.byte(0xae);
+        e.byte(0xf0);
+        return true;
+    }
+
+    // loads: ecx = m(rs1 + imm), extended as the instruction requires
+    static const struct
+    {
+        void (rv32i::*handler)(const decoded_insn &d, std::ostream *pos);
+        uint32_t len;
+        uint8_t op[2]; // 0f xx, or a lone 8b for lw
+    } loads[] = {
+        {&rv32i::exec_lb<trace_off>, 1, {0x0f, 0xbe}},
+        {&rv32i::exec_lbu<trace_off>, 1, {0x0f, 0xb6}},
+        {&rv32i::exec_lh<trace_off>, 2, {0x0f, 0xbf}},
+        {&rv32i::exec_lhu<trace_off>, 2, {0x0f, 0xb7}},
+        {&rv32i::exec_lw<trace_off>, 4, {0x8b, 0}},
+    };
+    for (const auto &l : loads)
+    {
+        if (h != l.handler)
+            continue;
+        emit_address(e, d, l.len, mem_size, exits);
+        emit_page(e, exits);
+        e.byte(l.op[0]);
+        if (l.op[1])
+            e.byte(l.op[1]);
+        e.byte(0x0c); // ecx, [rdx + rax]
+        e.byte(0x02);
+        e.store_reg(d.rd, ecx);
+        return true;
+    }
+
+    // Stores: write the low 1, 2 or 4 bytes of rs2. A store into a line of
+    // decoded code leaves through a side exit.
+    if (h == &rv32i::exec_sb<trace_off> || h == &rv32i::exec_sh<trace_off> || h == &rv32i::exec_sw<trace_off>)
+    {
+        uint32_t len = h == &rv32i::exec_sb<trace_off> ? 1 : h == &rv32i::exec_sh<trace_off> ? 2 : 4;
+        emit_address(e, d, len, mem_size, exits);
+        e.byte(0x89); // mov edx, eax
+        e.byte(0xc2);
+        e.byte(0xc1); // shr edx, log2(bytes per code line)
+        e.byte(0xea);
+        e.byte(code_line_shift);
+        e.byte(0x41); // cmp byte [r8 + rdx], 0
+        e.byte(0x80);
+        e.byte(0x3c);
+        e.byte(0x10);
+        e.byte(0x00);
+        exits.push_back(e.jcc(cc_ne));
+        emit_page(e, exits);
+        e.load_reg(ecx, d.rs2);
+        if (len == 2)
+            e.byte(0x66); // operand size prefix: cx
+        e.byte(len == 1 ? 0x88 : 0x89); // mov [rdx + rax], cl/cx/ecx
+        e.byte(0x0c);
+        e.byte(0x02);
+        return true;
+    }
+
+    // register-immediate ALU operations: 81 group digit, or a shift/compare
+    static const struct
+    {
+        void (rv32i::*handler)(const decoded_insn &d, std::ostream *pos);
+        int digit;
+    } alu_imm[] = {
+        {&rv32i::exec_addi<trace_off>, 0},
+        {&rv32i::exec_ori<trace_off>, 1},
+        {&rv32i::exec_andi<trace_off>, 4},
+        {&rv32i::exec_xori<trace_off>, 6},
+    };
+    for (const auto &a : alu_imm)
+    {
+        if (h != a.handler)
+            continue;
+        e.load_reg(eax, d.rs1);
+        e.alu_imm(a.digit, d.imm);
+        e.store_reg(d.rd, eax);
+        return true;
+    }
+
+    if (h == &rv32i::exec_slti<trace_off> || h == &rv32i::exec_sltiu<trace_off>)
+    {
+        e.load_reg(eax, d.rs1);
+        e.alu_imm(7, d.imm);
+        e.setcc(h == &rv32i::exec_slti<trace_off> ? cc_l : cc_b);
+        e.store_reg(d.rd, eax);
+        return true;
+    }
+
+    if (h == &rv32i::exec_slli<trace_off> || h == &rv32i::exec_srli<trace_off> || h == &rv32i::exec_srai<trace_off>)
+    {
+        e.load_reg(eax, d.rs1);
+        e.shift(h == &rv32i::exec_slli<trace_off> ? 4 : h == &rv32i::exec_srli<trace_off> ? 5 : 7, false, d.imm & 0x1f);
+        e.store_reg(d.rd, eax);
+        return true;
+    }
+
+    // register-register ALU operations
+    static const struct
+    {
+        void (rv32i::*handler)(const decoded_insn &d, std::ostream *pos);
+        uint8_t op;
+    } alu[] = {
+        {&rv32i::exec_add<trace_off>, 0x01},
+        {&rv32i::exec_sub<trace_off>, 0x29},
+        {&rv32i::exec_and<trace_off>, 0x21},
+        {&rv32i::exec_or<trace_off>, 0x09},
+        {&rv32i::exec_xor<trace_off>, 0x31},
+    };
+    for (const auto &a : alu)
+    {
+        if (h != a.handler)
+            continue;
+        e.load_reg(eax, d.rs1);
+        e.load_reg(ecx, d.rs2);
+        e.alu_ecx(a.op);
+        e.store_reg(d.rd, eax);
+        return true;
+    }
+
+    if (h == &rv32i::exec_slt<trace_off> || h == &rv32i::exec_sltu<trace_off>)
+    {
+        e.load_reg(eax, d.rs1);
+        e.load_reg(ecx, d.rs2);
+        e.alu_ecx(0x39);
+        e.setcc(h == &rv32i::exec_slt<trace_off> ? cc_l : cc_b);
+        e.store_reg(d.rd, eax);
+        return true;
+    }
+
+    if (h == &rv32i::exec_sll<trace_off> || h == &rv32i::exec_srl<trace_off> || h == &rv32i::exec_sra<trace_off>)
+    {
+        e.load_reg(eax, d.rs1);
+        e.load_reg(ecx, d.rs2);
+        e.shift(h == &rv32i::exec_sll<trace_off> ? 4 : h == &rv32i::exec_srl<trace_off> ? 5 : 7, true, 0);
+        e.store_reg(d.rd, eax);
+        return true;
+    }
+
+    // the multiplies (divides and mulhsu are left to the handlers)
+    if (h == &rv32i::exec_mul<trace_off> || h == &rv32i::exec_mulh<trace_off> || h == &rv32i::exec_mulhu<trace_off>)
+    {
+        e.load_reg(eax, d.rs1);
+        e.load_reg(ecx, d.rs2);
+        e.mul_ecx(h != &rv32i::exec_mul<trace_off>, h == &rv32i::exec_mulh<trace_off>);
+        e.store_reg(d.rd, eax);
+        return true;
+    }
+
+    return false;
+}
+
+// Emit the instruction that ends the block (at pc, with n instructions in the
+// block including it) and the block exit. Returns false for instructions the
+// JIT does not handle.
+static bool emit_last(x86_emitter &e, const decoded_insn &d, uint32_t pc, uint32_t n)
+{
+    auto h = d.handler;
+
+    static const struct
+    {
+        void (rv32i::*handler)(const decoded_insn &d, std::ostream *pos);
+        int cc;
+    } branches[] = {
+        {&rv32i::exec_beq<trace_off>, cc_e},
+        {&rv32i::exec_bne<trace_off>, cc_ne},
+        {&rv32i::exec_blt<trace_off>, cc_l},
+        {&rv32i::exec_bge<trace_off>, cc_ge},
+        {&rv32i::exec_bltu<trace_off>, cc_b},
+        {&rv32i::exec_bgeu<trace_off>, cc_ae},
+    };
+    for (const auto &b : branches)
+    {
+        if (h != b.handler)
+            continue;
+        e.load_reg(eax, d.rs1);
+        e.load_reg(ecx, d.rs2);
+        e.alu_ecx(0x39);
+        e.mov_imm(edx, pc + d.len);
+        e.mov_imm(ecx, pc + d.imm);
+        e.byte(0x0f); // cmovcc edx, ecx
+        e.byte(0x40 + b.cc);
+        e.byte(0xd1);
+        e.byte(0x89); // mov [pc], edx
+        e.ctx_operand(edx, offsetof(jit_context, pc));
+        e.store_imm(offsetof(jit_context, executed), n);
+        e.byte(0xc3);
+        return true;
+    }
+
+    if (h == &rv32i::exec_jal<trace_off>)
+    {
+        if (d.rd)
+            e.store_imm(offsetof(jit_context, x) + 4 * d.rd, pc + d.len);
+        emit_exit(e, pc + d.imm, n);
+        return true;
+    }
+
+    if (h == &rv32i::exec_jalr<trace_off>)
+    {
+        e.load_reg(eax, d.rs1);
+        e.alu_imm(0, d.imm);
+        e.alu_imm(4, 0xfffffffe);
+        if (d.rd)
+            e.store_imm(offsetof(jit_context, x) + 4 * d.rd, pc + d.len);
+        e.byte(0x89); // mov [pc], eax
+        e.ctx_operand(eax, offsetof(jit_context, pc));
+        e.store_imm(offsetof(jit_context, executed), n);
+        e.byte(0xc3);
+        return true;
+    }
+
+    return false;
+}
+
+jit::jit()
+{
+    this->size = jit_buffer_size;
+    this->used = 0;
+    this->full = false;
+
+    void *p = mmap(nullptr, this->size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    this->buf = (p == MAP_FAILED) ? nullptr : static_cast<uint8_t *>(p);
+}
+
+jit::~jit()
+{
+    if (this->buf)
+        munmap(this->buf, this->size);
+}
+
+bool jit::available() const
+{
+    return this->buf != nullptr;
+}
+
+jit_block_fn jit::compile(const translated_block &b, uint64_t mem_size)
+{
+    if (!this->buf || b.ops.empty() || mem_size < 4)
+        return nullptr;
+
+    x86_emitter e;
+    std::vector<size_t> exits;      // jumps to side exits, per instruction
+    std::vector<size_t> exit_insn;  // the instruction each of those belongs to
+    std::vector<uint32_t> exit_pc;  // and its address
+
+    e.byte(0x48); // mov rsi, [rdi + pages]
+    e.byte(0x8b);
+    e.ctx_operand(6, offsetof(jit_context, pages));
+    e.byte(0x4c); // mov r8, [rdi + code_lines]
+    e.byte(0x8b);
+    e.ctx_operand(0, offsetof(jit_context, code_lines));
+
+    uint32_t n = b.ops.size();
+    uint32_t pc = b.start;
+    for (uint32_t i = 0; i < n; pc += b.ops[i++].len)
+    {
+        const decoded_insn &d = b.ops[i];
+
+        if (i + 1 == n && emit_last(e, d, pc, n))
+            break;
+        if (!emit_insn(e, d, pc, mem_size, exits))
+            return nullptr;
+        exit_insn.resize(exits.size(), i);
+        exit_pc.resize(exits.size(), pc);
+
+        // a block cut short (by its length or the end of memory) falls through
+        if (i + 1 == n)
+            emit_exit(e, pc + d.len, n);
+    }
+
+    // side exits: resume in the interpreter at the instruction that failed its check
+    for (size_t k = 0; k < exits.size(); k++)
+    {
+        e.bind(exits[k]);
+        emit_exit(e, exit_pc[k], exit_insn[k]);
+    }
+
+    if (this->used + e.code.size() > this->size)
+    {
+        this->full = true;
+        return nullptr;
+    }
+
+    uint8_t *code = this->buf + this->used;
+    memcpy(code, e.code.data(), e.code.size());
+    this->used += e.code.size();
+
+    return reinterpret_cast<jit_block_fn>(code);
+}
+
+#else
+
+jit::jit()
+{
+    this->buf = nullptr;
+    this->size = 0;
+    this->used = 0;
+    this->full = false;
+}
+
+jit::~jit()
+{
+}
+
+bool jit::available() const
+{
+    return false;
+}
+
+jit_block_fn jit::compile(const translated_block &, uint64_t)
+{
+    return nullptr;
+}
+
+#endif
+
+void jit::flush()
+{
+    this->used = 0;
+    this->full = false;
+}
+
+bool jit::is_full() const
+{
+    return this->full;
+}
@@ -0,0 +1,194 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "include/hex.h"
+#include "include/loader.h"
+#include "include/memory.h"
+
+/*****************************************
+ * ELF loading
+ *
+ * Only what running a statically linked ELF32 little-endian RISC-V executable
+ * needs is read, by offset, from the headers (all little-endian):
+ *
+ *     file header      e_type @16, e_machine @18, e_entry @24, e_phoff @28,
+ *                      e_shoff @32, e_flags @36, e_phentsize @42, e_phnum @44,
+ *                      e_shentsize @46, e_shnum @48
+ *     program header   p_type @0, p_offset @4, p_vaddr @8, p_filesz @16,
+ *                      p_memsz @20
+ *     section header   sh_type @4, sh_offset @16, sh_size @20, sh_link @24
+ *     symbol           st_name @0, st_value @4, st_info @12, st_shndx @14
+ *
+ * Segment data is never read here: memory::load() maps it.
+ * **************************************/
+
+static constexpr uint16_t elf_exec = 2;     // e_type of an executable
+static constexpr uint16_t elf_riscv = 243;  // e_machine
+static constexpr uint32_t elf_flag_rvc = 1; // e_flags: uses the C extension
+static constexpr uint32_t elf_load = 1;     // p_type of a segment to load
+static constexpr uint32_t elf_symtab = 2;   // sh_type of the symbol table
+static constexpr uint32_t elf_ehdr_size = 52;
+static constexpr uint32_t elf_phdr_size = 32;
+static constexpr uint32_t elf_shdr_size = 40;
+static constexpr uint32_t elf_sym_size = 16;
+
+// the little-endian value of the given number of bytes at p
+static uint32_t le(const uint8_t *p, int bytes)
+{
+    uint32_t v = 0;
+    for (int i = bytes; i-- > 0;)
+        v = v << 8 | p[i];
+    return v;
+}
+
+// read len bytes of fd at offset into buf, all or nothing
+static bool read_at(int fd, uint64_t offset, uint8_t *buf, uint64_t len)
+{
+    while (len)
+    {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n <= 0)
+            return false;
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool is_elf(const std::string &fname)
+{
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    uint8_t magic[4];
+    bool elf = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && read_at(fd, 0, magic, 4) &&
+               magic[0] == 0x7f && magic[1] == 'E' && magic[2] == 'L' && magic[3] == 'F';
+    close(fd);
+    return elf;
+}
+
+// Add the function, object and untyped symbols defined in the symbol table
+// whose section header is sh to symbols. Where several name one address,
+// the first global one wins, or else the first.
+static void load_symbols(int fd, uint64_t file_size, const uint8_t *shdrs, uint32_t shnum, const uint8_t *sh, symbol_table &symbols)
+{
+    uint32_t link = le(sh + 24, 4);
+    if (link >= shnum)
+        return;
+    const uint8_t *strsh = shdrs + link * elf_shdr_size;
+
+    uint64_t sym_offset = le(sh + 16, 4), sym_size = le(sh + 20, 4);
+    uint64_t str_offset = le(strsh + 16, 4), str_size = le(strsh + 20, 4);
+    if (sym_offset + sym_size > file_size || str_offset + str_size > file_size)
+        return;
+    std::vector<uint8_t> syms(sym_size), strs(str_size + 1, 0);
+    if (!read_at(fd, sym_offset, syms.data(), sym_size) || !read_at(fd, str_offset, strs.data(), str_size))
+        return;
+
+    for (int global = 1; global >= 0; global--)
+    {
+        for (uint64_t i = 0; i + elf_sym_size <= sym_size; i += elf_sym_size)
+        {
+            const uint8_t *s = &syms[i];
+            uint32_t name = le(s, 4);
+            uint8_t type = s[12] & 0xf, bind = s[12] >> 4;
+            uint16_t shndx = le(s + 14, 2);
+            // 0: no section (undefined), 0xff00 and up: reserved (absolute, common)
+            if (type > 2 || (bind == 1) != (global == 1) || shndx == 0 || shndx >= 0xff00 || name >= str_size)
+                continue;
+            // skip the $x and $d symbols that mark code and data, and local labels
+            const char *n = reinterpret_cast<const char *>(&strs[name]);
+            if (!*n || *n == '$' || (n[0] == '.' && n[1] == 'L'))
+                continue;
+            symbols.emplace(le(s + 4, 4), n);
+        }
+    }
+}
+
+bool load_elf(const std::string &fname, memory *mem, program_info &prog, std::ostream &err)
+{
+    int fd = open(fname.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        err << "Can't open file " << fname << " for reading" << std::endl;
+        return false;
+    }
+    uint64_t file_size = st.st_size;
+
+    // whatever goes wrong, say what and give up
+    auto fail = [&](const std::string &why) {
+        close(fd);
+        err << fname << ": " << why << std::endl;
+        return false;
+    };
+
+    uint8_t ehdr[elf_ehdr_size];
+    if (!read_at(fd, 0, ehdr, sizeof(ehdr)))
+        return fail("truncated ELF header");
+    // EI_CLASS 1: 32-bit, EI_DATA 1: little-endian
+    if (ehdr[4] != 1 || ehdr[5] != 1 || le(ehdr + 18, 2) != elf_riscv)
+        return fail("not a 32-bit little-endian RISC-V ELF file");
+    if (le(ehdr + 16, 2) != elf_exec)
+        return fail("not an executable (link it without -shared or -pie)");
+
+    uint32_t phoff = le(ehdr + 28, 4), phentsize = le(ehdr + 42, 2), phnum = le(ehdr + 44, 2);
+    uint32_t shoff = le(ehdr + 32, 4), shentsize = le(ehdr + 46, 2), shnum = le(ehdr + 48, 2);
+    if (phnum && (phentsize < elf_phdr_size || phoff + (uint64_t)phnum * phentsize > file_size))
+        return fail("bad program headers");
+    if (shnum && (shentsize < elf_shdr_size || shoff + (uint64_t)shnum * shentsize > file_size))
+        return fail("bad section headers");
+
+    // place each segment, its file bytes then zeros up to its memory size
+    for (uint32_t i = 0; i < phnum; i++)
+    {
+        uint8_t ph[elf_phdr_size];
+        if (!read_at(fd, phoff + (uint64_t)i * phentsize, ph, sizeof(ph)))
+            return fail("truncated program header");
+        if (le(ph, 4) != elf_load)
+            continue;
+        uint32_t offset = le(ph + 4, 4), vaddr = le(ph + 8, 4), filesz = le(ph + 16, 4), memsz = le(ph + 20, 4);
+        if (filesz > memsz || offset + (uint64_t)filesz > file_size)
+            return fail("bad segment at " + hex0x32(vaddr));
+        if (vaddr + (uint64_t)memsz > mem->get_size())
+            return fail("segment at " + hex0x32(vaddr) + " doesn't fit in memory (make it bigger with -m)");
+        if (!mem->load(fd, offset, vaddr, filesz))
+            return fail("can't read segment at " + hex0x32(vaddr));
+        mem->zero(vaddr + filesz, memsz - filesz);
+    }
+
+    prog.entry = le(ehdr + 24, 4);
+    prog.compressed = le(ehdr + 36, 4) & elf_flag_rvc;
+
+    // the symbol table is optional, so one that can't be read is ignored
+    if (shnum)
+    {
+        std::vector<uint8_t> shdrs(shnum * elf_shdr_size);
+        for (uint32_t i = 0; i < shnum; i++)
+            if (!read_at(fd, shoff + (uint64_t)i * shentsize, &shdrs[i * elf_shdr_size], elf_shdr_size))
+                return fail("truncated section header");
+        for (uint32_t i = 0; i < shnum; i++)
+        {
+            const uint8_t *sh = &shdrs[i * elf_shdr_size];
+            if (le(sh + 4, 4) == elf_symtab)
+                load_symbols(fd, file_size, shdrs.data(), shnum, sh, prog.symbols);
+        }
+    }
+
+    close(fd);
+    return true;
+}
+
+bool load_program(const std::string &fname, memory *mem, program_info &prog, std::ostream &err)
+{
+    prog = program_info();
+    if (is_elf(fname))
+        return load_elf(fname, mem, prog, err);
+    return mem->load_file(fname);
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "include/hex.h"
+#include "include/lockstep.h"
+#include "include/memory.h"
+#include "include/rv32i.h"
+
+/*****************************************
+ * Lockstep execution
+ *
+ * Several simulators, typically the reference interpreter and a faster
+ * engine, run the same program side by side, each on its own copy of
+ * memory. Every interval instructions they all stop and the state of each
+ * is compared with the first's, so a difference is found within interval
+ * instructions of where it arose, without writing and diffing -i logs.
+ * **************************************/
+
+// most differing bytes of memory listed in a report
+static constexpr int lockstep_max_bytes = 16;
+
+// true if the page of a and b at addr may differ: one of them has written it
+// and the bytes are not the same
+static bool page_differs(const memory &a, const memory &b, uint64_t addr)
+{
+    const uint8_t *pa = a.get_page(addr);
+    const uint8_t *pb = b.get_page(addr);
+    if (!pa && !pb)
+        return false;
+
+    uint32_t len = std::min<uint64_t>(memory_page_size, a.get_size() - addr);
+    uint8_t fresh[memory_page_size];
+    memset(fresh, 0xa5, len);
+    return memcmp(pa ? pa : fresh, pb ? pb : fresh, len) != 0;
+}
+
+// true if the hart states of a and b are the same, and their memories too
+// if with_mem
+static bool same_state(const lockstep_sim &a, const lockstep_sim &b, bool with_mem)
+{
+    if (a.cpu->get_pc() != b.cpu->get_pc() || a.cpu->get_insn_counter() != b.cpu->get_insn_counter() ||
+        a.cpu->is_halted() != b.cpu->is_halted())
+        return false;
+    for (uint32_t i = 1; i < 32; i++)
+        if (a.cpu->get_reg(i) != b.cpu->get_reg(i))
+            return false;
+    if (!with_mem)
+        return true;
+    for (uint64_t page = 0; page < a.mem->get_size(); page += memory_page_size)
+        if (page_differs(*a.mem, *b.mem, page))
+            return false;
+    return true;
+}
+
+// the instruction at pc in the memory of s, disassembled
+static std::string lockstep_insn(const lockstep_sim &s, uint32_t pc)
+{
+    if ((pc & 1) || pc >= s.mem->get_size())
+        return hex32(pc) + ": (outside memory)";
+    return hex32(pc) + ": " + s.cpu->decode(s.mem->get32(pc));
+}
+
+// Report how b differs from a; where says when the difference arose
+static void report(const lockstep_sim &a, const lockstep_sim &b, const std::string &where, std::ostream &os)
+{
+    os << "Lockstep mismatch between " << a.name << " and " << b.name << " " << where << std::endl;
+
+    for (const lockstep_sim *s : {&a, &b})
+        os << "    " << s->name << ": " << s->cpu->get_insn_counter() << " instructions, "
+           << (s->cpu->is_halted() ? "halted" : "running") << ", next " << lockstep_insn(*s, s->cpu->get_pc()) << std::endl;
+
+    if (a.cpu->get_pc() != b.cpu->get_pc())
+        os << "    pc " << hex0x32(b.cpu->get_pc()) << " expected " << hex0x32(a.cpu->get_pc()) << std::endl;
+    for (uint32_t i = 1; i < 32; i++)
+        if (a.cpu->get_reg(i) != b.cpu->get_reg(i))
+            os << "    x" << i << " " << hex0x32(b.cpu->get_reg(i)) << " expected " << hex0x32(a.cpu->get_reg(i)) << std::endl;
+
+    int bytes = 0;
+    for (uint64_t i = 0; i < a.mem->get_size(); i++)
+    {
+        if (i % memory_page_size == 0 && !page_differs(*a.mem, *b.mem, i))
+        {
+            i += memory_page_size - 1;
+            continue;
+        }
+        if (a.mem->get8(i) == b.mem->get8(i))
+            continue;
+        if (bytes++ == lockstep_max_bytes)
+        {
+            os << "    ..." << std::endl;
+            break;
+        }
+        os << "    m8(" << hex0x32(i) << ") " << hex0x32(b.mem->get8(i)) << " expected " << hex0x32(a.mem->get8(i)) << std::endl;
+    }
+}
+
+bool lockstep(const std::vector<lockstep_sim> &sims, uint64_t interval, uint64_t limit, std::ostream &os)
+{
+    const lockstep_sim &ref = sims[0];
+    uint64_t done = 0;
+
+    while (!ref.cpu->is_halted() && !(limit && done >= limit))
+    {
+        uint64_t to = done + interval;
+        if (limit && to > limit)
+            to = limit;
+        uint32_t pc = ref.cpu->get_pc();
+
+        for (const lockstep_sim &s : sims)
+            s.cpu->execute(to);
+
+        for (size_t i = 1; i < sims.size(); i++)
+        {
+            if (!same_state(ref, sims[i], false))
+            {
+                if (to == done + 1)
+                    report(ref, sims[i], "in instruction " + std::to_string(to) + ", " + lockstep_insn(ref, pc), os);
+                else
+                    report(ref, sims[i], "in instructions " + std::to_string(done + 1) + ".." + std::to_string(to), os);
+                return false;
+            }
+        }
+        done = to;
+    }
+
+    for (size_t i = 1; i < sims.size(); i++)
+    {
+        if (!same_state(ref, sims[i], true))
+        {
+            report(ref, sims[i], "in memory at the end of the run", os);
+            return false;
+        }
+    }
+    return true;
+}
@@ -1,34 +1,50 @@
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "include/hex.h"
 #include "include/memory.h"
 /*
-Use: initializes vector to 0xa5
-Parameters: 1. uint32_t siz: used to determined vectors size
+Use: initializes the page table; every byte reads as 0xa5 until it is written,
+     and a page is only allocated (and filled with 0xa5) when it is first written
+Parameters: 1. uint64_t siz: used to determined memory size, at most 4 GiB
 */
-memory::memory(uint32_t siz)
+memory::memory(uint64_t siz)
 {
-    size = (siz + 15) & 0xfffffff0;
+    size = std::min<uint64_t>((siz + 15) & ~(uint64_t)15, (uint64_t)1 << 32);
 
-    //resizes vector to size value and sets every element to 0xa5
-    mem.resize(size, 0xa5);
+    //one page table entry for each page, none allocated yet
+    pages.resize((size + memory_page_size - 1) >> memory_page_shift, nullptr);
+    whole_pages = size >> memory_page_shift;
+
+    out = &std::cout;
+    err = &std::cerr;
 }
 
 /*
-Use: calls destructor for vector
+Use: frees the pages and unmaps the file
 Parameters: none
 */
 memory::~memory()
 {
     //destructor
-    mem.clear();
+    for (uint8_t *p : pages)
+        if (!mapped(p))
+            delete[] p;
+    for (const std::pair<uint8_t *, uint64_t> &m : maps)
+        munmap(m.first, m.second);
 }
 
 /*
 Use: checks if address is valid
-Parameters: 1. uint32_t i: address to be checked
+Parameters: 1. uint64_t i: address to be checked, or the end of a 4 GiB
+               memory (2^32) when a load does not fit
 */
-bool memory::check_address(uint32_t i) const
+bool memory::check_address(uint64_t i) const
 {
     //checks if i is less or equal to size
     if (i < size)
@@ -38,7 +54,7 @@ bool memory::check_address(uint32_t i) const
     //print warning if address out of range
     else
     {
-        std::cout << "WARNING: Address out of range: " << hex0x32(i) << std::endl;
+        *out << "WARNING: Address out of range: " << (i >> 32 ? "0x1" + hex32(i) : hex0x32(i)) << std::endl;
         return 0;
     }
 }
@@ -47,22 +63,213 @@ bool memory::check_address(uint32_t i) const
 Use: returns size
 Parameters: none
 */
-uint32_t memory::get_size() const
+uint64_t memory::get_size() const
 {
     return size;
 }
 
 /*
-Use: returns value in a given address
+Use: returns the page table, for code that accesses memory without get8/set8
+Parameters: none
+*/
+uint8_t *const *memory::get_page_table() const
+{
+    return pages.data();
+}
+
+/*
+Use: returns the page holding an address in range, or nullptr if it has not
+     been allocated
+Parameters: 1. uint32_t addr: an address in the page
+*/
+uint8_t *memory::find(uint32_t addr) const
+{
+    return __atomic_load_n(&pages[addr >> memory_page_shift], __ATOMIC_ACQUIRE);
+}
+
+/*
+Use: returns the page holding an address in range, allocating it if need be.
+     Harts on other threads may race to allocate the same page; the first
+     one wins and the others use its page.
+Parameters: 1. uint32_t addr: an address in the page
+*/
+uint8_t *memory::touch(uint32_t addr)
+{
+    uint8_t *p = find(addr);
+    if (!p)
+    {
+        uint8_t *fresh = new uint8_t[memory_page_size];
+        memset(fresh, 0xa5, memory_page_size);
+        if (__atomic_compare_exchange_n(&pages[addr >> memory_page_shift], &p, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            p = fresh;
+        else
+            delete[] fresh;
+    }
+    return p;
+}
+
+/*
+Use: returns the bytes of the page holding addr, or nullptr if it is out of
+     range or has never been written
+Parameters: 1. uint32_t addr: an address in the page
+*/
+const uint8_t *memory::get_page(uint32_t addr) const
+{
+    return addr < size ? find(addr) : nullptr;
+}
+
+/*
+Use: copies len bytes of memory at addr into buf; the bytes must all be in range
+Parameters: 1. uint32_t addr: the first address
+* 			2. uint8_t *buf: where the bytes go
+* 			3. uint32_t len: how many
+*/
+void memory::read(uint32_t addr, uint8_t *buf, uint32_t len) const
+{
+    while (len)
+    {
+        uint32_t offset = addr & (memory_page_size - 1);
+        uint32_t n = std::min(len, memory_page_size - offset);
+        uint8_t *p = find(addr);
+        if (p)
+            memcpy(buf, p + offset, n);
+        else if (is_device(addr))
+            for (uint32_t i = 0; i < n; i++)
+                buf[i] = get8(addr + i);
+        else
+            memset(buf, 0xa5, n);
+        addr += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+/*
+Use: copies len bytes from buf into memory at addr; the bytes must all be in range
+Parameters: 1. uint32_t addr: the first address
+* 			2. const uint8_t *buf: the bytes
+* 			3. uint32_t len: how many
+*/
+void memory::write(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+    while (len)
+    {
+        uint32_t offset = addr & (memory_page_size - 1);
+        uint32_t n = std::min(len, memory_page_size - offset);
+        if (!find(addr) && is_device(addr))
+            for (uint32_t i = 0; i < n; i++)
+                set8(addr + i, buf[i]);
+        else
+            memcpy(touch(addr) + offset, buf, n);
+        addr += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+/*
+Use: maps a device in place of the memory in its pages; see memory.h
+Parameters: 1. uint32_t base: its first address, at the start of a page
+* 			2. device *d: the device, which is deleted if it can't be attached
+*/
+bool memory::attach(uint32_t base, device *d)
+{
+    std::unique_ptr<device> owned(d);
+    uint64_t end = ((uint64_t)base + d->size() + memory_page_size - 1) & ~(uint64_t)(memory_page_size - 1);
+    if ((base & (memory_page_size - 1)) || d->size() == 0 || end > (uint64_t)1 << 32)
+        return false;
+    for (const io_region &r : io)
+        if (base < r.end && r.base < end)
+            return false;
+
+    //the memory in its pages is gone, and they never get any more
+    for (uint64_t a = base; a < std::min(end, size); a += memory_page_size)
+    {
+        uint8_t *&p = pages[a >> memory_page_shift];
+        if (!mapped(p))
+            delete[] p;
+        p = nullptr;
+    }
+    io.push_back(io_region{base, end, std::move(owned)});
+    return true;
+}
+
+/*
+Use: checks if an address belongs to a device
+Parameters: 1. uint32_t addr: the address
+*/
+bool memory::is_device(uint32_t addr) const
+{
+    return io_at(addr, 1) != nullptr;
+}
+
+/*
+Use: returns the device holding all of len bytes at addr, or nullptr
+Parameters: 1. uint32_t addr: the first address
+* 			2. uint32_t len: how many bytes
+*/
+const memory::io_region *memory::io_at(uint32_t addr, uint32_t len) const
+{
+    for (const io_region &r : io)
+        if (addr >= r.base && addr + (uint64_t)len <= r.end)
+            return &r;
+    return nullptr;
+}
+
+/*
+Use: loads from a device, one access at a time
+Parameters: 1. const io_region &r: the device
+* 			2. uint32_t addr: the address
+* 			3. uint32_t width: 1, 2 or 4 bytes
+*/
+uint32_t memory::io_read(const io_region &r, uint32_t addr, uint32_t width) const
+{
+    std::lock_guard<std::mutex> lock(io_lock);
+    return r.dev->read(addr - r.base, width);
+}
+
+/*
+Use: stores to a device, one access at a time
+Parameters: 1. const io_region &r: the device
+* 			2. uint32_t addr: the address
+* 			3. uint32_t width: 1, 2 or 4 bytes
+* 			4. uint32_t val: the value, in its low width bytes
+*/
+void memory::io_write(const io_region &r, uint32_t addr, uint32_t width, uint32_t val)
+{
+    std::lock_guard<std::mutex> lock(io_lock);
+    r.dev->write(addr - r.base, width, val);
+}
+
+/*
+Use: sends the dump, warnings and errors to the given streams instead of std::cout and std::cerr
+Parameters: 1. std::ostream *o: stream for the dump and warnings
+* 			2. std::ostream *e: stream for errors
+*/
+void memory::set_output(std::ostream *o, std::ostream *e)
+{
+    out = o;
+    err = e;
+}
+
+/*
+Use: returns value in a given address outside the fast path (see get8 in memory.h)
 Parameters: 1. uint32_t: used for getting value in a certain address
 
 */
-uint8_t memory::get8(uint32_t addr) const
+uint8_t memory::get8_slow(uint32_t addr) const
 {
+    if (const io_region *r = io_at(addr, 1))
+        return io_read(*r, addr, 1);
+
     //checks if check address is true
     if (check_address(addr))
     {
-        return mem[addr];
+        uint8_t *p = find(addr);
+        if (!p)
+            return 0xa5;
+        // relaxed atomic, so harts on other threads may share memory
+        return __atomic_load_n(&p[addr & (memory_page_size - 1)], __ATOMIC_RELAXED);
     }
     else
     {
@@ -73,12 +280,24 @@ uint8_t memory::get8(uint32_t addr) const
 /*
 
 
-Use: returns value in a given address (little endiend format)
+Use: returns value in a given address (little endiend format) outside the fast
+     path, a byte at a time if it is misaligned or out of range
 Parameters: 1. uint16_t: used for getting value in a certain address
 
 */
-uint16_t memory::get16(uint32_t addr) const
+uint16_t memory::get16_slow(uint32_t addr) const
 {
+    if (const io_region *r = io_at(addr, 2))
+        return io_read(*r, addr, 2);
+
+    if (MEMORY_NATIVE_LE && !(addr & 1) && addr < size)
+    {
+        uint8_t *p = find(addr);
+        if (!p)
+            return 0xa5a5;
+        return __atomic_load_n(reinterpret_cast<const uint16_t *>(&p[addr & (memory_page_size - 1)]), __ATOMIC_RELAXED);
+    }
+
     uint16_t sum;
     //sets sum to the addresses in little endiend format
     sum = (get8(addr) | get8(addr + 1) << 8);
@@ -86,96 +305,283 @@ uint16_t memory::get16(uint32_t addr) const
 }
 
 /*
-Use: returns value in a given address (little endiend format)
+Use: returns value in a given address (little endiend format) outside the fast
+     path, a byte at a time if it is misaligned or out of range
 Parameters: 1. uint32_t: used for getting value in a certain address
 */
-uint32_t memory::get32(uint32_t addr) const
+uint32_t memory::get32_slow(uint32_t addr) const
 {
+    if (const io_region *r = io_at(addr, 4))
+        return io_read(*r, addr, 4);
+
+    if (MEMORY_NATIVE_LE && !(addr & 3) && addr < size)
+    {
+        uint8_t *p = find(addr);
+        if (!p)
+            return 0xa5a5a5a5;
+        return __atomic_load_n(reinterpret_cast<const uint32_t *>(&p[addr & (memory_page_size - 1)]), __ATOMIC_RELAXED);
+    }
+
     uint32_t sum;
     //sets sum to the addresses in little endiend format
-    sum = get16(addr) | get16(addr + 2) << 16;
+    sum = get16_slow(addr) | get16_slow(addr + 2) << 16;
     return sum;
 }
 
 /*
-Use: sets val to the given address
+Use: sets val to the given address outside the fast path, if it is in range (see set8 in memory.h)
 Parameters: 1. uint32_t: used to determined the address
 */
-void memory::set8(uint32_t addr, uint8_t val)
+void memory::set8_slow(uint32_t addr, uint8_t val)
 {
+    if (const io_region *r = io_at(addr, 1))
+        return io_write(*r, addr, 1, val);
+
     //checks if address is valid
     if (check_address(addr))
     {
-        mem[addr] = val;
+        uint8_t *p = touch(addr);
+        __atomic_store_n(&p[addr & (memory_page_size - 1)], val, __ATOMIC_RELAXED);
     }
 }
 
 /*
-Use: sets val to the given address
+Use: sets val to the given address outside the fast path, a byte at
+     a time if it is misaligned or out of range
 Parameters: 1. uint32_t: used to determined the address
 * 			2. uint16_t: value to be stored (little endiend)
 */
-void memory::set16(uint32_t addr, uint16_t val)
+void memory::set16_slow(uint32_t addr, uint16_t val)
 {
-    //shifts value 8 bits address and increments address
-    set8(addr + 1, val >> 8);
+    if (const io_region *r = io_at(addr, 2))
+        return io_write(*r, addr, 2, val);
+
+    if (MEMORY_NATIVE_LE && !(addr & 1) && addr < size)
+    {
+        uint8_t *p = touch(addr);
+        __atomic_store_n(reinterpret_cast<uint16_t *>(&p[addr & (memory_page_size - 1)]), val, __ATOMIC_RELAXED);
+        return;
+    }
     set8(addr, val);
-    mem[addr] = val;
+    set8(addr + 1, val >> 8);
 }
 
 /*
-
-
-Use: sets val to the given address
+Use: sets val to the given address outside the fast path, a byte at
+     a time if it is misaligned or out of range
 Parameters: 1. uint32_t: used to determined the address
 * 			2. unint32_t: value to be stored (little endiend)
+*/
+void memory::set32_slow(uint32_t addr, uint32_t val)
+{
+    if (const io_region *r = io_at(addr, 4))
+        return io_write(*r, addr, 4, val);
 
+    if (MEMORY_NATIVE_LE && !(addr & 3) && addr < size)
+    {
+        uint8_t *p = touch(addr);
+        __atomic_store_n(reinterpret_cast<uint32_t *>(&p[addr & (memory_page_size - 1)]), val, __ATOMIC_RELAXED);
+        return;
+    }
+    set16_slow(addr, val);
+    set16_slow(addr + 2, val >> 16);
+}
+
+/*
+Use: prints the memory in hex and ascii, 16 bytes a line
+Parameters: none
 */
 void memory::dump() const
 {
     char ascii[17];
     ascii[16] = 0;
-    for (uint32_t i = 0; i < size; i++)
+    for (uint64_t i = 0; i < size; i++)
     {
         if (i % 16 == 0)
         {
             if (i != 0)
-                std::cout << " *" << ascii << "*" << std::endl;
-            std::cout << hex32(i) << ":";
+                *out << " *" << ascii << "*" << std::endl;
+            *out << hex32(i) << ":";
+        }
+        //device registers are not read, as that may change them
+        if (is_device(i))
+        {
+            *out << (i % 16 == 8 ? "  " : " ") << "--";
+            ascii[i % 16] = '.';
+            continue;
         }
         uint8_t ch = get8(i);
-        std::cout << (i % 16 == 8 ? "  " : " ") << hex8(ch);
+        *out << (i % 16 == 8 ? "  " : " ") << hex8(ch);
         ascii[i % 16] = isprint(ch) ? ch : '.';
     }
-    std::cout << " *" << ascii << "*" << std::endl;
+    *out << " *" << ascii << "*" << std::endl;
 }
 
+/*
+Use: maps len bytes of a file, copy-on-write, and returns the byte at offset,
+     or nullptr if it can't; fd -1 maps len zeros, which take no memory until
+     they are written
+Parameters: 1. int fd: the open file, or -1
+* 			2. uint64_t offset: where the bytes start in the file
+* 			3. uint64_t len: how many
+*/
+uint8_t *memory::map(int fd, uint64_t offset, uint64_t len)
+{
+    //mmap wants an offset that is a whole number of host pages
+    uint64_t skip = offset % sysconf(_SC_PAGESIZE);
+    void *m = mmap(nullptr, skip + len, PROT_READ | PROT_WRITE, fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_PRIVATE, fd, offset - skip);
+    if (m == MAP_FAILED)
+        return nullptr;
+    maps.emplace_back(static_cast<uint8_t *>(m), skip + len);
+    return static_cast<uint8_t *>(m) + skip;
+}
+
+/*
+Use: checks if a page is part of something map() mapped, rather than allocated
+Parameters: 1. const uint8_t *p: the page
+*/
+bool memory::mapped(const uint8_t *p) const
+{
+    for (const std::pair<uint8_t *, uint64_t> &m : maps)
+        if (p >= m.first && p < m.first + m.second)
+            return true;
+    return false;
+}
+
+/*
+Use: reads len bytes of a file from offset into memory at addr
+Parameters: 1. int fd: the open file
+* 			2. uint64_t offset: where the bytes start in the file
+* 			3. uint32_t addr: where they go
+* 			4. uint64_t len: how many
+*/
+bool memory::copy(int fd, uint64_t offset, uint32_t addr, uint64_t len)
+{
+    uint8_t buf[memory_page_size];
+    while (len)
+    {
+        ssize_t n = pread(fd, buf, std::min<uint64_t>(len, sizeof(buf)), offset);
+        if (n <= 0)
+            return false;
+        write(addr, buf, n);
+        addr += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+Use: loads len bytes of a file at addr. Every page wholly within them is mapped,
+     copy-on-write, straight into the page table, so loading takes the same
+     time whatever their size, nothing is copied until the program writes it,
+     and simulators loading the same file share its pages. The part pages at
+     either end are copied into pages of their own, as the rest of them must
+     keep what they hold. So is everything if the bytes start at a different
+     place within a page in the file than in memory.
+Parameters: 1. int fd: the open file
+* 			2. uint64_t offset: where the bytes start in the file
+* 			3. uint32_t addr: where they go
+* 			4. uint64_t len: how many
+*/
+bool memory::load(int fd, uint64_t offset, uint32_t addr, uint64_t len)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || offset + len > (uint64_t)st.st_size || addr + len > size)
+        return false;
+
+    uint64_t first = ((uint64_t)addr + memory_page_size - 1) & ~(uint64_t)(memory_page_size - 1);
+    uint64_t end = ((uint64_t)addr + len) & ~(uint64_t)(memory_page_size - 1);
+    uint8_t *m = nullptr;
+    if (first < end && !((offset ^ addr) & (memory_page_size - 1)))
+        m = map(fd, offset + (first - addr), end - first);
+    if (!m)
+        return copy(fd, offset, addr, len);
+
+    for (uint64_t a = first; a < end; a += memory_page_size)
+    {
+        uint8_t *&p = pages[a >> memory_page_shift];
+        if (p)
+            memcpy(p, m + (a - first), memory_page_size);
+        else
+            p = m + (a - first);
+    }
+    return copy(fd, offset, addr, first - addr) && copy(fd, offset + (end - addr), end, addr + len - end);
+}
+
+/*
+Use: makes bytes read as zero. Pages wholly within them share one mapping of
+     zeros, which the host only allocates a page of as it is written.
+Parameters: 1. uint32_t addr: the first address
+* 			2. uint64_t len: how many bytes
+*/
+void memory::zero(uint32_t addr, uint64_t len)
+{
+    uint64_t first = ((uint64_t)addr + memory_page_size - 1) & ~(uint64_t)(memory_page_size - 1);
+    uint64_t end = ((uint64_t)addr + len) & ~(uint64_t)(memory_page_size - 1);
+    uint8_t *m = first < end ? map(-1, 0, end - first) : nullptr;
+    for (uint64_t a = addr; a < (uint64_t)addr + len;)
+    {
+        uint32_t offset = a & (memory_page_size - 1);
+        uint64_t n = std::min<uint64_t>(addr + len - a, memory_page_size - offset);
+        uint8_t *&p = pages[a >> memory_page_shift];
+        if (!p && m && n == memory_page_size)
+            p = m + (a - first);
+        else
+            memset(touch(a) + offset, 0, n);
+        a += n;
+    }
+}
+
+/*
+Use: loads a file at address 0 (see load())
+Parameters: 1. const std::string &fname: the file
+*/
 bool memory::load_file(const std::string &fname)
 {
-    char temp;
-    int counter = 0;
-    std::ifstream infile(fname, std::ios::in | std::ios::binary);
+    int fd = open(fname.c_str(), O_RDONLY);
+    struct stat st;
     //checks if file exists or can be opened
-    if (!infile)
+    if (fd < 0 || fstat(fd, &st) != 0)
     {
-        std::cout << "Can't open file " << fname << " for reading" << std::endl;
+        if (fd >= 0)
+            close(fd);
+        *out << "Can't open file " << fname << " for reading" << std::endl;
         return false;
     }
-    //reads in bit by bit
-    while (infile.get(temp))
+
+    //a pipe is read and copied in
+    if (!S_ISREG(st.st_mode))
     {
-        //checks if address is ok
-        if (check_address(counter))
+        uint8_t buf[memory_page_size];
+        uint64_t addr = 0;
+        ssize_t n;
+        while ((n = ::read(fd, buf, sizeof(buf))) > 0)
         {
-            //sets value of temp into vector index (counter)
-            mem[counter] = temp;
+            if (addr + n > size)
+            {
+                close(fd);
+                check_address(size);
+                *err << "Program too big." << std::endl;
+                return false;
+            }
+            write(addr, buf, n);
+            addr += n;
         }
-        else
-        {
-            std::cerr << "Program too big." << std::endl;
-            return false;
-        }
-        counter++;
+        close(fd);
+        return true;
     }
-    return true;
+
+    if ((uint64_t)st.st_size > size)
+    {
+        close(fd);
+        check_address(size);
+        *err << "Program too big." << std::endl;
+        return false;
+    }
+    bool ok = load(fd, 0, 0, st.st_size);
+    close(fd);
+    if (!ok)
+        *out << "Can't read file " << fname << std::endl;
+    return ok;
 }
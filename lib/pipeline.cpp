@@ -0,0 +1,110 @@
+#include <iomanip>
+#include <sstream>
+
+#include "include/pipeline.h"
+#include "include/rv32i.h"
+
+/*****************************************
+ * Pipeline timing model
+ *
+ * Each instruction is given the cycle at which it is in EX. One follows
+ * another a cycle later, unless
+ *
+ *   - an operand is not ready: with forwarding, the result of a load can be
+ *     used one cycle after an ALU result would be (the load-use stall);
+ *     without it every result must reach WB, and is read in ID in the same
+ *     cycle it is written
+ *   - the one before changed the flow: the pipeline fetches pc+4, so a jal
+ *     (target known in ID) costs one bubble, and a taken branch or a jalr
+ *     (resolved in EX) two
+ *
+ * The run takes as many cycles as it takes the last instruction to leave WB.
+ * Stores and branches are taken to need all their operands in EX.
+ * **************************************/
+
+pipeline::pipeline(bool forwarding)
+{
+    this->forwarding = forwarding;
+    this->insns = 0;
+    this->ex = 1; // so that the first instruction is in EX in cycle 2
+    this->redirect = 0;
+    for (uint32_t i = 0; i < 32; i++)
+        this->ready[i] = 0;
+    this->data_stalls = 0;
+    this->load_use_stalls = 0;
+    this->branch_bubbles = 0;
+}
+
+void pipeline::retire(uint32_t insn, uint32_t len, uint32_t pc, uint32_t next_pc)
+{
+    uint32_t opcode = rv32i::get_opcode(insn);
+    uint32_t rd = rv32i::get_rd(insn);
+    uint32_t rs1 = rv32i::get_rs1(insn);
+    uint32_t rs2 = rv32i::get_rs2(insn);
+
+    bool reads_rs1 = !(opcode == opcode_lui || opcode == opcode_auipc || opcode == opcode_jal ||
+                       opcode == opcode_fenc_opt || (opcode == opcode_exc && (rv32i::get_funct3(insn) & 0b100)));
+    bool reads_rs2 = opcode == opcode_rtype || opcode == opcode_stype || opcode == opcode_btype;
+    bool writes_rd = !(opcode == opcode_stype || opcode == opcode_btype || opcode == opcode_fenc_opt);
+
+    // in EX a cycle after the one before, after any bubbles, once the operands are ready
+    uint64_t earliest = this->ex + 1 + this->redirect;
+    uint64_t at = earliest;
+    if (reads_rs1 && rs1 && this->ready[rs1] > at)
+        at = this->ready[rs1];
+    if (reads_rs2 && rs2 && this->ready[rs2] > at)
+        at = this->ready[rs2];
+
+    if (at > earliest)
+    {
+        // a load result one cycle late is a load-use stall; anything else
+        // is waiting for a write back
+        if (this->forwarding)
+            this->load_use_stalls += at - earliest;
+        else
+            this->data_stalls += at - earliest;
+    }
+    this->branch_bubbles += this->redirect;
+
+    this->insns++;
+    this->ex = at;
+
+    // when the result can be used by an instruction in EX
+    if (writes_rd && rd)
+    {
+        if (!this->forwarding)
+            this->ready[rd] = at + 3; // EX, MEM, WB (read in ID that cycle), then EX
+        else if (opcode == opcode_load_imm)
+            this->ready[rd] = at + 2; // from MEM/WB
+        else
+            this->ready[rd] = at + 1; // from EX/MEM
+    }
+
+    // instructions fetched after a change of flow are dropped
+    if (opcode == opcode_jal)
+        this->redirect = 1;
+    else if (opcode == opcode_jalr || (opcode == opcode_btype && next_pc != pc + len))
+        this->redirect = 2;
+    else
+        this->redirect = 0;
+}
+
+// cycles until the last instruction leaves WB
+uint64_t pipeline::get_cycles() const
+{
+    return this->insns ? this->ex + 3 : 0;
+}
+
+std::string pipeline::render() const
+{
+    std::ostringstream os;
+    uint64_t cycles = get_cycles();
+    os << cycles << " cycles, CPI " << std::fixed << std::setprecision(3)
+       << (this->insns ? (double)cycles / this->insns : 0.0) << " (";
+    if (this->forwarding)
+        os << this->load_use_stalls << " load-use stalls, ";
+    else
+        os << this->data_stalls << " data stalls, ";
+    os << this->branch_bubbles << " branch bubbles)";
+    return os.str();
+}
@@ -47,37 +47,37 @@ int32_t registerfile::get(uint32_t r) const
  * x16 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0
  * x24 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0 f0f0f0f0
  * **/
-void registerfile::dump() const
+void registerfile::dump(std::ostream &os) const
 {
     // registers from [0-7]
-    std::cout << std::setfill(' ') << std::right << std::setw(3) << "x0";
+    os << std::setfill(' ') << std::right << std::setw(3) << "x0";
     for (int i = 0; i < 8; i++)
     {
-        std::cout << " " << hex32(this->registers[i]);
+        os << " " << hex32(this->registers[i]);
     }
-    std::cout << "\n";
+    os << "\n";
 
     // registers from [8-15]
-    std::cout << std::setfill(' ') << std::right << std::setw(3) << "x8";
+    os << std::setfill(' ') << std::right << std::setw(3) << "x8";
     for (int i = 8; i < 16; i++)
     {
-        std::cout << " " << hex32(this->registers[i]);
+        os << " " << hex32(this->registers[i]);
     }
-    std::cout << "\n";
+    os << "\n";
 
     // registers from [16-23]
-    std::cout << std::setfill(' ') << std::right << std::setw(3) << "x16";
+    os << std::setfill(' ') << std::right << std::setw(3) << "x16";
     for (int i = 16; i < 24; i++)
     {
-        std::cout << " " << hex32(this->registers[i]);
+        os << " " << hex32(this->registers[i]);
     }
-    std::cout << "\n";
+    os << "\n";
 
     // registers from [24-32]
-    std::cout << std::setfill(' ') << std::right << std::setw(3) << "x24";
+    os << std::setfill(' ') << std::right << std::setw(3) << "x24";
     for (int i = 24; i < 32; i++)
     {
-        std::cout << " " << hex32(this->registers[i]);
+        os << " " << hex32(this->registers[i]);
     }
-    std::cout << "\n";
+    os << "\n";
 }
\ No newline at end of file
@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <new>
 #include <sstream>
+#include <sys/mman.h>
 
+#include "include/aot.h"
 #include "include/hex.h"
 #include "include/rv32i.h"
 
@@ -8,20 +13,82 @@
 rv32i::rv32i(memory *m)
 {
     this->mem = m;
+    this->engine = engine_ref;
+    this->show_instructions = false;
+    this->show_registers = false;
+    this->blocks_stale = false;
+    this->jctx_live = false;
+    this->icache_traced = false;
+    this->insn_limit = 0;
+    this->hartid = 0;
+    this->entry = 0;
+    this->symbols = nullptr;
+    this->aot = nullptr;
+    this->aot_table_base = 0;
+    this->sample_window = 0;
+    this->sample_skip = 0;
+    this->satp = 0;
+    this->paging = false;
+    flush_tlb();
+    this->compressed = false;
+    this->vl = 0;
+    this->vtype = vtype_vill;
+    this->out = &std::cout;
+    this->err = &std::cerr;
+
+    // one (initially unallocated) instruction cache page per 4K of memory
+    uint32_t insns = this->mem->get_size() / 4;
+    this->icache.resize((insns + icache_page_insns - 1) / icache_page_insns);
+    this->icache_half.resize(this->icache.size());
+    this->code_lines_size = std::max<size_t>((insns + code_line_insns - 1) / code_line_insns, 1);
+    void *lines = mmap(nullptr, this->code_lines_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lines == MAP_FAILED)
+        throw std::bad_alloc();
+    this->code_lines = static_cast<uint8_t *>(lines);
+
+    this->jctx.pages = this->mem->get_page_table();
+    this->jctx.code_lines = this->code_lines;
+}
+
+rv32i::~rv32i()
+{
+    munmap(this->code_lines, this->code_lines_size);
 }
 
 // This method will be used to disassemble the instructions in the simulated memory
 // To perform this task, set pc to zero and then, for each 32-bit word in the memory
+// (or, with the C extension, each 16- or 32-bit instruction)
 void rv32i::disasm(void)
 {
-    // set pc to zero
-    for (this->pc = 0; this->pc < this->mem->get_size(); this->pc += 4)
+    // set pc to zero (counting in 64 bits, as a 4 GiB memory ends at 2^32)
+    uint32_t len;
+    for (uint64_t at = 0; at < this->mem->get_size(); at += len)
     {
+        // skip the pages of devices, whose registers may change when read
+        if (this->mem->is_device(at))
+        {
+            len = memory_page_size - (at & (memory_page_size - 1));
+            continue;
+        }
+        this->pc = at;
+
+        // name the address on a line of its own if it has a name
+        if (this->symbols)
+        {
+            symbol_table::const_iterator sym = this->symbols->find(this->pc);
+            if (sym != this->symbols->end())
+                *this->out << sym->second << ":\n";
+        }
+
         // print the 32-bit hex address in the pc register
-        std::cout << hex32(this->pc) << ": ";
+        *this->out << hex32(this->pc) << ": ";
 
         // fetch the 32-bit instruction from memory at the address in the pc register
-        uint32_t insn = this->mem->get32(this->pc);
+        // (only the first halfword of it if that is a compressed instruction)
+        uint32_t insn = this->mem->get16(this->pc);
+        len = insn_length(insn);
+        if (len == 4)
+            insn = this->mem->get32(this->pc);
 
         // print the instruction as a 32-bit hex value
         // std::cout << hex32(insn) << " ";
@@ -31,16 +98,63 @@ void rv32i::disasm(void)
         std::string decoded_insn = decode(insn);
 
         // print the decoded instruction string returned from decode()
-        std::cout << decoded_insn << "\n";
-        // increment pc by 4 (point to the next instruction)
+        *this->out << decoded_insn << "\n";
+        // increment pc by len (point to the next instruction)
     }
 }
 
+// The Zbb and Zba instructions, found by their fixed bits. They share the
+// R-type and immediate ALU opcodes with the base ISA, using funct7 (and, for
+// those with one operand, rs2) values the base leaves unassigned.
+// predecode() keeps their handlers in the same order.
+struct bitmanip_insn
+{
+    uint32_t mask;
+    uint32_t match;
+    const char *mnemonic;
+    char form; // 'r': rs1 and rs2, 'u': rs1 alone, 'i': rs1 and a shift amount
+};
+
+static const bitmanip_insn bitmanip_insns[] = {
+    {0xfe00707f, 0x40007033, " andn   ", 'r'},
+    {0xfe00707f, 0x40006033, " orn    ", 'r'},
+    {0xfe00707f, 0x40004033, " xnor   ", 'r'},
+    {0xfff0707f, 0x60001013, " clz    ", 'u'},
+    {0xfff0707f, 0x60101013, " ctz    ", 'u'},
+    {0xfff0707f, 0x60201013, " cpop   ", 'u'},
+    {0xfe00707f, 0x0a006033, " max    ", 'r'},
+    {0xfe00707f, 0x0a007033, " maxu   ", 'r'},
+    {0xfe00707f, 0x0a004033, " min    ", 'r'},
+    {0xfe00707f, 0x0a005033, " minu   ", 'r'},
+    {0xfff0707f, 0x60401013, " sext.b ", 'u'},
+    {0xfff0707f, 0x60501013, " sext.h ", 'u'},
+    {0xfff0707f, 0x08004033, " zext.h ", 'u'},
+    {0xfe00707f, 0x60001033, " rol    ", 'r'},
+    {0xfe00707f, 0x60005033, " ror    ", 'r'},
+    {0xfe00707f, 0x60005013, " rori   ", 'i'},
+    {0xfff0707f, 0x28705013, " orc.b  ", 'u'},
+    {0xfff0707f, 0x69805013, " rev8   ", 'u'},
+    {0xfe00707f, 0x20002033, " sh1add ", 'r'},
+    {0xfe00707f, 0x20004033, " sh2add ", 'r'},
+    {0xfe00707f, 0x20006033, " sh3add ", 'r'},
+};
+
+// the bitmanip_insns entry for insn, or nullptr if it is not one of them
+static const bitmanip_insn *find_bitmanip(uint32_t insn)
+{
+    for (const auto &b : bitmanip_insns)
+        if ((insn & b.mask) == b.match)
+            return &b;
+    return nullptr;
+}
+
 // This function must be capable of handling any possible insn value.
 // It is the purpose of this function to return a std::string containing
 // the disassembled instruction text. This function will not print anything.
 std::string rv32i::decode(uint32_t insn) const
 {
+    if (insn_length(insn) == 2)
+        return render_compressed(insn);
 
     uint32_t opcode = get_opcode(insn);
 
@@ -102,6 +216,9 @@ std::string rv32i::decode(uint32_t insn) const
         break;
 
     case opcode_alu_imm:
+        if (const bitmanip_insn *b = find_bitmanip(insn))
+            return render_bitmanip(insn, b->mnemonic, b->form);
+
         switch (get_funct3(insn))
         {
         case 0b000:
@@ -164,6 +281,17 @@ std::string rv32i::decode(uint32_t insn) const
         break;
 
     case opcode_rtype: // R-type
+        if (const bitmanip_insn *b = find_bitmanip(insn))
+            return render_bitmanip(insn, b->mnemonic, b->form);
+
+        // RV32M multiply and divide
+        if (get_funct7(insn) == funct7_muldiv)
+        {
+            static const char *const muldiv[] = {" mul    ", " mulh   ", " mulhsu ", " mulhu  ",
+                                                 " div    ", " divu   ", " rem    ", " remu   "};
+            return render_rtype(insn, muldiv[get_funct3(insn)]);
+        }
+
         //checks get_funct3 value
         switch (get_funct3(insn))
         {
@@ -219,6 +347,28 @@ std::string rv32i::decode(uint32_t insn) const
         return render_fence(insn);
 
     case opcode_exc:
+        // Zicsr instructions
+        switch (get_funct3(insn))
+        {
+        case 0b001:
+            return render_csrrx(insn, " csrrw  ");
+        case 0b010:
+            return render_csrrx(insn, " csrrs  ");
+        case 0b011:
+            return render_csrrx(insn, " csrrc  ");
+        case 0b101:
+            return render_csrrx(insn, " csrrwi ");
+        case 0b110:
+            return render_csrrx(insn, " csrrsi ");
+        case 0b111:
+            return render_csrrx(insn, " csrrci ");
+        case 0b100:
+            return render_illegal_insn(insn);
+        }
+
+        if (get_funct7(insn) == funct7_sfence_vma)
+            return render_sfence_vma(insn);
+
         switch (get_funct7(insn) + get_rs2(insn))
         {
         case 0b000000000000:
@@ -230,6 +380,11 @@ std::string rv32i::decode(uint32_t insn) const
         }
         break;
 
+    case opcode_load_fp:
+    case opcode_store_fp:
+    case opcode_vector:
+        return render_vector(insn);
+
     default:
         return render_illegal_insn(insn);
     }
@@ -334,6 +489,18 @@ void rv32i::set_show_instructions(bool b)
     this->show_instructions = b;
 }
 
+// select the engine used by run()
+void rv32i::set_engine(engine_type e)
+{
+    this->engine = e;
+    if (e == engine_aot)
+    {
+        this->aot = aot_find(this->mem);
+        if (!this->aot)
+            *this->err << "No ahead-of-time translation of this image is linked in, interpreting it" << std::endl;
+    }
+}
+
 // set register hart display flag
 void rv32i::set_show_registers(bool b)
 {
@@ -346,58 +513,385 @@ bool rv32i::is_halted() const
     return this->halt;
 }
 
+// the program counter
+uint32_t rv32i::get_pc() const
+{
+    return this->pc;
+}
+
+// the value of register r
+int32_t rv32i::get_reg(uint32_t r) const
+{
+    return this->regs.get(r);
+}
+
 // reset RISC-V Simulation
 void rv32i::reset()
 {
     this->regs.reset();     // reset general purpose registers
-    this->pc = 0;           // set program counter to zero
+    this->pc = this->entry; // set program counter to the entry point
     this->insn_counter = 0; // set instruction counter to zero
     this->halt = false;     // setting 'halt' flag to false
+
+    // bare (untranslated) addressing
+    this->satp = 0;
+    this->paging = false;
+    flush_tlb();
+
+    reset_vector();
+
+    // storing memory size to the x2 register, less the stacks of the harts
+    // before this one
+    this->regs.set(2, this->mem->get_size() - this->hartid * hart_stack_size);
+}
+
+// turn the C extension (compressed instructions) on or off
+void rv32i::set_compressed(bool b)
+{
+    this->compressed = b;
+    flush_decoded();
+}
+
+// set the hart ID (mhartid) of this hart, before reset()
+void rv32i::set_hartid(uint32_t id)
+{
+    this->hartid = id;
+}
+
+// set the address reset() starts at, the entry point of an ELF file (0 by default)
+void rv32i::set_entry(uint32_t addr)
+{
+    this->entry = addr;
+}
+
+uint32_t rv32i::get_entry() const
+{
+    return this->entry;
+}
+
+// label the lines of disasm() with the names in s (not copied), or nullptr
+void rv32i::set_symbols(const symbol_table *s)
+{
+    this->symbols = s;
+}
+
+// measure detailed windows of window instructions, each after skip more run
+// by the engine; a window of 0 turns sampling off
+void rv32i::set_sampling(uint64_t window, uint64_t skip)
+{
+    this->sample_window = window;
+    this->sample_skip = skip;
+}
+
+// model the timing of a five-stage pipeline, with or without forwarding
+void rv32i::set_timing(bool enable, bool forwarding)
+{
+    this->timing.reset(enable ? new pipeline(forwarding) : nullptr);
+}
+
+// model the caches fetches and data accesses go through, or not if c is
+// nullptr; takes ownership of c
+void rv32i::set_caches(cache_hierarchy *c)
+{
+    this->caches.reset(c);
+}
+
+// predict branches and jumps with b, or not if b is nullptr; takes
+// ownership of b
+void rv32i::set_branches(branch_model *b)
+{
+    this->branches.reset(b);
+}
+
+// send traces, dumps and messages to o, and errors to e
+void rv32i::set_output(std::ostream *o, std::ostream *e)
+{
+    this->out = o;
+    this->err = e;
+}
+
+// the number of instructions executed so far
+uint64_t rv32i::get_insn_counter() const
+{
+    return this->insn_counter;
 }
 
 // dump the simulator state
 void rv32i::dump() const
 {
-    this->regs.dump();
-    std::cout << " pc " << hex32(this->pc) << std::endl;
+    this->regs.dump(*this->out);
+    *this->out << " pc " << hex32(this->pc) << std::endl;
+
+    // the vector registers too, once the program has set vtype
+    if (this->vtype != vtype_vill)
+        this->vregs.dump(*this->out);
 }
 
 // function to execute an instruction
 void rv32i::tick()
+{
+    bool traced = this->show_instructions || this->show_registers;
+    use_trace_policy(traced);
+
+    if (traced)
+        step<trace_on>();
+    else
+        step<trace_off>();
+}
+
+// execute one instruction with the handlers of the given trace policy, which
+// must be the one the instruction cache holds
+template <class trace>
+void rv32i::step()
 {
     this->insn_counter++; // increment instruction counter
 
-    // show GP register hart
-    if (this->show_registers)
-        dump();
+    std::ostream *pos = nullptr;
+
+    if (trace::enabled)
+    {
+        // show GP register hart
+        if (this->show_registers)
+            dump();
+
+        // show instructions
+        if (this->show_instructions)
+        {
+            // print the 32-bit hex address in the pc register
+            *this->out << hex32(pc) << ": ";
 
-    // fetch the 32-bit instruction from memory at the address in the pc register
-    uint32_t insn = this->mem->get32(pc);
+            // render instruction and simulation details while executing
+            pos = this->out;
+        }
+    }
 
-    // show instructions
-    if (this->show_instructions)
+    // the instruction cache holds what is at physical addresses
+    uint32_t pc = this->pc;
+    if (this->paging && !translate(pc, access_fetch))
+        return;
+    decoded_insn *d = lookup(pc);
+
+    // a misaligned pc, or one outside memory, takes the uncached path so that
+    // get32 reports it exactly as before
+    if (!d)
     {
-        // print the 32-bit hex address in the pc register
-        std::cout << hex32(pc) << ": ";
+        dcex(this->mem->get32(pc), pos);
+        return;
+    }
 
-        // print the instruction as a 32-bit hex value
-        // std::cout << hex32(insn) << " ";
+    (this->*d->handler)(*d, pos);
+}
 
-        // execute instruction and render instruction and simulation details
-        dcex(insn, &std::cout);
+// Make the instruction cache hold handlers of the trace_on or trace_off
+// instantiation. Switching discards everything decoded so far.
+void rv32i::use_trace_policy(bool traced)
+{
+    if (traced == this->icache_traced)
+        return;
+
+    flush_decoded();
+    this->icache_traced = traced;
+}
+
+// discard everything decoded or translated from memory so far
+void rv32i::flush_decoded()
+{
+    for (auto &page : this->icache)
+        page.reset();
+    for (auto &page : this->icache_half)
+        page.reset();
+    for (auto &page : this->tcache)
+        page.reset();
+    this->blocks.clear();
+    this->jitter.flush();
+    this->blocks_stale = false;
+    // give back the pages of the code map rather than writing zeros to them
+    madvise(this->code_lines, this->code_lines_size, MADV_DONTNEED);
+    this->aot_table.clear();
+}
+
+// lookup() for an addr that is not a multiple of 4, which only with the C
+// extension can hold an instruction, 2 bytes into a word
+decoded_insn *rv32i::lookup_half(uint32_t addr)
+{
+    if (!this->compressed || (addr & 3) != 2 || addr >= this->mem->get_size())
+        return nullptr;
+
+    uint32_t idx = addr / 4;
+    decoded_insn *page = this->icache_half[idx / icache_page_insns].get();
+
+    if (!page || !page[idx % icache_page_insns].handler)
+        return lookup_miss(addr);
+
+    return &page[idx % icache_page_insns];
+}
+
+// allocate the cache page for addr if needed and decode the instruction there.
+// Only with the C extension can an instruction start 2 bytes into a word; a
+// 32-bit one there runs into the next word, so it has to be within memory.
+decoded_insn *rv32i::lookup_miss(uint32_t addr)
+{
+    uint32_t idx = addr / 4;
+    uint32_t page = idx / icache_page_insns;
+    bool half = addr & 2;
+    std::vector<std::unique_ptr<decoded_insn[]>> &cache = half ? this->icache_half : this->icache;
+
+    uint16_t lo = this->mem->get16(addr);
+    if (half && insn_length(lo) == 4 && (uint64_t)addr + 4 > this->mem->get_size())
+        return nullptr;
+    uint16_t hi = insn_length(lo) == 4 ? this->mem->get16(addr + 2) : 0;
+
+    if (!cache[page])
+        cache[page].reset(new decoded_insn[icache_page_insns]());
+
+    decoded_insn *d = &cache[page][idx % icache_page_insns];
+    if (this->icache_traced)
+    {
+        predecode_at<trace_on>(lo, hi, *d);
     }
     else
     {
-        // execute instruction without rendering instruction and simulation details
-        dcex(insn, nullptr);
+        predecode_at<trace_off>(lo, hi, *d);
+        if (!half)
+            fuse(addr, *d);
+    }
+    this->code_lines[idx / code_line_insns] = 1;
+    if (half)
+        this->code_lines[(addr + 2) / 4 / code_line_insns] = 1;
+    return d;
+}
+
+// Bytes taken by the instruction whose first halfword is lo: every encoding
+// but those with the two low bits set is compressed
+uint32_t rv32i::insn_length(uint16_t lo) const
+{
+    return this->compressed && (lo & 3) != 3 ? 2 : 4;
+}
+
+// decode the instruction whose first halfword is lo (and, unless that is a
+// compressed instruction, whose second is hi) into d
+template <class trace>
+void rv32i::predecode_at(uint16_t lo, uint16_t hi, decoded_insn &d) const
+{
+    if (insn_length(lo) == 2)
+    {
+        predecode<trace>(expand_compressed(lo), d);
+        d.len = 2;
+    }
+    else
+    {
+        predecode<trace>(lo | (uint32_t)hi << 16, d);
+    }
+}
+
+// the cache entry for addr as a single instruction, decoded into tmp where
+// the cache holds it fused with the next one
+const decoded_insn *rv32i::lookup_single(uint32_t addr, decoded_insn &tmp)
+{
+    const decoded_insn *d = lookup(addr);
+    if (!d || !d->fused)
+        return d;
+
+    predecode<trace_off>(d->insn, tmp);
+    return &tmp;
+}
+
+// drop the cached decoding of any instruction overlapping [addr, addr+len)
+void rv32i::invalidate(uint32_t addr, uint32_t len)
+{
+    // and that of an instruction fused with the first of them
+    if (addr >= 4 && addr / 4 - 1 < this->mem->get_size() / 4)
+    {
+        uint32_t prev = addr / 4 - 1;
+        uint32_t page = prev / icache_page_insns;
+        if (this->icache[page] && this->icache[page][prev % icache_page_insns].fused)
+            this->icache[page][prev % icache_page_insns].handler = nullptr;
+    }
+
+    // and that of a 32-bit instruction starting 2 bytes before the first word
+    if (this->compressed && addr >= 2 && (addr & 3) < 2 && (addr - 2) / 4 < this->mem->get_size() / 4)
+    {
+        uint32_t prev = (addr - 2) / 4;
+        uint32_t page = prev / icache_page_insns;
+        if (this->icache_half[page])
+            this->icache_half[page][prev % icache_page_insns].handler = nullptr;
+        uint32_t slot = 2 * prev + 1;
+        if (slot / icache_page_insns < this->tcache.size() && this->tcache[slot / icache_page_insns])
+            this->tcache[slot / icache_page_insns][slot % icache_page_insns] = this->tcache_unfilled;
+    }
+
+    for (uint32_t idx = addr / 4; idx <= ((uint64_t)addr + len - 1) / 4; idx++)
+    {
+        if (idx >= this->mem->get_size() / 4)
+            break;
+
+        uint32_t page = idx / icache_page_insns;
+        if (page < this->icache.size() && this->icache[page])
+            this->icache[page][idx % icache_page_insns].handler = nullptr;
+        if (page < this->icache_half.size() && this->icache_half[page])
+            this->icache_half[page][idx % icache_page_insns].handler = nullptr;
+        // the threaded engine's slots, one per word or, with the C extension, halfword
+        for (uint32_t slot = idx << this->compressed; slot < (idx + 1) << this->compressed; slot++)
+        {
+            uint32_t tpage = slot / icache_page_insns;
+            if (tpage < this->tcache.size() && this->tcache[tpage])
+                this->tcache[tpage][slot % icache_page_insns] = this->tcache_unfilled;
+        }
+        if (this->code_lines[idx / code_line_insns])
+            this->blocks_stale = true;
     }
 }
 
 // function to execute instructions loaded from file
 void rv32i::run(uint64_t limit)
 {
-    // storing memory size to the x2 register
-    this->regs.set(2, this->mem->get_size());
+    if (this->sample_window)
+        run_sampled(limit);
+    else
+        execute(limit);
+    *this->out << render_total_insn_exec(this->insn_counter) << std::endl;
+    if (this->timing)
+        *this->out << this->timing->render() << std::endl;
+    if (this->caches)
+        *this->out << this->caches->render() << std::endl;
+    if (this->branches)
+    {
+        // decode() shows targets relative to this->pc
+        uint32_t pc = this->pc;
+        *this->out << this->branches->render([this](uint32_t at, uint32_t insn) {
+            this->pc = at;
+            return decode(insn);
+        }) << std::endl;
+        this->pc = pc;
+    }
+}
+
+// execute until halted or limit instructions executed, without printing the total
+void rv32i::execute(uint64_t limit)
+{
+    // only tick() can trace, so -i and -r always use it whatever the engine
+    bool traced = this->show_instructions || this->show_registers;
+    use_trace_policy(traced);
+    this->insn_limit = limit;
+
+    // the other engines read memory directly, so with paging on (or once
+    // it has been turned on) the run continues in the reference loop
+    if ((this->timing || this->caches || this->branches) && !traced)
+    {
+        run_modelled(limit);
+    }
+    else if (this->engine == engine_threaded && !traced && !this->paging)
+    {
+        run_threaded(limit);
+    }
+    else if ((this->engine == engine_block || this->engine == engine_jit || this->engine == engine_jitdiff) && !traced && !this->paging)
+    {
+        run_blocks(limit);
+    }
+    else if (this->engine == engine_aot && !traced && !this->paging)
+    {
+        run_aot(limit);
+    }
 
     // execute
     while (true)
@@ -411,127 +905,215 @@ void rv32i::run(uint64_t limit)
             break;
         }
 
-        tick(); // execute one instruction at a time
+        // execute one instruction at a time
+        if (traced)
+            step<trace_on>();
+        else
+            step<trace_off>();
+    }
+}
+
+// Run until halted or limit instructions executed, one instruction at a time
+// (never a fused pair) so that the timing, cache and branch models see
+// every one.
+// The fetch and the data address are taken before the instruction runs, as
+// it may overwrite its base register.
+void rv32i::run_modelled(uint64_t limit)
+{
+    while (!is_halted() && !(limit && this->insn_counter >= limit))
+    {
+        uint32_t pc = this->pc;
+        uint32_t at = pc;
+        this->insn_counter++;
+        if (this->paging && !translate(at, access_fetch))
+            break;
+
+        decoded_insn single;
+        const decoded_insn *d = lookup_single(at, single);
+        if (this->caches)
+            this->caches->fetch(pc, d ? d->len : 4);
+        if (!d)
+        {
+            dcex(this->mem->get32(at), nullptr);
+            continue;
+        }
+
+        uint32_t insn = d->insn;
+        if (this->caches)
+        {
+            uint32_t opcode = get_opcode(insn);
+            uint32_t addr = this->regs.get(d->rs1) + d->imm;
+            if (opcode == opcode_load_imm)
+                this->caches->load(addr, 1 << (get_funct3(insn) & 3));
+            else if (opcode == opcode_stype)
+                this->caches->store(addr, 1 << (get_funct3(insn) & 3));
+            else if (opcode == opcode_load_fp || opcode == opcode_store_fp)
+                model_vector_access(insn);
+        }
+        (this->*d->handler)(*d, nullptr);
+        if (this->timing)
+            this->timing->retire(insn, d->len, pc, this->pc);
+        if (this->branches)
+            this->branches->retire(insn, d->len, pc, this->pc);
     }
-    std::cout << render_total_insn_exec(this->insn_counter) << std::endl;
 }
 
 /*****************************************
  * Execution Handler function
  * **************************************/
 
-void rv32i::dcex(uint32_t insn, std::ostream *pos)
+// Decode insn once into d: select the exec_* handler for it and extract the
+// register indices and the sign-extended immediate of its format
+template <class trace>
+void rv32i::predecode(uint32_t insn, decoded_insn &d)
 {
+    d.insn = insn;
+    d.rd = get_rd(insn);
+    d.rs1 = get_rs1(insn);
+    d.rs2 = get_rs2(insn);
+    d.imm = 0;
+    d.fused = 0;
+    d.len = 4;
 
     uint32_t opcode = get_opcode(insn);
 
+    if (opcode == opcode_rtype || opcode == opcode_alu_imm)
+    {
+        // in the order of bitmanip_insns
+        static decltype(d.handler) const bitmanip_handlers[] = {
+            &rv32i::exec_andn<trace>, &rv32i::exec_orn<trace>, &rv32i::exec_xnor<trace>,
+            &rv32i::exec_clz<trace>, &rv32i::exec_ctz<trace>, &rv32i::exec_cpop<trace>,
+            &rv32i::exec_max<trace>, &rv32i::exec_maxu<trace>, &rv32i::exec_min<trace>,
+            &rv32i::exec_minu<trace>, &rv32i::exec_sext_b<trace>, &rv32i::exec_sext_h<trace>,
+            &rv32i::exec_zext_h<trace>, &rv32i::exec_rol<trace>, &rv32i::exec_ror<trace>,
+            &rv32i::exec_rori<trace>, &rv32i::exec_orc_b<trace>, &rv32i::exec_rev8<trace>,
+            &rv32i::exec_sh1add<trace>, &rv32i::exec_sh2add<trace>, &rv32i::exec_sh3add<trace>};
+        static_assert(sizeof(bitmanip_handlers) / sizeof(bitmanip_handlers[0]) ==
+                          sizeof(bitmanip_insns) / sizeof(bitmanip_insns[0]),
+                      "a handler for each bitmanip_insns entry");
+
+        if (const bitmanip_insn *b = find_bitmanip(insn))
+        {
+            d.imm = get_rs2(insn); // the shift amount of rori
+            d.handler = bitmanip_handlers[b - bitmanip_insns];
+            return;
+        }
+    }
+
     switch (opcode)
     {
     case opcode_lui:
-        exec_lui(insn, pos);
+        d.imm = get_imm_u(insn);
+        d.handler = &rv32i::exec_lui<trace>;
         break;
     case opcode_auipc:
-        exec_auipc(insn, pos);
+        d.imm = get_imm_u(insn);
+        d.handler = &rv32i::exec_auipc<trace>;
         break;
     case opcode_jal:
-        exec_jal(insn, pos);
+        d.imm = get_imm_j(insn);
+        d.handler = &rv32i::exec_jal<trace>;
         break;
     case opcode_jalr:
-        exec_jalr(insn, pos);
+        d.imm = get_imm_i(insn);
+        d.handler = &rv32i::exec_jalr<trace>;
         break;
     case opcode_btype:
+        d.imm = get_imm_b(insn);
         switch (get_funct3(insn))
         {
         case 0b000:
             // exec_btype(insn, " beq    ", pos);
-            exec_beq(insn, pos);
+            d.handler = &rv32i::exec_beq<trace>;
             break;
         case 0b001:
             // exec_btype(insn, " bne    ", pos);
-            exec_bne(insn, pos);
+            d.handler = &rv32i::exec_bne<trace>;
             break;
         case 0b100:
             // exec_btype(insn, " blt    ", pos);
-            exec_blt(insn, pos);
+            d.handler = &rv32i::exec_blt<trace>;
             break;
         case 0b101:
             // exec_btype(insn, " bge    ", pos);
-            exec_bge(insn, pos);
+            d.handler = &rv32i::exec_bge<trace>;
             break;
         case 0b110:
             // exec_btype(insn, " bltu   ", pos);
-            exec_bltu(insn, pos);
+            d.handler = &rv32i::exec_bltu<trace>;
             break;
         case 0b111:
             // exec_btype(insn, " bgeu   ", pos);
-            exec_bgeu(insn, pos);
+            d.handler = &rv32i::exec_bgeu<trace>;
             break;
         default:
-            exec_error(insn, pos);
+            d.handler = &rv32i::exec_error<trace>;
             break;
         }
         break;
 
     case opcode_load_imm:
+        d.imm = get_imm_i(insn);
         switch (get_funct3(insn))
         {
         case 0b000:
             // exec_itype_load(insn, " lb     ", pos);
-            exec_lb(insn, pos);
+            d.handler = &rv32i::exec_lb<trace>;
             break;
         case 0b001:
             // exec_itype_load(insn, " lh     ", pos);
-            exec_lh(insn, pos);
+            d.handler = &rv32i::exec_lh<trace>;
             break;
         case 0b010:
             // exec_itype_load(insn, " lw     ", pos);
-            exec_lw(insn, pos);
+            d.handler = &rv32i::exec_lw<trace>;
             break;
         case 0b100:
             // exec_itype_load(insn, " lbu    ", pos);
-            exec_lbu(insn, pos);
+            d.handler = &rv32i::exec_lbu<trace>;
             break;
         case 0b101:
             // exec_itype_load(insn, " lhu    ", pos);
-            exec_lhu(insn, pos);
+            d.handler = &rv32i::exec_lhu<trace>;
             break;
         default:
-            exec_error(insn, pos);
+            d.handler = &rv32i::exec_error<trace>;
             break;
         }
         break;
 
     case opcode_alu_imm:
+        d.imm = get_imm_i(insn);
         switch (get_funct3(insn))
         {
         case 0b000:
             // exec_itype_alu(insn, " addi   ", get_imm_i(insn), pos);
-            exec_addi(insn, pos);
+            d.handler = &rv32i::exec_addi<trace>;
             break;
 
         case 0b010:
             // exec_itype_alu(insn, " slti   ", get_imm_i(insn), pos);
-            exec_slti(insn, pos);
+            d.handler = &rv32i::exec_slti<trace>;
             break;
         case 0b011:
             // exec_itype_alu(insn, " sltiu  ", get_imm_i(insn), pos);
-            exec_sltiu(insn, pos);
+            d.handler = &rv32i::exec_sltiu<trace>;
             break;
         case 0b100:
             // exec_itype_alu(insn, " xori   ", get_imm_i(insn), pos);
-            exec_xori(insn, pos);
+            d.handler = &rv32i::exec_xori<trace>;
             break;
         case 0b110:
             // exec_itype_alu(insn, " ori    ", get_imm_i(insn), pos);
-            exec_ori(insn, pos);
+            d.handler = &rv32i::exec_ori<trace>;
             break;
         case 0b111:
             // exec_itype_alu(insn, " andi   ", get_imm_i(insn), pos);
-            exec_andi(insn, pos);
+            d.handler = &rv32i::exec_andi<trace>;
             break;
         case 0b001:
             // exec_itype_alu(insn, " slli   ", get_imm_i(insn), pos);
-            exec_slli(insn, pos);
+            d.handler = &rv32i::exec_slli<trace>;
             break;
         case 0b101:
             //checks get_funct7 value
@@ -539,47 +1121,81 @@ void rv32i::dcex(uint32_t insn, std::ostream *pos)
             {
             case 0b0000000:
                 // exec_itype_alu(insn, " srli   ", get_imm_i(insn), pos);
-                exec_srli(insn, pos);
+                d.handler = &rv32i::exec_srli<trace>;
                 break;
             case 0b0100000:
                 // exec_itype_alu(insn, " srai   ", get_imm_i(insn), pos);
-                exec_srai(insn, pos);
+                d.handler = &rv32i::exec_srai<trace>;
                 break;
             default:
-                exec_error(insn, pos);
+                d.handler = &rv32i::exec_error<trace>;
                 break;
             }
             break;
         default:
-            exec_error(insn, pos);
+            d.handler = &rv32i::exec_error<trace>;
             break;
         }
 
         break;
 
     case opcode_stype: // S - type store instructions
+        d.imm = get_imm_s(insn);
         //checks get_funct3 value
         switch (get_funct3(insn))
         {
         case 0b000:
             // exec_stype(insn, " sb     ", pos);
-            exec_sb(insn, pos);
+            d.handler = &rv32i::exec_sb<trace>;
             break;
         case 0b001:
             // exec_stype(insn, " sh     ", pos);
-            exec_sh(insn, pos);
+            d.handler = &rv32i::exec_sh<trace>;
             break;
         case 0b010:
             // exec_stype(insn, " sw     ", pos);
-            exec_sw(insn, pos);
+            d.handler = &rv32i::exec_sw<trace>;
             break;
         default:
-            exec_error(insn, pos);
+            d.handler = &rv32i::exec_error<trace>;
             break;
         }
         break;
 
     case opcode_rtype: // R-type
+        // RV32M multiply and divide
+        if (get_funct7(insn) == funct7_muldiv)
+        {
+            switch (get_funct3(insn))
+            {
+            case 0b000:
+                d.handler = &rv32i::exec_mul<trace>;
+                break;
+            case 0b001:
+                d.handler = &rv32i::exec_mulh<trace>;
+                break;
+            case 0b010:
+                d.handler = &rv32i::exec_mulhsu<trace>;
+                break;
+            case 0b011:
+                d.handler = &rv32i::exec_mulhu<trace>;
+                break;
+            case 0b100:
+                d.handler = &rv32i::exec_div<trace>;
+                break;
+            case 0b101:
+                d.handler = &rv32i::exec_divu<trace>;
+                break;
+            case 0b110:
+                d.handler = &rv32i::exec_rem<trace>;
+                break;
+            case 0b111:
+                d.handler = &rv32i::exec_remu<trace>;
+                break;
+            }
+            break;
+        }
+
         //checks get_funct3 value
         switch (get_funct3(insn))
         {
@@ -589,32 +1205,32 @@ void rv32i::dcex(uint32_t insn, std::ostream *pos)
             {
             case 0b0000000:
                 // exec_rtype(insn, " add    ", pos);
-                exec_add(insn, pos);
+                d.handler = &rv32i::exec_add<trace>;
                 break;
             case 0b0100000:
                 // exec_rtype(insn, " sub    ", pos);
-                exec_sub(insn, pos);
+                d.handler = &rv32i::exec_sub<trace>;
                 break;
             default:
-                exec_error(insn, pos);
+                d.handler = &rv32i::exec_error<trace>;
                 break;
             }
             break;
         case 0b001:
             // exec_rtype(insn, " sll    ", pos);
-            exec_sll(insn, pos);
+            d.handler = &rv32i::exec_sll<trace>;
             break;
         case 0b010:
             // exec_rtype(insn, " slt    ", pos);
-            exec_slt(insn, pos);
+            d.handler = &rv32i::exec_slt<trace>;
             break;
         case 0b011:
             // exec_rtype(insn, " sltu   ", pos);
-            exec_sltu(insn, pos);
+            d.handler = &rv32i::exec_sltu<trace>;
             break;
         case 0b100:
             // exec_rtype(insn, " xor    ", pos);
-            exec_xor(insn, pos);
+            d.handler = &rv32i::exec_xor<trace>;
             break;
         case 0b101:
             //checks get_funct7 value
@@ -622,69 +1238,127 @@ void rv32i::dcex(uint32_t insn, std::ostream *pos)
             {
             case 0b0000000:
                 // exec_rtype(insn, " srl    ", pos);
-                exec_srl(insn, pos);
+                d.handler = &rv32i::exec_srl<trace>;
                 break;
             case 0b0100000:
                 // exec_rtype(insn, " sra    ", pos);
-                exec_sra(insn, pos);
+                d.handler = &rv32i::exec_sra<trace>;
                 break;
             default:
-                exec_error(insn, pos);
+                d.handler = &rv32i::exec_error<trace>;
                 break;
             }
             break;
         case 0b110:
             // exec_rtype(insn, " or     ", pos);
-            exec_or(insn, pos);
+            d.handler = &rv32i::exec_or<trace>;
             break;
         case 0b111:
             // exec_rtype(insn, " and    ", pos);
-            exec_and(insn, pos);
+            d.handler = &rv32i::exec_and<trace>;
             break;
         }
         break;
 
     case opcode_fenc_opt: //fence operation
-        exec_fence(insn, pos);
+        d.handler = &rv32i::exec_fence<trace>;
         break;
 
     case opcode_exc:
+        // Zicsr instructions, with the CSR number as the immediate
+        if (get_funct3(insn) != 0)
+        {
+            d.imm = insn >> 20;
+            switch (get_funct3(insn))
+            {
+            case 0b001:
+                d.handler = &rv32i::exec_csrrw<trace>;
+                break;
+            case 0b010:
+                d.handler = &rv32i::exec_csrrs<trace>;
+                break;
+            case 0b011:
+                d.handler = &rv32i::exec_csrrc<trace>;
+                break;
+            case 0b101:
+                d.handler = &rv32i::exec_csrrwi<trace>;
+                break;
+            case 0b110:
+                d.handler = &rv32i::exec_csrrsi<trace>;
+                break;
+            case 0b111:
+                d.handler = &rv32i::exec_csrrci<trace>;
+                break;
+            default:
+                d.handler = &rv32i::exec_illegal_insn<trace>;
+                break;
+            }
+            break;
+        }
+
+        if (get_funct7(insn) == funct7_sfence_vma)
+        {
+            d.handler = &rv32i::exec_sfence_vma<trace>;
+            break;
+        }
+
         switch (get_funct7(insn) + get_rs2(insn))
         {
         case 0b000000000000:
-            exec_ecall(insn, pos);
+            d.handler = &rv32i::exec_ecall<trace>;
             break;
         case 0b000000000001:
-            exec_ebreak(insn, pos);
+            d.handler = &rv32i::exec_ebreak<trace>;
             break;
         default:
-            exec_error(insn, pos);
+            d.handler = &rv32i::exec_error<trace>;
             break;
         }
         break;
+    case opcode_load_fp:
+    case opcode_store_fp:
+    case opcode_vector:
+        if (!predecode_vector<trace>(insn, d))
+            d.handler = &rv32i::exec_illegal_insn<trace>;
+        break;
+
     default:
-        exec_illegal_insn(insn, pos);
+        d.handler = &rv32i::exec_illegal_insn<trace>;
         break;
     }
 }
+
+// decode and execute a single instruction without going through the cache
+void rv32i::dcex(uint32_t insn, std::ostream *pos)
+{
+    decoded_insn d;
+    if (pos)
+        predecode<trace_on>(insn, d);
+    else
+        predecode<trace_off>(insn, d);
+    (this->*d.handler)(d, pos);
+}
+
 //-------------------------------------------------------//
 
-void rv32i::exec_illegal_insn(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_illegal_insn(const decoded_insn &d, std::ostream *pos)
 {
     this->halt = true;
 }
 
-void rv32i::exec_ebreak(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_ebreak(const decoded_insn &d, std::ostream *pos)
 {
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_ebreak(insn);
+        std::string s = render_ebreak(d.insn);
         s.resize(instruction_width, ' ');
         *pos << s << "          // HALT";
 
         *pos << std::endl;
     }
-    cout << "Execution terminated by EBREAK instruction\n";
+    *this->out << "Execution terminated by EBREAK instruction\n";
 
     this->halt = true;
 }
@@ -692,38 +1366,40 @@ void rv32i::exec_ebreak(uint32_t insn, std::ostream *pos)
 /*****************************************
  * U-Type Instructions
  * **************************************/
-void rv32i::exec_lui(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_lui(const decoded_insn &d, std::ostream *pos)
 {
 
     // store val to register reg
-    uint32_t reg = get_rd(insn);
-    int32_t val = get_imm_u(insn);
+    uint32_t reg = d.rd;
+    int32_t val = d.imm;
     this->regs.set(reg, val);
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 
-    if (pos)
+    if (trace::enabled && pos)
     {
         // 00000000: abcde237 lui x4,0xabcde // x4 = 0xabcde000
-        std::string s = render_lui(insn);
+        std::string s = render_lui(d.insn);
         s.resize(instruction_width, ' ');
         *pos << s << "          // ";
         *pos << "x" << reg << " = " << hex0x32(val);
         *pos << std::endl;
     }
 }
-void rv32i::exec_auipc(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_auipc(const decoded_insn &d, std::ostream *pos)
 {
     // store instruction addr + U-value to register reg
-    uint32_t reg = get_rd(insn);
-    int32_t val = get_imm_u(insn);
+    uint32_t reg = d.rd;
+    int32_t val = d.imm;
     this->regs.set(reg, val + this->pc);
 
     // std::cout << "reg: " << reg << "  data: " << hex32(this->regs.get(reg)) << std::endl;
-    if (pos)
+    if (trace::enabled && pos)
     {
         // 00000004: abcde217 auipc x4,0xabcde // x4 = 0x00000004 + 0xabcde000 = 0xabcde004
-        std::string s = render_auipc(insn);
+        std::string s = render_auipc(d.insn);
         s.resize(instruction_width, ' ');
         *pos << s << "          // ";
         *pos << "x" << reg << " = " << hex0x32(this->pc) << " + " << hex0x32(val) << " = " << hex0x32(val + this->pc);
@@ -731,23 +1407,24 @@ void rv32i::exec_auipc(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
 /*****************************************
  * J-Type Instructions
  * **************************************/
-void rv32i::exec_jal(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_jal(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t reg = get_rd(insn);
-    uint32_t nxt_insn = this->pc + 4;
+    uint32_t reg = d.rd;
+    uint32_t nxt_insn = this->pc + d.len;
     this->regs.set(reg, nxt_insn);
-    uint32_t imm_j = get_imm_j(insn);
+    uint32_t imm_j = d.imm;
 
-    if (pos)
+    if (trace::enabled && pos)
     {
         // 00000008: 008000ef jal x1,0x10 // x1 = 0x0000000c,  pc = 0x00000008 + 0x00000008 = 0x00000010
-        std::string s = render_jal(insn);
+        std::string s = render_jal(d.insn);
         s.resize(instruction_width, ' ');
         *pos << s << "          // ";
         *pos << "x" << reg << " = " << hex0x32(nxt_insn) << ",  pc"
@@ -762,21 +1439,22 @@ void rv32i::exec_jal(uint32_t insn, std::ostream *pos)
 /*****************************************
  * R-Type Instructions
  * **************************************/
-void rv32i::exec_add(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_add(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t reg = get_rd(insn);
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t rs2 = this->regs.get(get_rs2(insn));
+    uint32_t reg = d.rd;
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t rs2 = this->regs.get(d.rs2);
     int32_t sum = rs1 + rs2;
     this->regs.set(reg, sum);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_rtype(insn, " add    ");
+        std::string s = render_rtype(d.insn, " add    ");
         s.resize(instruction_width, ' ');
         // 000000e0: 00f77233 and x4,x14,x15 // x4 = 0xf0f0f0f0 + 0xf0f0f0f0 = 0xf0f0f0f0
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " + "
              << hex0x32(rs2)
@@ -786,23 +1464,24 @@ void rv32i::exec_add(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_and(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_and(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t reg = get_rd(insn);
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t rs2 = this->regs.get(get_rs2(insn));
+    uint32_t reg = d.rd;
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t rs2 = this->regs.get(d.rs2);
     int32_t res = (rs1 & rs2);
     this->regs.set(reg, res);
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_rtype(insn, " and    ");
+        std::string s = render_rtype(d.insn, " and    ");
         s.resize(instruction_width, ' ');
         // 000000dc: 00f76233 or x4,x14,x15 // x4 = 0xf0f0f0f0 | 0xf0f0f0f0 = 0xf0f0f0f0
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " & "
              << hex0x32(rs2)
@@ -812,24 +1491,25 @@ void rv32i::exec_and(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_or(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_or(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t reg = get_rd(insn);
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t rs2 = this->regs.get(get_rs2(insn));
+    uint32_t reg = d.rd;
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t rs2 = this->regs.get(d.rs2);
     int32_t res = (rs1 | rs2);
     this->regs.set(reg, res);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_rtype(insn, " or     ");
+        std::string s = render_rtype(d.insn, " or     ");
         s.resize(instruction_width, ' ');
         // 000000e0: 00f77233 and x4,x14,x15 // x4 = 0xf0f0f0f0 & 0xf0f0f0f0 = 0xf0f0f0f0
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " | "
              << hex0x32(rs2)
@@ -839,24 +1519,25 @@ void rv32i::exec_or(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_sll(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_sll(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    uint32_t rs2 = (uint32_t)this->regs.get(get_rs2(insn)) & 0x1F;
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    uint32_t rs2 = (uint32_t)this->regs.get(d.rs2) & 0x1F;
     uint32_t res = (rs1 << (rs2 & 0x1F));
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_rtype(insn, " sll    ");
+        std::string s = render_rtype(d.insn, " sll    ");
         s.resize(instruction_width, ' ');
         // 000000d0: 00f74233 xor x4,x14,x15 // x4 = 0xf0f0f0f0 ^ 0xf0f0f0f0 = 0x00000000
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " << "
              << rs2
@@ -868,18 +1549,19 @@ void rv32i::exec_sll(uint32_t insn, std::ostream *pos)
     this->regs.set(reg, res);
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_slt(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_slt(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rd = get_rd(insn);
-    int32_t rs1 = (int32_t)this->regs.get(get_rs1(insn));
-    int32_t rs2 = (int32_t)this->regs.get(get_rs2(insn));
+    uint32_t rd = d.rd;
+    int32_t rs1 = (int32_t)this->regs.get(d.rs1);
+    int32_t rs2 = (int32_t)this->regs.get(d.rs2);
     int32_t val = (rs1 < rs2) ? 1 : 0;
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_rtype(insn, " slt    ");
+        std::string s = render_rtype(d.insn, " slt    ");
         s.resize(instruction_width, ' ');
         // slt x4,x14,x15 // x4 = (0xf0f0f0f0 < 0xf0f0f0f0) ? 1 : 0 = 0x00000000
         *pos << s << "          // "
@@ -894,21 +1576,22 @@ void rv32i::exec_slt(uint32_t insn, std::ostream *pos)
     this->regs.set(rd, val);
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_sltu(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_sltu(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    uint32_t rs2 = (uint32_t)this->regs.get(get_rs2(insn));
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    uint32_t rs2 = (uint32_t)this->regs.get(d.rs2);
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     int32_t val = (rs1 < rs2) ? 1 : 0;
 
     // this->regs.set(reg, (rs1 < rs2) ? 1 : 0);
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_rtype(insn, " sltu   ");
+        std::string s = render_rtype(d.insn, " sltu   ");
         s.resize(instruction_width, ' ');
         // 000000cc: 00f73233 sltu x4,x14,x15 // x4 = (0xf0f0f0f0 <U 0xf0f0f0f0) ? 1 : 0 = 0x00000000
         *pos << s << "          // "
@@ -923,28 +1606,29 @@ void rv32i::exec_sltu(uint32_t insn, std::ostream *pos)
     regs.set(reg, val);
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_sra(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_sra(const decoded_insn &d, std::ostream *pos)
 {
     // signed data type for arithmetic shift
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t rs2 = this->regs.get(get_rs2(insn)) & 0x1F;
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t rs2 = this->regs.get(d.rs2) & 0x1F;
 
     // arithmetic shift right
     int32_t res = (rs1 >> rs2);
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, res);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_rtype(insn, " sra    ");
+        std::string s = render_rtype(d.insn, " sra    ");
         s.resize(instruction_width, ' ');
         // 000000d8: 40f751b3 sra x3,x14,x15 // x3 = 0xf0f0f0f0 >> 16 = 0xfffff0f0
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " >> "
              << rs2
@@ -954,24 +1638,27 @@ void rv32i::exec_sra(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_srl(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_srl(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    uint32_t rs2 = (uint32_t)this->regs.get(get_rs2(insn)) & 0x1F;
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    uint32_t rs2 = (uint32_t)this->regs.get(d.rs2) & 0x1F;
 
     // logical shift right
     int32_t res = (rs1 >> rs2);
 
-    if (pos)
+    uint32_t reg = d.rd;
+
+    if (trace::enabled && pos)
     {
-        std::string s = render_rtype(insn, " srl    ");
+        std::string s = render_rtype(d.insn, " srl    ");
         s.resize(instruction_width, ' ');
         // 000000d4: 00f751b3 srl x3,x14,x15 // x3 = 0xf0f0f0f0 >> 16 = 0x0000f0f0
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " >> "
              << (rs2)
@@ -980,28 +1667,28 @@ void rv32i::exec_srl(uint32_t insn, std::ostream *pos)
         *pos << std::endl;
     }
 
-    uint32_t reg = get_rd(insn);
     this->regs.set(reg, res);
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_sub(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_sub(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t reg = get_rd(insn);
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t rs2 = this->regs.get(get_rs2(insn));
+    uint32_t reg = d.rd;
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t rs2 = this->regs.get(d.rs2);
     int32_t sub = rs1 - rs2;
     this->regs.set(reg, sub);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_rtype(insn, " sub    ");
+        std::string s = render_rtype(d.insn, " sub    ");
         s.resize(instruction_width, ' ');
         // 000000e0: 00f77233 and x4,x14,x15 // x4 = 0xf0f0f0f0 & 0xf0f0f0f0 = 0xf0f0f0f0
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " - "
              << hex0x32(rs2)
@@ -1011,23 +1698,24 @@ void rv32i::exec_sub(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_xor(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_xor(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t reg = get_rd(insn);
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t rs2 = this->regs.get(get_rs2(insn));
+    uint32_t reg = d.rd;
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t rs2 = this->regs.get(d.rs2);
     int32_t res = (rs1 ^ rs2);
     this->regs.set(reg, res);
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_rtype(insn, " xor    ");
+        std::string s = render_rtype(d.insn, " xor    ");
         s.resize(instruction_width, ' ');
         // 000000d0: 00f74233 xor x4,x14,x15 // x4 = 0xf0f0f0f0 ^ 0xf0f0f0f0 = 0x00000000
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " ^ "
              << hex0x32(rs2)
@@ -1037,25 +1725,26 @@ void rv32i::exec_xor(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
 /*****************************************
  * I-Type Instructions
  * **************************************/
-void rv32i::exec_addi(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_addi(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t reg = get_rd(insn);
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    uint32_t reg = d.rd;
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
     int32_t sum = rs1 + imm_i;
     this->regs.set(reg, sum);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
         // 00000060: 01000313 addi x6,x0,16 // x6 = 0x00000000 + 0x00000010 = 0x00000010
 
-        std::string s = render_itype_alu(insn, " addi   ", get_imm_i(insn));
+        std::string s = render_itype_alu(d.insn, " addi   ", d.imm);
         s.resize(instruction_width, ' ');
         *pos << s << "          // ";
         *pos << "x" << reg << " = " << hex0x32(rs1) << " + " << hex0x32(imm_i) << " = " << hex0x32(sum);
@@ -1063,52 +1752,54 @@ void rv32i::exec_addi(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_andi(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_andi(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t reg = get_rd(insn);
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    uint32_t reg = d.rd;
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
     int32_t res = (rs1 & imm_i);
     this->regs.set(reg, res);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
         //  000000ac: 4d267213 andi x4,x12,1234 // x4 = 0xf0f0f0f0 & 0x000004d2 = 0x000000d0
 
-        std::string s = render_itype_alu(insn, " andi   ", get_imm_i(insn));
+        std::string s = render_itype_alu(d.insn, " andi   ", d.imm);
         s.resize(instruction_width, ' ');
         *pos << s << "          // ";
         *pos << "x" << reg << " = " << hex0x32(rs1) << " & " << hex0x32(imm_i) << " = " << hex0x32(res);
         *pos << std::endl;
     }
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_jalr(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_jalr(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
 
     // write after reading the register value for rs1
-    uint32_t reg = get_rd(insn);
-    uint32_t nxt_insn = this->pc + 4;
+    uint32_t reg = d.rd;
+    uint32_t nxt_insn = this->pc + d.len;
     this->regs.set(reg, nxt_insn);
 
     // jump
     this->pc = ((rs1 + imm_i) & 0xFFFFFFFE);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
         // 00000010: 01008267 jalr x4,16(x1) // x4 = 0x00000014,
         //pc = (0x00000010 + 0x0000000c) & 0xfffffffe = 0x0000001c
 
         // TODO: find out  0x0000000c
 
-        std::string s = render_jalr(insn);
+        std::string s = render_jalr(d.insn);
         s.resize(instruction_width, ' ');
         *pos << s << "          // ";
         *pos << "x" << reg << " = " << hex0x32(nxt_insn) << ",  pc"
@@ -1118,11 +1809,14 @@ void rv32i::exec_jalr(uint32_t insn, std::ostream *pos)
         *pos << std::endl;
     }
 }
-void rv32i::exec_lb(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_lb(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
     uint32_t addr = rs1 + imm_i;
+    if (this->paging && !translate(addr, access_load))
+        return;
 
     int32_t data = this->mem->get8(addr);
 
@@ -1131,13 +1825,13 @@ void rv32i::exec_lb(uint32_t insn, std::ostream *pos)
     if (0x80 & data)
         data |= 0xFFFFFF00;
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, data);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
 
-        std::string s = render_itype_load(insn, " lb     ");
+        std::string s = render_itype_load(d.insn, " lb     ");
         // 00000074: 01030203 lb x4,16(x6) // x4 = sx(m8(0x00000010 + 0x00000010)) = 0xffffffe3
 
         s.resize(instruction_width, ' ');
@@ -1147,25 +1841,28 @@ void rv32i::exec_lb(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
-void rv32i::exec_lh(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_lh(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
     uint32_t addr = rs1 + imm_i;
+    if (this->paging && !translate(addr, access_load))
+        return;
     int32_t data = this->mem->get16(addr);
 
     // sign extend
     if (0x8000 & data)
         data |= 0xFFFF0000;
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, data);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_itype_load(insn, " lh     ");
+        std::string s = render_itype_load(d.insn, " lh     ");
 
         // 0000007c: 01031203 lh x4,16(x6) // x4 = sx(m16(0x00000010 + 0x00000010)) = 0x00004ae3
         s.resize(instruction_width, ' ');
@@ -1175,23 +1872,26 @@ void rv32i::exec_lh(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
-void rv32i::exec_lw(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_lw(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
     uint32_t addr = rs1 + imm_i;
+    if (this->paging && !translate(addr, access_load))
+        return;
 
     int32_t data = this->mem->get32(addr);
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, data);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
 
-        std::string s = render_itype_load(insn, " lw     ");
+        std::string s = render_itype_load(d.insn, " lw     ");
 
         // 00000084: 01032203 lw x4,16(x6) // x4 = sx(m32(0x00000010 + 0x00000010)) = 0xfe004ae3
         s.resize(instruction_width, ' ');
@@ -1201,24 +1901,27 @@ void rv32i::exec_lw(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
-void rv32i::exec_lbu(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_lbu(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
     uint32_t addr = rs1 + imm_i;
+    if (this->paging && !translate(addr, access_load))
+        return;
 
     // zero extended
     int32_t data = this->mem->get8(addr);
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, data);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
 
-        std::string s = render_itype_load(insn, " lbu    ");
+        std::string s = render_itype_load(d.insn, " lbu    ");
         // 00000064: 01034203 lbu x4,16(x6) // x4 = zx(m8(0x00000010 + 0x00000010)) = 0x000000e3
 
         s.resize(instruction_width, ' ');
@@ -1228,24 +1931,27 @@ void rv32i::exec_lbu(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
-void rv32i::exec_lhu(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_lhu(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
     uint32_t addr = rs1 + imm_i;
+    if (this->paging && !translate(addr, access_load))
+        return;
 
     // zero extended
     int32_t data = this->mem->get16(addr);
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, data);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
 
-        std::string s = render_itype_load(insn, " lhu    ");
+        std::string s = render_itype_load(d.insn, " lhu    ");
 
         // 0000006c: 01035203 lhu x4,16(x6) // x4 = zx(m16(0x00000010 + 0x00000010)) = 0x00004ae3
         s.resize(instruction_width, ' ');
@@ -1255,25 +1961,26 @@ void rv32i::exec_lhu(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_ori(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_ori(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
     int32_t res = (rs1 | imm_i);
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, res);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_itype_alu(insn, " ori    ", get_imm_i(insn));
+        std::string s = render_itype_alu(d.insn, " ori    ", d.imm);
         s.resize(instruction_width, ' ');
         // 000000a8: 4d266213 ori x4,x12,1234 // x4 = 0xf0f0f0f0 | 0x000004d2 = 0xf0f0f4f2
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " | "
              << hex0x32(imm_i)
@@ -1283,29 +1990,30 @@ void rv32i::exec_ori(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_slli(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_slli(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
 
     // 5 LSB of imm_i is shamt_i
     int32_t shamt_i = (imm_i & 0x1F);
 
     int32_t res = (rs1 << shamt_i);
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, res);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_itype_alu(insn, " slli   ", get_imm_i(insn));
+        std::string s = render_itype_alu(d.insn, " slli   ", d.imm);
         s.resize(instruction_width, ' ');
         // 000000b0: 00c69213 slli x4,x13,12 // x4 = 0xf0f0f0f0 << 12 = 0x0f0f0000
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " << "
              << (imm_i)
@@ -1315,24 +2023,25 @@ void rv32i::exec_slli(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_slti(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_slti(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, (rs1 < imm_i) ? 1 : 0);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_itype_alu(insn, " slti   ", get_imm_i(insn));
+        std::string s = render_itype_alu(d.insn, " slti   ", d.imm);
         s.resize(instruction_width, ' ');
         // 0000009c: 4d262213 slti x4,x12,1234 // x4 = (0xf0f0f0f0 < 1234) ? 1 : 0 = 0x00000001
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = ("
+             << "x" << reg << " = ("
              << hex0x32(rs1)
              << " < "
              << imm_i
@@ -1342,24 +2051,25 @@ void rv32i::exec_slti(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_sltiu(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_sltiu(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    uint32_t imm_i = get_imm_i(insn);
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    uint32_t imm_i = d.imm;
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, (rs1 < imm_i) ? 1 : 0);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_itype_alu(insn, " sltiu  ", get_imm_i(insn));
+        std::string s = render_itype_alu(d.insn, " sltiu  ", d.imm);
         s.resize(instruction_width, ' ');
         // 000000a0: 4d263213 sltiu x4,x12,1234 // x4 = (0xf0f0f0f0 <U 1234) ? 1 : 0 = 0x00000000
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = ("
+             << "x" << reg << " = ("
              << hex0x32(rs1)
              << " <U "
              << imm_i
@@ -1369,13 +2079,14 @@ void rv32i::exec_sltiu(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_srai(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_srai(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
 
     // 5 LSB of imm_i is shamt_i
     int32_t shamt_i = (imm_i & 0x1F);
@@ -1383,16 +2094,16 @@ void rv32i::exec_srai(uint32_t insn, std::ostream *pos)
     // arithmetic shift right
     int32_t data = (rs1 >> shamt_i);
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, data);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_itype_alu(insn, " srai   ", get_imm_i(insn));
+        std::string s = render_itype_alu(d.insn, " srai   ", d.imm);
         s.resize(instruction_width, ' ');
         // 000000b8: 40c6d213 srai x4,x13,12 // x4 = 0xf0f0f0f0 >> 12 = 0xffff0f0f
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " >> "
              << shamt_i
@@ -1402,13 +2113,14 @@ void rv32i::exec_srai(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_srli(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_srli(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
 
     // 5 LSB of imm_i is shamt_i
     int32_t shamt_i = (imm_i & 0x1F);
@@ -1416,16 +2128,16 @@ void rv32i::exec_srli(uint32_t insn, std::ostream *pos)
     // logical shift right
     int32_t data = (rs1 >> shamt_i);
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, data);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_itype_alu(insn, " srli   ", get_imm_i(insn));
+        std::string s = render_itype_alu(d.insn, " srli   ", d.imm);
         s.resize(instruction_width, ' ');
         // 000000b4: 00c6d213 srli x4,x13,12 // x4 = 0xf0f0f0f0 >> 12 = 0x000f0f0f
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " >> "
              << (imm_i)
@@ -1435,27 +2147,28 @@ void rv32i::exec_srli(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
-void rv32i::exec_xori(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_xori(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_i = get_imm_i(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_i = d.imm;
 
     // xor
     int32_t res = (rs1 ^ imm_i);
 
-    uint32_t reg = get_rd(insn);
+    uint32_t reg = d.rd;
     this->regs.set(reg, res);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_itype_alu(insn, " xori   ", get_imm_i(insn));
+        std::string s = render_itype_alu(d.insn, " xori   ", d.imm);
         s.resize(instruction_width, ' ');
         // 000000a4: 4d264213 xori x4,x12,1234 // x4 = 0xf0f0f0f0 ^ 0x000004d2 = 0xf0f0f422
         *pos << s << "          // "
-             << "x" << get_rd(insn) << " = "
+             << "x" << reg << " = "
              << hex0x32(rs1)
              << " ^ "
              << hex0x32(imm_i)
@@ -1465,24 +2178,28 @@ void rv32i::exec_xori(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
 /*****************************************
  * S-Type Instructions
  * **************************************/
-void rv32i::exec_sb(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_sb(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_s = get_imm_s(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_s = d.imm;
     uint32_t addr = rs1 + imm_s;
-    uint8_t data = (uint8_t)this->regs.get(get_rs2(insn));
+    if (this->paging && !translate(addr, access_store))
+        return;
+    uint8_t data = (uint8_t)this->regs.get(d.rs2);
     this->mem->set8(addr, data);
+    invalidate(addr, 1);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
 
-        std::string s = render_stype(insn, " sb     ");
+        std::string s = render_stype(d.insn, " sb     ");
         // 0000008c: 0e500ea3 sb x5,253(x0) // m8(0x00000000 + 0x000000fd) = 0x000000ff
 
         s.resize(instruction_width, ' ');
@@ -1492,20 +2209,24 @@ void rv32i::exec_sb(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
-void rv32i::exec_sh(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_sh(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_s = get_imm_s(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_s = d.imm;
     uint32_t addr = rs1 + imm_s;
-    uint16_t data = (uint16_t)this->regs.get(get_rs2(insn));
-    this->mem->set8(addr, data);
+    if (this->paging && !translate(addr, access_store))
+        return;
+    uint16_t data = (uint16_t)this->regs.get(d.rs2);
+    this->mem->set16(addr, data);
+    invalidate(addr, 2);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
 
-        std::string s = render_stype(insn, " sh     ");
+        std::string s = render_stype(d.insn, " sh     ");
         // 00000090: 0e501823 sh x5,240(x0) // m16(0x00000000 + 0x000000f0) = 0x0000ffff
         s.resize(instruction_width, ' ');
         *pos << s << "          // ";
@@ -1514,25 +2235,29 @@ void rv32i::exec_sh(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
-void rv32i::exec_sw(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_sw(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t imm_s = get_imm_s(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t imm_s = d.imm;
     uint32_t addr = rs1 + imm_s;
+    if (this->paging && !translate(addr, access_store))
+        return;
 
-    // uint32_t data = (uint32_t)get_rs2(insn);
-    int32_t data = this->regs.get(get_rs2(insn));
+    // uint32_t data = (uint32_t)d.rs2;
+    int32_t data = this->regs.get(d.rs2);
 
-    this->mem->set8(addr, data);
+    this->mem->set32(addr, data);
+    invalidate(addr, 4);
 
     // std::cout << "imm_s : " << imm_s << "\taddr : " << addr << "\t rs1 :" << rs1 << "\tdata : " << data << std::endl;
 
-    if (pos)
+    if (trace::enabled && pos)
     {
 
-        std::string s = render_stype(insn, " sw     ");
+        std::string s = render_stype(d.insn, " sw     ");
         // 00000094: 0e502a23 sw x5,244(x0) // m32(0x00000000 + 0x000000f4) = 0xffffffff
         s.resize(instruction_width, ' ');
         *pos << s << "          // ";
@@ -1541,49 +2266,51 @@ void rv32i::exec_sw(uint32_t insn, std::ostream *pos)
     }
 
     // increment program counter
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
 
 /*****************************************
  * B-Type Instructions
  * **************************************/
-void rv32i::exec_beq(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_beq(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t rs2 = this->regs.get(get_rs2(insn));
-    int32_t imm_b = get_imm_b(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t rs2 = this->regs.get(d.rs2);
+    int32_t imm_b = d.imm;
 
     // conditional jump
-    int32_t jump_to = (rs1 == rs2 ? imm_b : 4);
+    int32_t jump_to = (rs1 == rs2 ? imm_b : d.len);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_btype(insn, " beq    ");
+        std::string s = render_btype(d.insn, " beq    ");
         s.resize(instruction_width, ' ');
         // 00000030: 00000463 beq x0,x0,0x38 // pc += (0x00000000 == 0x00000000 ? 0x00000008 : 4) = 0x00000038
         *pos << s << "          // ";
 
         *pos << "pc += (" << hex0x32(rs1) << " == " << hex0x32(rs2) << " ? "
              << hex0x32(imm_b) << " : "
-             << "4"
+             << (int)d.len
              << ") = " << hex0x32(this->pc + jump_to);
         *pos << std::endl;
     }
     // conditional jump
     this->pc += jump_to;
 }
-void rv32i::exec_bge(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_bge(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t rs2 = this->regs.get(get_rs2(insn));
-    int32_t imm_b = get_imm_b(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t rs2 = this->regs.get(d.rs2);
+    int32_t imm_b = d.imm;
 
     // conditional jump
-    int32_t jump_to = (rs1 >= rs2 ? imm_b : 4);
+    int32_t jump_to = (rs1 >= rs2 ? imm_b : d.len);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_btype(insn, " bge    ");
+        std::string s = render_btype(d.insn, " bge    ");
         s.resize(instruction_width, ' ');
         // 00000024: fe0558e3 bge x10,x0,0x14 //
         // pc += (0xf0f0f0f0 >= 0x00000000 ? 0xfffffff0 : 4) = 0x00000028
@@ -1591,50 +2318,52 @@ void rv32i::exec_bge(uint32_t insn, std::ostream *pos)
 
         *pos << "pc += (" << hex0x32(rs1) << " >= " << hex0x32(rs2) << " ? "
              << hex0x32(imm_b) << " : "
-             << "4"
+             << (int)d.len
              << ") = " << hex0x32(this->pc + jump_to);
         *pos << std::endl;
     }
     // conditional jump
     this->pc += jump_to;
 }
-void rv32i::exec_bgeu(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_bgeu(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    uint32_t rs2 = (uint32_t)this->regs.get(get_rs2(insn));
-    int32_t imm_b = get_imm_b(insn);
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    uint32_t rs2 = (uint32_t)this->regs.get(d.rs2);
+    int32_t imm_b = d.imm;
 
     // conditional jump
-    int32_t jump_to = (rs1 >= rs2 ? imm_b : 4);
+    int32_t jump_to = (rs1 >= rs2 ? imm_b : d.len);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_btype(insn, " bgeu   ");
+        std::string s = render_btype(d.insn, " bgeu   ");
         s.resize(instruction_width, ' ');
         // 0000002c: fea074e3 bgeu x0,x10,0x14 // pc += (0x00000000 >=U 0xf0f0f0f0 ? 0xffffffe8 : 4) = 0x00000030
         *pos << s << "          // ";
 
         *pos << "pc += (" << hex0x32(rs1) << " >=U " << hex0x32(rs2) << " ? "
              << hex0x32(imm_b) << " : "
-             << "4"
+             << (int)d.len
              << ") = " << hex0x32(this->pc + jump_to);
         *pos << std::endl;
     }
     // conditional jump
     this->pc += jump_to;
 }
-void rv32i::exec_blt(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_blt(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t rs2 = this->regs.get(get_rs2(insn));
-    int32_t imm_b = get_imm_b(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t rs2 = this->regs.get(d.rs2);
+    int32_t imm_b = d.imm;
 
     // conditional jump
-    int32_t jump_to = (rs1 < rs2 ? imm_b : 4);
+    int32_t jump_to = (rs1 < rs2 ? imm_b : d.len);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_btype(insn, " blt    ");
+        std::string s = render_btype(d.insn, " blt    ");
         s.resize(instruction_width, ' ');
         // 00000020: fe004ae3 blt x0,x0,0x14 //
         // pc += (0x00000000 < 0x00000000 ? 0xfffffff4 : 4) = 0x00000024
@@ -1642,48 +2371,50 @@ void rv32i::exec_blt(uint32_t insn, std::ostream *pos)
 
         *pos << "pc += (" << hex0x32(rs1) << " < " << hex0x32(rs2) << " ? "
              << hex0x32(imm_b) << " : "
-             << "4"
+             << (int)d.len
              << ") = " << hex0x32(this->pc + jump_to);
         *pos << std::endl;
     }
     // conditional jump
     this->pc += jump_to;
 }
-void rv32i::exec_bltu(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_bltu(const decoded_insn &d, std::ostream *pos)
 {
-    uint32_t rs1 = (uint32_t)this->regs.get(get_rs1(insn));
-    uint32_t rs2 = (uint32_t)this->regs.get(get_rs2(insn));
-    int32_t imm_b = get_imm_b(insn);
+    uint32_t rs1 = (uint32_t)this->regs.get(d.rs1);
+    uint32_t rs2 = (uint32_t)this->regs.get(d.rs2);
+    int32_t imm_b = d.imm;
 
-    int32_t jump_to = (rs1 < rs2 ? imm_b : 4);
+    int32_t jump_to = (rs1 < rs2 ? imm_b : d.len);
 
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_btype(insn, " bltu   ");
+        std::string s = render_btype(d.insn, " bltu   ");
         s.resize(instruction_width, ' ');
         // 00000028: fe0066e3 bltu x0,x0,0x14 // pc += (0x00000000 <U 0x00000000 ? 0xffffffec : 4) = 0x0000002c
         *pos << s << "          // ";
 
         *pos << "pc += (" << hex0x32(rs1) << " <U " << hex0x32(rs2) << " ? "
              << hex0x32(imm_b) << " : "
-             << "4"
+             << (int)d.len
              << ") = " << hex0x32(this->pc + jump_to);
         *pos << std::endl;
     }
     // conditional jump
     this->pc += jump_to;
 }
-void rv32i::exec_bne(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_bne(const decoded_insn &d, std::ostream *pos)
 {
-    int32_t rs1 = this->regs.get(get_rs1(insn));
-    int32_t rs2 = this->regs.get(get_rs2(insn));
-    int32_t imm_b = get_imm_b(insn);
+    int32_t rs1 = this->regs.get(d.rs1);
+    int32_t rs2 = this->regs.get(d.rs2);
+    int32_t imm_b = d.imm;
 
-    int32_t jump_to = (rs1 != rs2 ? imm_b : 4);
+    int32_t jump_to = (rs1 != rs2 ? imm_b : d.len);
     // std::cout << "pc: " << this->pc << " imm_b: " << imm_b << " pc+imm_b   " << hex32(this->pc + imm_b) << std::endl;
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_btype(insn, " bne    ");
+        std::string s = render_btype(d.insn, " bne    ");
         s.resize(instruction_width, ' ');
         // s0000001c: feb59ce3 bne x11,x11,0x14
         // // pc += (0xf0f0f0f0 != 0xf0f0f0f0 ? 0xfffffff8 : 4) = 0x00000020
@@ -1692,7 +2423,7 @@ void rv32i::exec_bne(uint32_t insn, std::ostream *pos)
 
         *pos << "pc += (" << hex0x32(rs1) << " != " << hex0x32(rs2) << " ? "
              << hex0x32(imm_b) << " : "
-             << "4"
+             << (int)d.len
              << ") = " << hex0x32(this->pc + jump_to);
         *pos << std::endl;
     }
@@ -1717,32 +2448,504 @@ void rv32i::exec_bne(uint32_t insn, std::ostream *pos)
 // void rv32i::exec_rtype(uint32_t insn, const char *mnemonic, std::ostream *pos)
 // {
 // }
-void rv32i::exec_fence(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_fence(const decoded_insn &d, std::ostream *pos)
 {
-    if (pos)
+    if (trace::enabled && pos)
     {
-        std::string s = render_fence(insn);
+        std::string s = render_fence(d.insn);
         s.resize(instruction_width, ' ');
         *pos << s << "          // fence";
         *pos << std::endl;
     }
+
+    // order this hart's memory accesses as seen by other harts
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
     // increment pc
-    this->pc = this->pc + 4;
+    this->pc = this->pc + d.len;
 }
-void rv32i::exec_ecall(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_sfence_vma(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t vaddr = this->regs.get(d.rs1);
+
+    if (trace::enabled && pos)
+    {
+        std::string s = render_sfence_vma(d.insn);
+        s.resize(instruction_width, ' ');
+        *pos << s << "          // ";
+        if (d.rs1)
+            *pos << "flush TLB for " << hex0x32(vaddr);
+        else
+            *pos << "flush TLB";
+        *pos << std::endl;
+    }
+
+    // with rs1 a virtual address, only its page is flushed (the ASID in rs2
+    // is ignored: the TLB holds the current address space only)
+    if (d.rs1)
+    {
+        tlb_entry &e = this->tlb[(vaddr >> page_shift) % tlb_entries];
+        if (e.vpn == vaddr >> page_shift)
+            e.perms = 0;
+    }
+    else
+    {
+        flush_tlb();
+    }
+
+    // increment pc
+    this->pc = this->pc + d.len;
+}
+template <class trace>
+void rv32i::exec_ecall(const decoded_insn &d, std::ostream *pos)
 {
 }
 
-void rv32i::exec_error(uint32_t insn, std::ostream *pos)
+template <class trace>
+void rv32i::exec_error(const decoded_insn &d, std::ostream *pos)
 {
-    std::cout << "ERROR OCCURRED!!!" << std::endl;
+    *this->out << "ERROR OCCURRED!!!" << std::endl;
     this->halt = true;
 }
 
+/*****************************************
+ * RV32M Instructions
+ * **************************************/
+
+// Write res, computed by the host from rs1 and rs2, to rd. The trace shows
+// the operation as "rs1 op rs2".
+template <class trace>
+void rv32i::exec_muldiv(const decoded_insn &d, std::ostream *pos, const char *mnemonic, const char *op, uint32_t res)
+{
+    if (trace::enabled && pos)
+    {
+        std::string s = render_rtype(d.insn, mnemonic);
+        s.resize(instruction_width, ' ');
+        // 00000100: 02f70233 mul x4,x14,x15 // x4 = 0x00000003 * 0xfffffffe = 0xfffffffa
+        *pos << s << "          // "
+             << "x" << (uint32_t)d.rd << " = "
+             << hex0x32(this->regs.get(d.rs1))
+             << " " << op << " "
+             << hex0x32(this->regs.get(d.rs2))
+             << " = "
+             << hex0x32(res);
+        *pos << std::endl;
+    }
+
+    this->regs.set(d.rd, res);
+
+    // increment program counter
+    this->pc = this->pc + d.len;
+}
+
+template <class trace>
+void rv32i::exec_mul(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_muldiv<trace>(d, pos, " mul    ", "*", rs1 * rs2);
+}
+
+template <class trace>
+void rv32i::exec_mulh(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_muldiv<trace>(d, pos, " mulh   ", "*h", rv32m_mulh(rs1, rs2));
+}
+
+template <class trace>
+void rv32i::exec_mulhsu(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_muldiv<trace>(d, pos, " mulhsu ", "*hsu", rv32m_mulhsu(rs1, rs2));
+}
+
+template <class trace>
+void rv32i::exec_mulhu(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_muldiv<trace>(d, pos, " mulhu  ", "*hu", rv32m_mulhu(rs1, rs2));
+}
+
+template <class trace>
+void rv32i::exec_div(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_muldiv<trace>(d, pos, " div    ", "/", rv32m_div(rs1, rs2));
+}
+
+template <class trace>
+void rv32i::exec_divu(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_muldiv<trace>(d, pos, " divu   ", "/u", rv32m_divu(rs1, rs2));
+}
+
+template <class trace>
+void rv32i::exec_rem(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_muldiv<trace>(d, pos, " rem    ", "%", rv32m_rem(rs1, rs2));
+}
+
+template <class trace>
+void rv32i::exec_remu(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_muldiv<trace>(d, pos, " remu   ", "%u", rv32m_remu(rs1, rs2));
+}
+
+/*****************************************
+ * Zbb and Zba Instructions
+ * **************************************/
+
+// Write res, computed by the host from rs1 (and rs2 or the shift amount),
+// to rd. The trace shows the operation as a call, "mnemonic(rs1, rs2)".
+template <class trace>
+void rv32i::exec_bitmanip(const decoded_insn &d, std::ostream *pos, uint32_t res)
+{
+    if (trace::enabled && pos)
+    {
+        const bitmanip_insn *b = find_bitmanip(d.insn);
+        std::string s = render_bitmanip(d.insn, b->mnemonic, b->form);
+        s.resize(instruction_width, ' ');
+        std::string name = b->mnemonic;
+        name.erase(name.find_last_not_of(' ') + 1);
+        // 00000100: 60079213 clz x4,x15 // x4 = clz(0x00f00000) = 0x00000008
+        *pos << s << "          // "
+             << "x" << (uint32_t)d.rd << " = " << name.substr(1) << "("
+             << hex0x32(this->regs.get(d.rs1));
+        if (b->form == 'r')
+            *pos << ", " << hex0x32(this->regs.get(d.rs2));
+        else if (b->form == 'i')
+            *pos << ", " << std::dec << d.imm;
+        *pos << ") = "
+             << hex0x32(res);
+        *pos << std::endl;
+    }
+
+    this->regs.set(d.rd, res);
+
+    // increment program counter
+    this->pc = this->pc + d.len;
+}
+
+template <class trace>
+void rv32i::exec_andn(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, rs1 & ~rs2);
+}
+
+template <class trace>
+void rv32i::exec_orn(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, rs1 | ~rs2);
+}
+
+template <class trace>
+void rv32i::exec_xnor(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, ~(rs1 ^ rs2));
+}
+
+template <class trace>
+void rv32i::exec_clz(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    exec_bitmanip<trace>(d, pos, zbb_clz(rs1));
+}
+
+template <class trace>
+void rv32i::exec_ctz(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    exec_bitmanip<trace>(d, pos, zbb_ctz(rs1));
+}
+
+template <class trace>
+void rv32i::exec_cpop(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    exec_bitmanip<trace>(d, pos, zbb_cpop(rs1));
+}
+
+template <class trace>
+void rv32i::exec_max(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, (int32_t)rs1 > (int32_t)rs2 ? rs1 : rs2);
+}
+
+template <class trace>
+void rv32i::exec_maxu(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, rs1 > rs2 ? rs1 : rs2);
+}
+
+template <class trace>
+void rv32i::exec_min(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, (int32_t)rs1 < (int32_t)rs2 ? rs1 : rs2);
+}
+
+template <class trace>
+void rv32i::exec_minu(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, rs1 < rs2 ? rs1 : rs2);
+}
+
+template <class trace>
+void rv32i::exec_sext_b(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    exec_bitmanip<trace>(d, pos, (int8_t)rs1);
+}
+
+template <class trace>
+void rv32i::exec_sext_h(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    exec_bitmanip<trace>(d, pos, (int16_t)rs1);
+}
+
+template <class trace>
+void rv32i::exec_zext_h(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    exec_bitmanip<trace>(d, pos, (uint16_t)rs1);
+}
+
+template <class trace>
+void rv32i::exec_rol(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, zbb_rol(rs1, rs2));
+}
+
+template <class trace>
+void rv32i::exec_ror(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, zbb_ror(rs1, rs2));
+}
+
+template <class trace>
+void rv32i::exec_rori(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    exec_bitmanip<trace>(d, pos, zbb_ror(rs1, d.imm));
+}
+
+template <class trace>
+void rv32i::exec_orc_b(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    exec_bitmanip<trace>(d, pos, zbb_orc_b(rs1));
+}
+
+template <class trace>
+void rv32i::exec_rev8(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    exec_bitmanip<trace>(d, pos, zbb_rev8(rs1));
+}
+
+template <class trace>
+void rv32i::exec_sh1add(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, (rs1 << 1) + rs2);
+}
+
+template <class trace>
+void rv32i::exec_sh2add(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, (rs1 << 2) + rs2);
+}
+
+template <class trace>
+void rv32i::exec_sh3add(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t rs1 = this->regs.get(d.rs1);
+    uint32_t rs2 = this->regs.get(d.rs2);
+    exec_bitmanip<trace>(d, pos, (rs1 << 3) + rs2);
+}
+
+/*****************************************
+ * Zicsr Instructions
+ * **************************************/
+
+// read CSR csr into val; false if there is no such CSR
+bool rv32i::csr_read(uint32_t csr, uint32_t &val) const
+{
+    switch (csr)
+    {
+    case csr_satp:
+        val = this->satp;
+        return true;
+    case csr_mhartid:
+        val = this->hartid;
+        return true;
+    case csr_vl:
+        val = this->vl;
+        return true;
+    case csr_vtype:
+        val = this->vtype;
+        return true;
+    case csr_vlenb:
+        val = this->vregs.get_vlenb();
+        return true;
+    }
+    return false;
+}
+
+// write val to CSR csr; false if there is no such CSR or it is read-only
+bool rv32i::csr_write(uint32_t csr, uint32_t val)
+{
+    switch (csr)
+    {
+    case csr_satp:
+        // MODE (bit 31) turns Sv32 translation on
+        this->satp = val;
+        this->paging = (val >> 31) != 0;
+        flush_tlb();
+        return true;
+    case csr_mhartid:
+        return false;
+    }
+    return false;
+}
+
+// The six CSR instructions: read the CSR into rd, then write it with rs1 (or
+// the 5-bit immediate in the rs1 field), set the bits of it or clear them.
+// csrrs and csrrc with x0 (or 0) do not write. Accessing a missing CSR, or
+// writing a read-only one, halts like an illegal instruction.
+template <class trace>
+void rv32i::exec_csr(const decoded_insn &d, std::ostream *pos, const char *mnemonic)
+{
+    uint32_t funct3 = get_funct3(d.insn);
+    uint32_t csr = d.imm & 0xfff;
+    uint32_t src = (funct3 & 0b100) ? d.rs1 : (uint32_t)this->regs.get(d.rs1);
+    bool writes = (funct3 & 0b011) == 0b001 || d.rs1 != 0;
+
+    uint32_t old = 0;
+    uint32_t val = 0;
+    bool ok = csr_read(csr, old);
+    if (ok && writes)
+    {
+        switch (funct3 & 0b011)
+        {
+        case 0b001:
+            val = src;
+            break;
+        case 0b010:
+            val = old | src;
+            break;
+        default:
+            val = old & ~src;
+            break;
+        }
+        ok = csr_write(csr, val);
+    }
+
+    if (trace::enabled && pos)
+    {
+        std::string s = render_csrrx(d.insn, mnemonic);
+        s.resize(instruction_width, ' ');
+        *pos << s << "          // ";
+        if (!ok)
+            *pos << "ILLEGAL CSR ACCESS";
+        else if (writes)
+            *pos << "x" << (uint32_t)d.rd << " = " << render_csr(csr) << " = " << hex0x32(old) << ", " << render_csr(csr) << " = " << hex0x32(val);
+        else
+            *pos << "x" << (uint32_t)d.rd << " = " << render_csr(csr) << " = " << hex0x32(old);
+        *pos << std::endl;
+    }
+
+    if (!ok)
+    {
+        this->halt = true;
+        return;
+    }
+
+    this->regs.set(d.rd, old);
+
+    // increment program counter
+    this->pc = this->pc + d.len;
+}
+
+template <class trace>
+void rv32i::exec_csrrw(const decoded_insn &d, std::ostream *pos)
+{
+    exec_csr<trace>(d, pos, " csrrw  ");
+}
+template <class trace>
+void rv32i::exec_csrrs(const decoded_insn &d, std::ostream *pos)
+{
+    exec_csr<trace>(d, pos, " csrrs  ");
+}
+template <class trace>
+void rv32i::exec_csrrc(const decoded_insn &d, std::ostream *pos)
+{
+    exec_csr<trace>(d, pos, " csrrc  ");
+}
+template <class trace>
+void rv32i::exec_csrrwi(const decoded_insn &d, std::ostream *pos)
+{
+    exec_csr<trace>(d, pos, " csrrwi ");
+}
+template <class trace>
+void rv32i::exec_csrrsi(const decoded_insn &d, std::ostream *pos)
+{
+    exec_csr<trace>(d, pos, " csrrsi ");
+}
+template <class trace>
+void rv32i::exec_csrrci(const decoded_insn &d, std::ostream *pos)
+{
+    exec_csr<trace>(d, pos, " csrrci ");
+}
+
 /*****************************************
  * String render formatting functions
  * **************************************/
 
+// a compressed instruction, rendered as the instruction it expands to but
+// showing its own 16 bits
+std::string rv32i::render_compressed(uint16_t insn) const
+{
+    uint32_t expanded = expand_compressed(insn);
+    std::string s = expanded ? decode(expanded) : render_illegal_insn(expanded);
+
+    return "    " + hex8(insn >> 8) + hex8(insn) + s.substr(8);
+}
+
 std::string rv32i::render_illegal_insn(uint32_t insn) const
 {
     std::ostringstream os;
@@ -1848,6 +3051,23 @@ std::string rv32i::render_rtype(uint32_t insn, const char *mnemonic) const
     return os.str();
 }
 
+// Zbb and Zba instructions: as R-type, or as an immediate shift (rori), or
+// with rs1 alone
+std::string rv32i::render_bitmanip(uint32_t insn, const char *mnemonic, char form) const
+{
+    if (form == 'r')
+        return render_rtype(insn, mnemonic);
+    if (form == 'i')
+        return render_itype_alu(insn, mnemonic, get_imm_i(insn));
+
+    std::ostringstream os;
+
+    os << hex32(insn) << " "; // the instruction hex value
+    os << mnemonic;
+    os << " x" << std::dec << get_rd(insn) << ",x" << get_rs1(insn);
+    return os.str();
+}
+
 std::string rv32i::render_fence(uint32_t insn) const
 {
     std::ostringstream os;
@@ -1901,6 +3121,16 @@ std::string rv32i::render_fence(uint32_t insn) const
     return os.str();
 }
 
+std::string rv32i::render_sfence_vma(uint32_t insn) const
+{
+    std::ostringstream os;
+
+    os << hex32(insn) << " "; // the instruction hex value
+    os << " sfence.vma x" << std::dec << get_rs1(insn) << ",x" << get_rs2(insn);
+
+    return os.str();
+}
+
 std::string rv32i::render_ecall(uint32_t insn) const
 {
     std::ostringstream os;
@@ -1929,6 +3159,39 @@ std::string rv32i::render_eror(uint32_t insn) const
     return os.str();
 }
 
+// the name of a CSR, or its number if it has none here
+std::string rv32i::render_csr(uint32_t csr) const
+{
+    switch (csr)
+    {
+    case csr_satp:
+        return "satp";
+    case csr_mhartid:
+        return "mhartid";
+    }
+
+    std::ostringstream os;
+    os << "0x" << std::hex << csr;
+    return os.str();
+}
+
+std::string rv32i::render_csrrx(uint32_t insn, const char *mnemonic) const
+{
+    std::ostringstream os;
+
+    os << hex32(insn) << " "; // the instruction hex value
+    os << mnemonic;
+    os << " x" << std::dec << get_rd(insn) << "," << render_csr(insn >> 20) << ",";
+
+    // the immediate forms take a 5-bit value in place of rs1
+    if (get_funct3(insn) & 0b100)
+        os << get_rs1(insn);
+    else
+        os << "x" << get_rs1(insn);
+
+    return os.str();
+}
+
 std::string rv32i::render_total_insn_exec(uint64_t total) const
 {
     std::ostringstream os;
@@ -1939,3 +3202,84 @@ std::string rv32i::render_total_insn_exec(uint64_t total) const
         os << " instructions executed";
     return os.str();
 }
+
+// The untraced handlers are also named by the other engines (to recognise
+// instructions), so they are instantiated here explicitly.
+template void rv32i::exec_illegal_insn<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_ebreak<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_lui<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_auipc<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_jal<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_add<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_and<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_or<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sll<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_slt<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sltu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sra<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_srl<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sub<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_xor<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_addi<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_andi<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_jalr<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_lb<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_lh<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_lw<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_lbu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_lhu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_ori<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_slli<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_slti<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sltiu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_srai<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_srli<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_xori<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sb<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sh<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sw<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_beq<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_bge<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_bgeu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_blt<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_bltu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_bne<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_fence<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_mul<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_mulh<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_mulhsu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_mulhu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_div<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_divu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_rem<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_remu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_andn<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_orn<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_xnor<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_clz<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_ctz<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_cpop<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_max<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_maxu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_min<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_minu<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sext_b<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sext_h<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_zext_h<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_rol<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_ror<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_rori<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_orc_b<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_rev8<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sh1add<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sh2add<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sh3add<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_sfence_vma<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_ecall<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_error<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_csrrw<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_csrrs<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_csrrc<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_csrrwi<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_csrrsi<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_csrrci<trace_off>(const decoded_insn &d, std::ostream *pos);
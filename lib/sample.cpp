@@ -0,0 +1,169 @@
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "include/rv32i.h"
+
+/*****************************************
+ * Sampled simulation
+ *
+ * Rather than model every instruction, run() can alternate between running
+ * sample_skip instructions at full speed with the chosen engine and
+ * measuring a detailed window of sample_window instructions, run one at a
+ * time. At the end the windows are taken as a sample of the whole program:
+ * each metric is estimated by its mean over the windows, with a 95%
+ * confidence interval from their spread.
+ *
+ * The detailed windows count the instruction mix and the cycles a simple
+ * in-order pipeline would take: one per instruction, plus a load-use delay
+ * after every load and a refill after every taken branch or jump.
+ * **************************************/
+
+static constexpr uint32_t sample_load_penalty = 1;     // extra cycles of a load
+static constexpr uint32_t sample_redirect_penalty = 2; // extra cycles of a taken branch or jump
+
+// z of a two-sided 95% confidence interval (normal approximation)
+static constexpr double sample_z95 = 1.96;
+
+// what a detailed window measured
+struct sample_counts
+{
+    uint64_t insns = 0;
+    uint64_t cycles = 0;
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    uint64_t branches = 0;
+    uint64_t taken = 0;
+    uint64_t jumps = 0;
+};
+
+// count insn, len bytes long, run at pc, which left the pc at next_pc
+static void sample_count(sample_counts &c, uint32_t insn, uint32_t len, uint32_t pc, uint32_t next_pc)
+{
+    c.insns++;
+    c.cycles++;
+    switch (rv32i::get_opcode(insn))
+    {
+    case opcode_load_imm:
+        c.loads++;
+        c.cycles += sample_load_penalty;
+        break;
+    case opcode_stype:
+        c.stores++;
+        break;
+    case opcode_btype:
+        c.branches++;
+        if (next_pc != pc + len)
+        {
+            c.taken++;
+            c.cycles += sample_redirect_penalty;
+        }
+        break;
+    case opcode_jal:
+    case opcode_jalr:
+        c.jumps++;
+        c.cycles += sample_redirect_penalty;
+        break;
+    }
+}
+
+// Print the mean of f over the windows, its 95% confidence interval and,
+// if scale is not 0, both scaled by it (the whole-program estimate).
+template <class F>
+static void sample_report(std::ostream &os, const char *name, const std::vector<sample_counts> &windows, F f, double scale)
+{
+    double n = windows.size();
+    double sum = 0;
+    for (const sample_counts &c : windows)
+        sum += f(c);
+    double mean = sum / n;
+
+    double squares = 0;
+    for (const sample_counts &c : windows)
+        squares += (f(c) - mean) * (f(c) - mean);
+    double half = n > 1 ? sample_z95 * std::sqrt(squares / (n - 1) / n) : 0;
+
+    os << "    " << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(4)
+       << std::setw(12) << mean << " +- " << std::setw(10) << half;
+    if (scale)
+        os << std::setprecision(0) << "    total " << std::setw(14) << mean * scale << " +- " << std::setw(12) << half * scale;
+    os << std::defaultfloat << std::endl;
+}
+
+// Run until halted or limit instructions executed, alternating between the
+// engine and detailed windows, then report the estimates.
+void rv32i::run_sampled(uint64_t limit)
+{
+    std::vector<sample_counts> windows;
+
+    while (!is_halted() && !(limit && this->insn_counter >= limit))
+    {
+        // fast-forward
+        uint64_t to = this->insn_counter + this->sample_skip;
+        if (limit && to > limit)
+            to = limit;
+        if (this->sample_skip)
+            execute(to);
+        if (is_halted() || (limit && this->insn_counter >= limit))
+            break;
+
+        // detailed window, one instruction (or fused pair) at a time
+        uint64_t end = this->insn_counter + this->sample_window;
+        if (limit && end > limit)
+            end = limit;
+        use_trace_policy(false);
+        this->insn_limit = end;
+
+        sample_counts c;
+        while (!is_halted() && this->insn_counter < end)
+        {
+            uint32_t pc = this->pc;
+            uint64_t size = this->mem->get_size();
+            uint32_t align = this->compressed ? 1 : 3;
+            uint32_t insn = !(pc & align) && (uint64_t)pc + 4 <= size ? this->mem->get32(pc) : 0;
+            uint32_t second = !(pc & align) && (uint64_t)pc + 8 <= size ? this->mem->get32(pc + 4) : 0;
+            uint32_t len = insn_length(insn);
+            if (len == 2)
+                insn = expand_compressed(insn);
+            uint64_t before = this->insn_counter;
+
+            step<trace_off>();
+
+            // only two 32-bit instructions are fused
+            if (this->insn_counter - before == 2)
+            {
+                sample_count(c, insn, 4, pc, pc + 4);
+                sample_count(c, second, 4, pc + 4, this->pc);
+            }
+            else
+            {
+                sample_count(c, insn, len, pc, this->pc);
+            }
+        }
+
+        // a window cut short by the end of the run would skew the means, so
+        // it only counts if there is nothing else
+        if (c.insns == this->sample_window || (windows.empty() && c.insns))
+            windows.push_back(c);
+    }
+
+    uint64_t detailed = 0;
+    for (const sample_counts &c : windows)
+        detailed += c.insns;
+
+    std::ostream &os = *this->out;
+    os << "Sampled " << windows.size() << " windows, " << detailed << " of " << this->insn_counter
+       << " instructions in detail" << std::endl;
+    if (windows.empty())
+        return;
+
+    double total = this->insn_counter;
+    os << "    per instruction (95% confidence)          whole program" << std::endl;
+    sample_report(os, "cycles", windows, [](const sample_counts &c) { return (double)c.cycles / c.insns; }, total);
+    sample_report(os, "loads", windows, [](const sample_counts &c) { return (double)c.loads / c.insns; }, total);
+    sample_report(os, "stores", windows, [](const sample_counts &c) { return (double)c.stores / c.insns; }, total);
+    sample_report(os, "branches", windows, [](const sample_counts &c) { return (double)c.branches / c.insns; }, total);
+    sample_report(os, "taken branches", windows, [](const sample_counts &c) { return (double)c.taken / c.insns; }, total);
+    sample_report(os, "jumps", windows, [](const sample_counts &c) { return (double)c.jumps / c.insns; }, total);
+}
@@ -0,0 +1,412 @@
+#include <iostream>
+
+#include "include/hex.h"
+#include "include/rv32i.h"
+
+/*****************************************
+ * Threaded execution engine
+ *
+ * Every instruction is prepared once into a threaded_insn holding the address
+ * of the code that implements it, so going from one instruction to the next is
+ * a single indirect jump rather than tick() -> dcex() -> exec_*. With GCC (and
+ * compilers that accept its extensions) the ops are labels in one function
+ * reached by computed goto. Elsewhere, or when built with
+ * -DRV32I_NO_COMPUTED_GOTO, each op is a small function returning the next
+ * instruction to run (call threading).
+ *
+ * Only the common RV32I instructions and RV32M have ops of their own. Anything else
+ * (fence, ecall, ebreak, CSR accesses, illegal instructions) goes through
+ * the generic op, which calls the reference exec_* handler, so results always
+ * match tick().
+ * **************************************/
+
+// The hart while the threaded engine runs it
+struct threaded_context
+{
+    uint32_t x[33]; // x0..x31 plus the scratch slot written instead of x0
+    uint32_t pc;
+    uint64_t count; // instructions executed so far
+    uint64_t stop;  // value of count at which to return
+    rv32i *cpu;
+    memory *mem;
+};
+
+// The ops with their own threaded code. SEQ ops continue with the instruction
+// at pc+len (len being 4, or with the C extension the length of the
+// instruction), JMP ops set the new pc themselves.
+#define THREADED_OPS(SEQ, JMP)                                                             \
+    SEQ(lui, c.x[t->rd] = t->imm;)                                                         \
+    SEQ(auipc, c.x[t->rd] = c.pc + t->imm;)                                                \
+    JMP(jal, c.x[t->rd] = c.pc + len; c.pc += t->imm;)                                     \
+    JMP(jalr, uint32_t to = (c.x[t->rs1] + t->imm) & 0xFFFFFFFE;                           \
+        c.x[t->rd] = c.pc + len; c.pc = to;)                                               \
+    JMP(beq, c.pc += (c.x[t->rs1] == c.x[t->rs2]) ? t->imm : len;)                         \
+    JMP(bne, c.pc += (c.x[t->rs1] != c.x[t->rs2]) ? t->imm : len;)                         \
+    JMP(blt, c.pc += ((int32_t)c.x[t->rs1] < (int32_t)c.x[t->rs2]) ? t->imm : len;)        \
+    JMP(bge, c.pc += ((int32_t)c.x[t->rs1] >= (int32_t)c.x[t->rs2]) ? t->imm : len;)       \
+    JMP(bltu, c.pc += (c.x[t->rs1] < c.x[t->rs2]) ? t->imm : len;)                         \
+    JMP(bgeu, c.pc += (c.x[t->rs1] >= c.x[t->rs2]) ? t->imm : len;)                        \
+    SEQ(lb, c.x[t->rd] = (int8_t)c.mem->get8(c.x[t->rs1] + t->imm);)                       \
+    SEQ(lh, c.x[t->rd] = (int16_t)c.mem->get16(c.x[t->rs1] + t->imm);)                     \
+    SEQ(lw, c.x[t->rd] = c.mem->get32(c.x[t->rs1] + t->imm);)                              \
+    SEQ(lbu, c.x[t->rd] = c.mem->get8(c.x[t->rs1] + t->imm);)                              \
+    SEQ(lhu, c.x[t->rd] = c.mem->get16(c.x[t->rs1] + t->imm);)                             \
+    SEQ(sb, uint32_t addr = c.x[t->rs1] + t->imm;                                          \
+        c.mem->set8(addr, c.x[t->rs2]); c.cpu->invalidate(addr, 1);)                       \
+    SEQ(sh, uint32_t addr = c.x[t->rs1] + t->imm;                                          \
+        c.mem->set16(addr, c.x[t->rs2]); c.cpu->invalidate(addr, 2);)                      \
+    SEQ(sw, uint32_t addr = c.x[t->rs1] + t->imm;                                          \
+        c.mem->set32(addr, c.x[t->rs2]); c.cpu->invalidate(addr, 4);)                      \
+    SEQ(addi, c.x[t->rd] = c.x[t->rs1] + t->imm;)                                          \
+    SEQ(slti, c.x[t->rd] = ((int32_t)c.x[t->rs1] < t->imm) ? 1 : 0;)                       \
+    SEQ(sltiu, c.x[t->rd] = (c.x[t->rs1] < (uint32_t)t->imm) ? 1 : 0;)                     \
+    SEQ(xori, c.x[t->rd] = c.x[t->rs1] ^ t->imm;)                                          \
+    SEQ(ori, c.x[t->rd] = c.x[t->rs1] | t->imm;)                                           \
+    SEQ(andi, c.x[t->rd] = c.x[t->rs1] & t->imm;)                                          \
+    SEQ(slli, c.x[t->rd] = c.x[t->rs1] << (t->imm & 0x1F);)                                \
+    SEQ(srli, c.x[t->rd] = c.x[t->rs1] >> (t->imm & 0x1F);)                                \
+    SEQ(srai, c.x[t->rd] = (int32_t)c.x[t->rs1] >> (t->imm & 0x1F);)                       \
+    SEQ(add, c.x[t->rd] = c.x[t->rs1] + c.x[t->rs2];)                                      \
+    SEQ(sub, c.x[t->rd] = c.x[t->rs1] - c.x[t->rs2];)                                      \
+    SEQ(sll, c.x[t->rd] = c.x[t->rs1] << (c.x[t->rs2] & 0x1F);)                            \
+    SEQ(slt, c.x[t->rd] = ((int32_t)c.x[t->rs1] < (int32_t)c.x[t->rs2]) ? 1 : 0;)          \
+    SEQ(sltu, c.x[t->rd] = (c.x[t->rs1] < c.x[t->rs2]) ? 1 : 0;)                           \
+    SEQ(xor, c.x[t->rd] = c.x[t->rs1] ^ c.x[t->rs2];)                                      \
+    SEQ(srl, c.x[t->rd] = c.x[t->rs1] >> (c.x[t->rs2] & 0x1F);)                            \
+    SEQ(sra, c.x[t->rd] = (int32_t)c.x[t->rs1] >> (c.x[t->rs2] & 0x1F);)                   \
+    SEQ(or, c.x[t->rd] = c.x[t->rs1] | c.x[t->rs2];)                                       \
+    SEQ(and, c.x[t->rd] = c.x[t->rs1] & c.x[t->rs2];)                                      \
+    SEQ(mul, c.x[t->rd] = c.x[t->rs1] * c.x[t->rs2];)                                      \
+    SEQ(mulh, c.x[t->rd] = rv32m_mulh(c.x[t->rs1], c.x[t->rs2]);)                          \
+    SEQ(mulhsu, c.x[t->rd] = rv32m_mulhsu(c.x[t->rs1], c.x[t->rs2]);)                      \
+    SEQ(mulhu, c.x[t->rd] = rv32m_mulhu(c.x[t->rs1], c.x[t->rs2]);)                        \
+    SEQ(div, c.x[t->rd] = rv32m_div(c.x[t->rs1], c.x[t->rs2]);)                            \
+    SEQ(divu, c.x[t->rd] = rv32m_divu(c.x[t->rs1], c.x[t->rs2]);)                          \
+    SEQ(rem, c.x[t->rd] = rv32m_rem(c.x[t->rs1], c.x[t->rs2]);)                            \
+    SEQ(remu, c.x[t->rd] = rv32m_remu(c.x[t->rs1], c.x[t->rs2]);)                          \
+    SEQ(andn, c.x[t->rd] = c.x[t->rs1] & ~c.x[t->rs2];)                                    \
+    SEQ(orn, c.x[t->rd] = c.x[t->rs1] | ~c.x[t->rs2];)                                     \
+    SEQ(xnor, c.x[t->rd] = ~(c.x[t->rs1] ^ c.x[t->rs2]);)                                  \
+    SEQ(clz, c.x[t->rd] = zbb_clz(c.x[t->rs1]);)                                           \
+    SEQ(ctz, c.x[t->rd] = zbb_ctz(c.x[t->rs1]);)                                           \
+    SEQ(cpop, c.x[t->rd] = zbb_cpop(c.x[t->rs1]);)                                         \
+    SEQ(max, uint32_t a = c.x[t->rs1]; uint32_t b = c.x[t->rs2];                           \
+        c.x[t->rd] = (int32_t)a > (int32_t)b ? a : b;)                                     \
+    SEQ(maxu, uint32_t a = c.x[t->rs1]; uint32_t b = c.x[t->rs2];                          \
+        c.x[t->rd] = a > b ? a : b;)                                                       \
+    SEQ(min, uint32_t a = c.x[t->rs1]; uint32_t b = c.x[t->rs2];                           \
+        c.x[t->rd] = (int32_t)a < (int32_t)b ? a : b;)                                     \
+    SEQ(minu, uint32_t a = c.x[t->rs1]; uint32_t b = c.x[t->rs2];                          \
+        c.x[t->rd] = a < b ? a : b;)                                                       \
+    SEQ(sext_b, c.x[t->rd] = (int8_t)c.x[t->rs1];)                                         \
+    SEQ(sext_h, c.x[t->rd] = (int16_t)c.x[t->rs1];)                                        \
+    SEQ(zext_h, c.x[t->rd] = (uint16_t)c.x[t->rs1];)                                       \
+    SEQ(rol, c.x[t->rd] = zbb_rol(c.x[t->rs1], c.x[t->rs2]);)                              \
+    SEQ(ror, c.x[t->rd] = zbb_ror(c.x[t->rs1], c.x[t->rs2]);)                              \
+    SEQ(rori, c.x[t->rd] = zbb_ror(c.x[t->rs1], t->imm);)                                  \
+    SEQ(orc_b, c.x[t->rd] = zbb_orc_b(c.x[t->rs1]);)                                       \
+    SEQ(rev8, c.x[t->rd] = zbb_rev8(c.x[t->rs1]);)                                         \
+    SEQ(sh1add, c.x[t->rd] = (c.x[t->rs1] << 1) + c.x[t->rs2];)                            \
+    SEQ(sh2add, c.x[t->rd] = (c.x[t->rs1] << 2) + c.x[t->rs2];)                            \
+    SEQ(sh3add, c.x[t->rd] = (c.x[t->rs1] << 3) + c.x[t->rs2];)
+
+// slots past the end of each tcache page, enough for a 4-byte instruction
+// in the last halfword slot to continue to one
+static constexpr uint32_t tcache_page_extra = 2;
+
+// op numbers, in the same order as the dispatch tables below
+enum threaded_op
+{
+    top_generic,
+#define THREADED_ENUM(name, ...) top_##name,
+    THREADED_OPS(THREADED_ENUM, THREADED_ENUM)
+#undef THREADED_ENUM
+};
+
+struct rv32i::threaded_engine
+{
+    // pick the threaded op for an instruction from its reference handler
+    static threaded_op op_of(const decoded_insn &d)
+    {
+        static const struct
+        {
+            void (rv32i::*handler)(const decoded_insn &d, std::ostream *pos);
+            threaded_op op;
+        } ops[] = {
+#define THREADED_HANDLER(name, ...) {&rv32i::exec_##name<trace_off>, top_##name},
+            THREADED_OPS(THREADED_HANDLER, THREADED_HANDLER)
+#undef THREADED_HANDLER
+        };
+
+        for (const auto &o : ops)
+            if (o.handler == d.handler)
+                return o.op;
+        return top_generic;
+    }
+
+    // prepare the operands of slot t from the (cached) decoding of the
+    // instruction at pc and return the op that executes it. An instruction
+    // that can't be decoded there (with the C extension, a 32-bit one in the
+    // last halfword of memory) gets the generic op, which reports it.
+    static threaded_op fill(threaded_context &c, threaded_insn *t)
+    {
+        decoded_insn single;
+        const decoded_insn *d = c.cpu->lookup_single(c.pc, single);
+        if (!d)
+            return top_generic;
+        t->imm = d->imm;
+        t->rd = d->rd ? d->rd : 32;
+        t->rs1 = d->rs1;
+        t->rs2 = d->rs2;
+        t->len = d->len;
+        return op_of(*d);
+    }
+
+    // Return the slot for the instruction at addr, allocating its page with
+    // every slot set to fill (or to refetch past the end of memory and in the
+    // extra slots at the end of the page). There is a slot per word, or with
+    // the C extension (compressed true) per halfword. Returns nullptr for a pc
+    // that cannot be cached.
+    template <bool compressed>
+    static threaded_insn *slot(threaded_context &c, uint32_t addr, const threaded_insn &fill, const threaded_insn &refetch)
+    {
+        rv32i &cpu = *c.cpu;
+        constexpr uint32_t shift = compressed ? 1 : 2;
+
+        if ((addr & ((1 << shift) - 1)) || addr >= c.mem->get_size())
+            return nullptr;
+
+        uint32_t idx = addr >> shift;
+        uint32_t page = idx / icache_page_insns;
+
+        if (!cpu.tcache[page])
+        {
+            cpu.tcache[page].reset(new threaded_insn[icache_page_insns + tcache_page_extra]);
+            for (uint32_t i = 0; i < icache_page_insns + tcache_page_extra; i++)
+            {
+                uint32_t a = (page * icache_page_insns + i) << shift;
+                cpu.tcache[page][i] = (i < icache_page_insns && a < c.mem->get_size()) ? fill : refetch;
+            }
+        }
+        return &cpu.tcache[page][idx % icache_page_insns];
+    }
+
+    // Bytes the instruction in slot t takes, and so the slots the next one is
+    // past it. Without the C extension it is always 4, and one slot.
+    template <bool compressed>
+    static uint32_t length(const threaded_insn *t)
+    {
+        return compressed ? t->len : 4;
+    }
+    template <bool compressed>
+    static uint32_t slots(uint32_t len)
+    {
+        return compressed ? len / 2 : 1;
+    }
+
+    // Run one instruction through the reference handler, with the hart state
+    // written back to the rv32i before and reloaded after
+    static void generic(threaded_context &c)
+    {
+        rv32i &cpu = *c.cpu;
+
+        cpu.pc = c.pc;
+        cpu.insn_counter = c.count + 1;
+        for (uint32_t i = 1; i < 32; i++)
+            cpu.regs.set(i, c.x[i]);
+
+        decoded_insn single;
+        const decoded_insn *d = cpu.lookup_single(c.pc, single);
+        if (d)
+            (cpu.*d->handler)(*d, nullptr);
+        else
+            cpu.dcex(c.mem->get32(c.pc), nullptr);
+
+        c.pc = cpu.pc;
+        c.count = cpu.insn_counter;
+        for (uint32_t i = 1; i < 32; i++)
+            c.x[i] = cpu.regs.get(i);
+    }
+
+#if defined(__GNUC__) && !defined(RV32I_NO_COMPUTED_GOTO)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+    template <bool compressed>
+    static void run(threaded_context &c)
+    {
+        static const void *const labels[] = {
+            &&op_generic,
+#define THREADED_LABEL(name, ...) &&op_##name,
+            THREADED_OPS(THREADED_LABEL, THREADED_LABEL)
+#undef THREADED_LABEL
+        };
+
+        threaded_insn fill_slot, refetch_slot;
+        fill_slot.label = &&op_fill;
+        refetch_slot.label = &&op_refetch;
+        c.cpu->tcache_unfilled = fill_slot;
+
+        threaded_insn *t;
+
+    op_refetch:
+        t = slot<compressed>(c, c.pc, fill_slot, refetch_slot);
+        if (!t)
+            goto op_generic;
+        goto *t->label;
+
+    op_fill:
+        t->label = labels[fill(c, t)];
+        goto *t->label;
+
+    op_generic:
+        generic(c);
+        if (c.cpu->halt || c.cpu->paging || c.count >= c.stop)
+            return;
+        goto op_refetch;
+
+#define THREADED_SEQ(name, ...)                \
+    op_##name:                                 \
+    {                                          \
+        uint32_t len = length<compressed>(t);  \
+        __VA_ARGS__                            \
+        c.pc += len;                           \
+        if (++c.count >= c.stop)               \
+            return;                            \
+        t += slots<compressed>(len);           \
+    }                                          \
+    goto *t->label;
+#define THREADED_JMP(name, ...)                \
+    op_##name:                                 \
+    {                                          \
+        uint32_t len = length<compressed>(t);  \
+        __VA_ARGS__                            \
+    }                                          \
+    if (++c.count >= c.stop)                   \
+        return;                                \
+    goto op_refetch;
+
+        THREADED_OPS(THREADED_SEQ, THREADED_JMP)
+#undef THREADED_SEQ
+#undef THREADED_JMP
+    }
+
+#pragma GCC diagnostic pop
+#else
+    template <bool compressed>
+    static const threaded_insn *op_refetch(threaded_context &c, const threaded_insn *)
+    {
+        static threaded_insn generic_slot = make_slot(op_generic<compressed>);
+        threaded_insn *t = slot<compressed>(c, c.pc, fill_slot<compressed>(), refetch_slot<compressed>());
+        return t ? t : &generic_slot;
+    }
+
+    template <bool compressed>
+    static const threaded_insn *op_fill(threaded_context &c, const threaded_insn *ct)
+    {
+        static const threaded_insn *(*const fns[])(threaded_context &, const threaded_insn *) = {
+            op_generic<compressed>,
+#define THREADED_FN(name, ...) op_##name<compressed>,
+            THREADED_OPS(THREADED_FN, THREADED_FN)
+#undef THREADED_FN
+        };
+
+        threaded_insn *t = const_cast<threaded_insn *>(ct);
+        t->fn = fns[fill(c, t)];
+        return t;
+    }
+
+    template <bool compressed>
+    static const threaded_insn *op_generic(threaded_context &c, const threaded_insn *)
+    {
+        generic(c);
+        if (c.cpu->halt || c.cpu->paging || c.count >= c.stop)
+            return nullptr;
+        return op_refetch<compressed>(c, nullptr);
+    }
+
+#define THREADED_SEQ(name, ...)                                                        \
+    template <bool compressed>                                                         \
+    static const threaded_insn *op_##name(threaded_context &c, const threaded_insn *t) \
+    {                                                                                  \
+        uint32_t len = length<compressed>(t);                                          \
+        __VA_ARGS__                                                                    \
+        c.pc += len;                                                                   \
+        return ++c.count >= c.stop ? nullptr : t + slots<compressed>(len);             \
+    }
+#define THREADED_JMP(name, ...)                                                        \
+    template <bool compressed>                                                         \
+    static const threaded_insn *op_##name(threaded_context &c, const threaded_insn *t) \
+    {                                                                                  \
+        uint32_t len = length<compressed>(t);                                          \
+        __VA_ARGS__                                                                    \
+        return ++c.count >= c.stop ? nullptr : op_refetch<compressed>(c, t);           \
+    }
+
+    THREADED_OPS(THREADED_SEQ, THREADED_JMP)
+#undef THREADED_SEQ
+#undef THREADED_JMP
+
+    static threaded_insn make_slot(const threaded_insn *(*fn)(threaded_context &, const threaded_insn *))
+    {
+        threaded_insn t;
+        t.fn = fn;
+        return t;
+    }
+    template <bool compressed>
+    static const threaded_insn &fill_slot()
+    {
+        static const threaded_insn t = make_slot(op_fill<compressed>);
+        return t;
+    }
+    template <bool compressed>
+    static const threaded_insn &refetch_slot()
+    {
+        static const threaded_insn t = make_slot(op_refetch<compressed>);
+        return t;
+    }
+
+    // each op returns the next instruction to run, or nullptr to stop
+    template <bool compressed>
+    static void run(threaded_context &c)
+    {
+        c.cpu->tcache_unfilled = fill_slot<compressed>();
+
+        const threaded_insn *t = op_refetch<compressed>(c, nullptr);
+        while (t)
+            t = t->fn(c, t);
+    }
+#endif
+};
+
+// run with the threaded engine until halted or limit instructions executed
+void rv32i::run_threaded(uint64_t limit)
+{
+    if (is_halted() || (limit && this->insn_counter >= limit))
+        return;
+
+    threaded_context c;
+    c.cpu = this;
+    c.mem = this->mem;
+    c.pc = this->pc;
+    c.count = this->insn_counter;
+    c.stop = limit ? limit : UINT64_MAX;
+    for (uint32_t i = 0; i < 32; i++)
+        c.x[i] = this->regs.get(i);
+    c.x[32] = 0;
+
+    // a slot per halfword with the C extension
+    size_t pages = this->icache.size() * (this->compressed ? 2 : 1);
+    if (this->tcache.size() != pages)
+        this->tcache.resize(pages);
+
+    if (this->compressed)
+        threaded_engine::run<true>(c);
+    else
+        threaded_engine::run<false>(c);
+
+    this->pc = c.pc;
+    this->insn_counter = c.count;
+    for (uint32_t i = 1; i < 32; i++)
+        this->regs.set(i, c.x[i]);
+}
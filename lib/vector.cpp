@@ -0,0 +1,1069 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#if defined(__SSE2__) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+#include <immintrin.h>
+#endif
+
+#include "include/hex.h"
+#include "include/rv32i.h"
+
+/*****************************************
+ * RVV vector instructions
+ *
+ * A subset of the V extension's integer instructions, for ELEN = 32 and a
+ * VLEN set with -v (128 bits by default):
+ *
+ *     vsetvli, vsetivli, vsetvl
+ *     vle8/16/32.v, vse8/16/32.v            unit-stride loads and stores
+ *     vlse8/16/32.v, vsse8/16/32.v          strided loads and stores
+ *     vadd vsub vrsub vand vor vxor         .vv, .vx and (but vsub) .vi
+ *     vmin vminu vmax vmaxu                 .vv and .vx
+ *     vsll vsrl vsra                        .vv, .vx and .vi
+ *     vmul vmulh vmulhu vmulhsu             .vv and .vx
+ *     vredsum vredand vredor vredxor
+ *     vredmin vredminu vredmax vredmaxu     .vs
+ *     vmv.v.v/x/i, vmerge.vvm/vxm/vim, vmv.x.s, vmv.s.x
+ *
+ * Any of them may be masked by v0. Elements past vl (the tail) and masked-off
+ * elements are left as they were, which both the agnostic and undisturbed
+ * policies allow. vstart is always 0. A vector instruction run with vtype.vill
+ * set, or with a register group that is misaligned or runs past v31, halts
+ * like an illegal instruction.
+ *
+ * The element loops work on a whole register group at a time. Where the
+ * host has them they run 16 bytes at a time with SSE2, or 32 with AVX2 when
+ * the CPU running the simulator supports it (the simulator itself is built
+ * for plain x86-64, so those kernels are compiled for AVX2 separately and
+ * picked at run time). What is left over, and the operations the host has no
+ * instruction for at that element width, go one element at a time.
+ * **************************************/
+
+// the operations of the arithmetic instructions, which predecode() keeps in
+// the imm of their cache entries
+enum vector_op
+{
+    vop_add,
+    vop_sub,
+    vop_rsub,
+    vop_and,
+    vop_or,
+    vop_xor,
+    vop_minu,
+    vop_min,
+    vop_maxu,
+    vop_max,
+    vop_sll,
+    vop_srl,
+    vop_sra,
+    vop_mul,
+    vop_mulh,
+    vop_mulhu,
+    vop_mulhsu,
+    vop_mv,     // vmv.v.* and, masked, vmerge.v*m
+    vop_redsum, // the reductions, in the same order as the operations they fold with
+    vop_redand,
+    vop_redor,
+    vop_redxor,
+    vop_redminu,
+    vop_redmin,
+    vop_redmaxu,
+    vop_redmax,
+    vop_mv_x_s,
+    vop_mv_s_x,
+};
+
+// the element-wise operation reduction op folds elements with
+static vector_op reduction_op(vector_op op)
+{
+    static const vector_op ops[] = {vop_add, vop_and, vop_or, vop_xor, vop_minu, vop_min, vop_maxu, vop_max};
+    return ops[op - vop_redsum];
+}
+
+// funct3 of the OP-V operand forms, as bits of vector_arith_insn::forms
+static constexpr uint32_t opivv = 1 << 0b000;
+static constexpr uint32_t opmvv = 1 << 0b010;
+static constexpr uint32_t opivi = 1 << 0b011;
+static constexpr uint32_t opivx = 1 << 0b100;
+static constexpr uint32_t opmvx = 1 << 0b110;
+
+// the arithmetic instructions by funct6 and the operand forms they have
+struct vector_arith_insn
+{
+    uint32_t funct6;
+    uint32_t forms;
+    vector_op op;
+    const char *name;
+};
+
+static const vector_arith_insn vector_arith_insns[] = {
+    {0b000000, opivv | opivx | opivi, vop_add, "vadd"},
+    {0b000010, opivv | opivx, vop_sub, "vsub"},
+    {0b000011, opivx | opivi, vop_rsub, "vrsub"},
+    {0b000100, opivv | opivx, vop_minu, "vminu"},
+    {0b000101, opivv | opivx, vop_min, "vmin"},
+    {0b000110, opivv | opivx, vop_maxu, "vmaxu"},
+    {0b000111, opivv | opivx, vop_max, "vmax"},
+    {0b001001, opivv | opivx | opivi, vop_and, "vand"},
+    {0b001010, opivv | opivx | opivi, vop_or, "vor"},
+    {0b001011, opivv | opivx | opivi, vop_xor, "vxor"},
+    {0b010111, opivv | opivx | opivi, vop_mv, "vmerge"},
+    {0b100101, opivv | opivx | opivi, vop_sll, "vsll"},
+    {0b101000, opivv | opivx | opivi, vop_srl, "vsrl"},
+    {0b101001, opivv | opivx | opivi, vop_sra, "vsra"},
+    {0b100101, opmvv | opmvx, vop_mul, "vmul"},
+    {0b100111, opmvv | opmvx, vop_mulh, "vmulh"},
+    {0b100100, opmvv | opmvx, vop_mulhu, "vmulhu"},
+    {0b100110, opmvv | opmvx, vop_mulhsu, "vmulhsu"},
+    {0b000000, opmvv, vop_redsum, "vredsum"},
+    {0b000001, opmvv, vop_redand, "vredand"},
+    {0b000010, opmvv, vop_redor, "vredor"},
+    {0b000011, opmvv, vop_redxor, "vredxor"},
+    {0b000100, opmvv, vop_redminu, "vredminu"},
+    {0b000101, opmvv, vop_redmin, "vredmin"},
+    {0b000110, opmvv, vop_redmaxu, "vredmaxu"},
+    {0b000111, opmvv, vop_redmax, "vredmax"},
+    {0b010000, opmvv | opmvx, vop_mv_x_s, "vmv"},
+};
+
+// whether the instruction is unmasked (vm set)
+static bool unmasked(uint32_t insn)
+{
+    return (insn >> 25) & 1;
+}
+
+// Find the operation of the OP-V arithmetic instruction insn, and its
+// mnemonic. Returns false for an encoding outside the subset.
+static bool vector_arith(uint32_t insn, vector_op &op, std::string &mnemonic)
+{
+    uint32_t funct3 = rv32i::get_funct3(insn);
+    uint32_t funct6 = insn >> 26;
+    uint32_t vs1 = rv32i::get_rs1(insn);
+    uint32_t vs2 = rv32i::get_rs2(insn);
+
+    for (const vector_arith_insn &v : vector_arith_insns)
+    {
+        if (v.funct6 != funct6 || !(v.forms & (1 << funct3)))
+            continue;
+
+        static const char *const suffix[] = {".vv", "", ".vv", ".vi", ".vx", "", ".vx", ""};
+        op = v.op;
+        mnemonic = std::string(v.name) + suffix[funct3];
+
+        if (op == vop_mv && unmasked(insn))
+        {
+            // vmv.v.* has vs2 = v0
+            mnemonic = std::string("vmv.v.") + suffix[funct3][2];
+            return vs2 == 0;
+        }
+        if (op == vop_mv)
+            mnemonic += "m";
+        else if (op >= vop_redsum && op <= vop_redmax)
+            mnemonic = std::string(v.name) + ".vs";
+        else if (op == vop_mv_x_s)
+        {
+            // vmv.x.s rd,vs2 (vs1 = 0) and vmv.s.x vd,rs1 (vs2 = 0), unmasked
+            if (funct3 == 0b110)
+                op = vop_mv_s_x;
+            mnemonic = op == vop_mv_x_s ? "vmv.x.s" : "vmv.s.x";
+            return unmasked(insn) && (op == vop_mv_x_s ? vs1 : vs2) == 0;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Find the element width (eew) of the vector load or store insn and whether
+// it is strided. Returns false for an encoding outside the subset, such as
+// the scalar floating-point loads and stores that share the opcode.
+static bool vector_memory(uint32_t insn, uint32_t &eew, bool &strided)
+{
+    uint32_t mop = (insn >> 26) & 3;
+    uint32_t nf_mew = insn >> 28;
+
+    switch (rv32i::get_funct3(insn))
+    {
+    case 0b000:
+        eew = 8;
+        break;
+    case 0b101:
+        eew = 16;
+        break;
+    case 0b110:
+        eew = 32;
+        break;
+    default:
+        return false;
+    }
+
+    // no segments, indexed accesses or unit-stride variants (whole
+    // register, mask and fault-only-first)
+    strided = mop == 0b10;
+    return nf_mew == 0 && (strided || (mop == 0b00 && rv32i::get_rs2(insn) == 0));
+}
+
+/*****************************************
+ * Element access and the scalar element operations
+ * **************************************/
+
+// element i of the sew-bit elements at base, zero-extended
+static uint32_t get_elem(const uint8_t *base, uint32_t sew, uint32_t i)
+{
+    switch (sew)
+    {
+    case 8:
+        return base[i];
+    case 16:
+    {
+        uint16_t e;
+        memcpy(&e, base + 2 * i, 2);
+        return e;
+    }
+    default:
+    {
+        uint32_t e;
+        memcpy(&e, base + 4 * i, 4);
+        return e;
+    }
+    }
+}
+
+// set element i of the sew-bit elements at base to the low sew bits of val
+static void set_elem(uint8_t *base, uint32_t sew, uint32_t i, uint32_t val)
+{
+    switch (sew)
+    {
+    case 8:
+        base[i] = val;
+        break;
+    case 16:
+    {
+        uint16_t e = val;
+        memcpy(base + 2 * i, &e, 2);
+        break;
+    }
+    default:
+        memcpy(base + 4 * i, &val, 4);
+        break;
+    }
+}
+
+// whether element i is active under the mask in v0
+static bool mask_bit(const uint8_t *v0, uint32_t i)
+{
+    return (v0[i / 8] >> (i % 8)) & 1;
+}
+
+// the sew-bit value val, sign-extended
+static int32_t sext_elem(uint32_t val, uint32_t sew)
+{
+    return (int32_t)(val << (32 - sew)) >> (32 - sew);
+}
+
+// a op b on one sew-bit element of each: a from vs2, b from vs1 (or the
+// scalar). The result's bits above sew are don't-cares.
+static uint32_t scalar_op(vector_op op, uint32_t sew, uint32_t a, uint32_t b)
+{
+    uint32_t mask = sew == 32 ? 0xffffffff : (1u << sew) - 1;
+    a &= mask;
+    b &= mask;
+    int64_t sa = sext_elem(a, sew);
+    int64_t sb = sext_elem(b, sew);
+
+    switch (op)
+    {
+    case vop_add:
+        return a + b;
+    case vop_sub:
+        return a - b;
+    case vop_rsub:
+        return b - a;
+    case vop_and:
+        return a & b;
+    case vop_or:
+        return a | b;
+    case vop_xor:
+        return a ^ b;
+    case vop_minu:
+        return std::min(a, b);
+    case vop_min:
+        return std::min(sa, sb);
+    case vop_maxu:
+        return std::max(a, b);
+    case vop_max:
+        return std::max(sa, sb);
+    case vop_sll:
+        return a << (b & (sew - 1));
+    case vop_srl:
+        return a >> (b & (sew - 1));
+    case vop_sra:
+        return sa >> (b & (sew - 1));
+    case vop_mul:
+        return a * b;
+    case vop_mulh:
+        return (uint64_t)(sa * sb) >> sew;
+    case vop_mulhu:
+        return ((uint64_t)a * b) >> sew;
+    case vop_mulhsu:
+        return (uint64_t)(sa * (int64_t)b) >> sew;
+    default: // vop_mv
+        return b;
+    }
+}
+
+// the value that leaves the others unchanged when a reduction folds it in
+static uint32_t reduction_identity(vector_op op, uint32_t sew)
+{
+    switch (op)
+    {
+    case vop_and:
+    case vop_minu:
+        return 0xffffffff;
+    case vop_min:
+        return (1u << (sew - 1)) - 1;
+    case vop_max:
+        return 1u << (sew - 1);
+    default:
+        return 0;
+    }
+}
+
+/*****************************************
+ * Host SIMD kernels
+ *
+ * Each applies op to the elements of a and b (as 8, 16 or 32 bits wide) and
+ * stores the results at d, as many whole host vectors at a time as fit in
+ * bytes, and returns the number of bytes it did: 0 when the host has no
+ * instruction for op at that width.
+ * **************************************/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_AVX2 1
+
+// one AVX2 instruction, EXPR of x (from a) and y (from b), for each 32 bytes
+#define AVX2_LOOP(EXPR)                                                    \
+    for (; i + 32 <= bytes; i += 32)                                       \
+    {                                                                      \
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)); \
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)); \
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i), EXPR);     \
+    }
+
+#define AVX2_BY_SEW(OP8, OP16, OP32)    \
+    if (sew == 8)                       \
+        AVX2_LOOP(OP8(x, y))            \
+    else if (sew == 16)                 \
+        AVX2_LOOP(OP16(x, y))           \
+    else                                \
+        AVX2_LOOP(OP32(x, y))
+
+__attribute__((target("avx2"))) static uint32_t avx2_kernel(vector_op op, uint32_t sew, uint8_t *d, const uint8_t *a,
+                                                            const uint8_t *b, uint32_t bytes)
+{
+    uint32_t i = 0;
+    __m256i shift_mask = _mm256_set1_epi32(31);
+
+    switch (op)
+    {
+    case vop_add:
+        AVX2_BY_SEW(_mm256_add_epi8, _mm256_add_epi16, _mm256_add_epi32)
+        break;
+    case vop_sub:
+        AVX2_BY_SEW(_mm256_sub_epi8, _mm256_sub_epi16, _mm256_sub_epi32)
+        break;
+    case vop_and:
+        AVX2_LOOP(_mm256_and_si256(x, y))
+        break;
+    case vop_or:
+        AVX2_LOOP(_mm256_or_si256(x, y))
+        break;
+    case vop_xor:
+        AVX2_LOOP(_mm256_xor_si256(x, y))
+        break;
+    case vop_minu:
+        AVX2_BY_SEW(_mm256_min_epu8, _mm256_min_epu16, _mm256_min_epu32)
+        break;
+    case vop_min:
+        AVX2_BY_SEW(_mm256_min_epi8, _mm256_min_epi16, _mm256_min_epi32)
+        break;
+    case vop_maxu:
+        AVX2_BY_SEW(_mm256_max_epu8, _mm256_max_epu16, _mm256_max_epu32)
+        break;
+    case vop_max:
+        AVX2_BY_SEW(_mm256_max_epi8, _mm256_max_epi16, _mm256_max_epi32)
+        break;
+    case vop_mul:
+        if (sew == 16)
+            AVX2_LOOP(_mm256_mullo_epi16(x, y))
+        else if (sew == 32)
+            AVX2_LOOP(_mm256_mullo_epi32(x, y))
+        break;
+    case vop_mulh:
+        if (sew == 16)
+            AVX2_LOOP(_mm256_mulhi_epi16(x, y))
+        break;
+    case vop_mulhu:
+        if (sew == 16)
+            AVX2_LOOP(_mm256_mulhi_epu16(x, y))
+        break;
+    case vop_sll:
+        if (sew == 32)
+            AVX2_LOOP(_mm256_sllv_epi32(x, _mm256_and_si256(y, shift_mask)))
+        break;
+    case vop_srl:
+        if (sew == 32)
+            AVX2_LOOP(_mm256_srlv_epi32(x, _mm256_and_si256(y, shift_mask)))
+        break;
+    case vop_sra:
+        if (sew == 32)
+            AVX2_LOOP(_mm256_srav_epi32(x, _mm256_and_si256(y, shift_mask)))
+        break;
+    default:
+        break;
+    }
+    return i;
+}
+
+// whether the CPU running the simulator has AVX2
+static bool host_has_avx2()
+{
+    static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    return avx2;
+}
+#endif
+
+#if defined(__SSE2__)
+#define SSE2_LOOP(EXPR)                                                    \
+    for (; i + 16 <= bytes; i += 16)                                       \
+    {                                                                      \
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)); \
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)); \
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), EXPR);        \
+    }
+
+static uint32_t sse2_kernel(vector_op op, uint32_t sew, uint8_t *d, const uint8_t *a, const uint8_t *b, uint32_t bytes)
+{
+    uint32_t i = 0;
+
+    switch (op)
+    {
+    case vop_add:
+        if (sew == 8)
+            SSE2_LOOP(_mm_add_epi8(x, y))
+        else if (sew == 16)
+            SSE2_LOOP(_mm_add_epi16(x, y))
+        else
+            SSE2_LOOP(_mm_add_epi32(x, y))
+        break;
+    case vop_sub:
+        if (sew == 8)
+            SSE2_LOOP(_mm_sub_epi8(x, y))
+        else if (sew == 16)
+            SSE2_LOOP(_mm_sub_epi16(x, y))
+        else
+            SSE2_LOOP(_mm_sub_epi32(x, y))
+        break;
+    case vop_and:
+        SSE2_LOOP(_mm_and_si128(x, y))
+        break;
+    case vop_or:
+        SSE2_LOOP(_mm_or_si128(x, y))
+        break;
+    case vop_xor:
+        SSE2_LOOP(_mm_xor_si128(x, y))
+        break;
+    case vop_minu:
+        if (sew == 8)
+            SSE2_LOOP(_mm_min_epu8(x, y))
+        break;
+    case vop_min:
+        if (sew == 16)
+            SSE2_LOOP(_mm_min_epi16(x, y))
+        break;
+    case vop_maxu:
+        if (sew == 8)
+            SSE2_LOOP(_mm_max_epu8(x, y))
+        break;
+    case vop_max:
+        if (sew == 16)
+            SSE2_LOOP(_mm_max_epi16(x, y))
+        break;
+    case vop_mul:
+        if (sew == 16)
+            SSE2_LOOP(_mm_mullo_epi16(x, y))
+        break;
+    case vop_mulh:
+        if (sew == 16)
+            SSE2_LOOP(_mm_mulhi_epi16(x, y))
+        break;
+    case vop_mulhu:
+        if (sew == 16)
+            SSE2_LOOP(_mm_mulhi_epu16(x, y))
+        break;
+    default:
+        break;
+    }
+    return i;
+}
+#endif
+
+// d[i] = a[i] op b[i] for the n sew-bit elements of each. d may be a or b,
+// but must not overlap either otherwise.
+static void vector_kernel(vector_op op, uint32_t sew, uint8_t *d, const uint8_t *a, const uint8_t *b, uint32_t n)
+{
+    if (op == vop_rsub)
+    {
+        op = vop_sub;
+        std::swap(a, b);
+    }
+    if (op == vop_mv)
+    {
+        memmove(d, b, n * sew / 8);
+        return;
+    }
+
+    uint32_t bytes = n * sew / 8;
+    uint32_t done = 0;
+#if defined(VECTOR_AVX2)
+    if (host_has_avx2())
+        done = avx2_kernel(op, sew, d, a, b, bytes);
+#endif
+#if defined(__SSE2__)
+    done += sse2_kernel(op, sew, d + done, a + done, b + done, bytes - done);
+#endif
+
+    for (uint32_t i = done / (sew / 8); i < n; i++)
+        set_elem(d, sew, i, scalar_op(op, sew, get_elem(a, sew, i), get_elem(b, sew, i)));
+}
+
+// Fold the n (at least 1) sew-bit elements at t together with op, which
+// must be associative and commutative, and return the result. t is
+// overwritten. The halves are folded into each other with vector_kernel(),
+// so each step runs at host vector width.
+static uint32_t vector_fold(vector_op op, uint32_t sew, uint8_t *t, uint32_t n)
+{
+    while (n > 1)
+    {
+        uint32_t half = n / 2;
+        uint32_t rest = n - half;
+        vector_kernel(op, sew, t, t, t + rest * sew / 8, half);
+        n = rest;
+    }
+    return get_elem(t, sew, 0);
+}
+
+// Fill the first n sew-bit elements at d with val
+static void splat(uint8_t *d, uint32_t sew, uint32_t n, uint32_t val)
+{
+    uint32_t size = sew / 8;
+    if (n == 0)
+        return;
+    set_elem(d, sew, 0, val);
+    for (uint32_t done = 1; done < n; done *= 2)
+        memcpy(d + done * size, d, std::min(done, n - done) * size);
+}
+
+/*****************************************
+ * vtype and register groups
+ * **************************************/
+
+// SEW in bits
+static uint32_t vtype_sew(uint32_t vtype)
+{
+    return 8 << ((vtype >> 3) & 7);
+}
+
+// LMUL in eighths: 1 (mf8) to 64 (m8), or 0 for the reserved encoding
+static uint32_t vtype_lmul8(uint32_t vtype)
+{
+    uint32_t vlmul = vtype & 7;
+    if (vlmul == 4)
+        return 0;
+    return vlmul < 4 ? 8 << vlmul : 8 >> (8 - vlmul);
+}
+
+// whether vtype is a setting this subset supports: SEW 8, 16 or 32, and a
+// fractional LMUL only where SEW <= LMUL * ELEN
+static bool vtype_valid(uint32_t vtype)
+{
+    uint32_t lmul8 = vtype_lmul8(vtype);
+    return (vtype >> 8) == 0 && ((vtype >> 3) & 7) <= 2 && lmul8 && vtype_sew(vtype) * 8 <= 32 * lmul8;
+}
+
+// Check that register group v of EMUL emul8/8 registers is aligned and ends
+// at v31 at the latest. Returns the number of registers in it, or 0 if not.
+static uint32_t vector_group(uint32_t v, uint32_t emul8)
+{
+    if (emul8 == 0 || emul8 > 64)
+        return 0;
+    uint32_t regs = emul8 < 8 ? 1 : emul8 / 8;
+    return (v % regs == 0 && v + regs <= 32) ? regs : 0;
+}
+
+// set VLEN, and start over with vector state of that size
+void rv32i::set_vlen(uint32_t bits)
+{
+    this->vregs.set_vlen(bits);
+    this->vl = 0;
+    this->vtype = vtype_vill;
+}
+
+// reset the vector state: vtype.vill set, vl 0 and every register 0
+void rv32i::reset_vector()
+{
+    this->vregs.reset();
+    this->vl = 0;
+    this->vtype = vtype_vill;
+}
+
+// The active elements of v (or the scalar result) for a trace: the first
+// vl sew-bit elements, element 0 first
+static std::string render_elems(const uint8_t *v, uint32_t sew, uint32_t vl)
+{
+    std::ostringstream os;
+    os << std::hex << std::setfill('0');
+    for (uint32_t i = 0; i < vl; i++)
+        os << (i ? " " : "") << std::setw(sew / 4) << get_elem(v, sew, i);
+    return os.str();
+}
+
+/*****************************************
+ * Vector instructions
+ * **************************************/
+
+// vsetvli, vsetivli and vsetvl: set vtype, and vl from the application
+// vector length (AVL) in rs1 (or the immediate of vsetivli), and write vl to
+// rd. A vtype outside the subset sets vill, and vl to 0.
+template <class trace>
+void rv32i::exec_vsetvl(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t insn = d.insn;
+    bool ivli = (insn >> 30) == 0b11;
+    uint32_t vtype = (insn >> 31) == 0 ? (insn >> 20) & 0x7ff : ivli ? (insn >> 20) & 0x3ff : (uint32_t)this->regs.get(d.rs2);
+
+    if (!vtype_valid(vtype))
+    {
+        this->vtype = vtype_vill;
+        this->vl = 0;
+    }
+    else
+    {
+        uint32_t vlmax = this->vregs.get_vlenb() * 8 / vtype_sew(vtype) * vtype_lmul8(vtype) / 8;
+        uint32_t avl;
+        if (ivli)
+            avl = d.rs1;
+        else if (d.rs1 != 0)
+            avl = this->regs.get(d.rs1);
+        else if (d.rd != 0)
+            avl = 0xffffffff;
+        else
+            avl = this->vl; // keep vl, as far as the new VLMAX allows
+        this->vtype = vtype;
+        this->vl = std::min(avl, vlmax);
+    }
+    this->regs.set(d.rd, this->vl);
+
+    if (trace::enabled && pos)
+    {
+        std::string s = render_vector(insn);
+        // a vsetvli with its vtype spelt out can be wider than the column
+        s.resize(std::max<size_t>(s.size(), instruction_width), ' ');
+        // 00000000: 0d0572d7 vsetvli x5,x10,e32,m1,ta,ma // vl = 4, vtype = 0x000000d0
+        *pos << s << "          // "
+             << "vl = " << std::dec << this->vl << ", vtype = " << hex0x32(this->vtype);
+        *pos << std::endl;
+    }
+
+    this->pc = this->pc + d.len;
+}
+
+// Check the vector state and register groups for an instruction on sew-bit
+// elements, whose destination group vd (of EMUL dest8/8 registers) is not
+// to overlap v0 if it is masked. Halts, returning false, if any is illegal.
+bool rv32i::vector_check(uint32_t insn, uint32_t vd, uint32_t dest8) const
+{
+    return !(this->vtype & vtype_vill) && vector_group(vd, dest8) && (unmasked(insn) || vd != 0);
+}
+
+// vle8/16/32.v and vlse8/16/32.v
+// Tell the cache model about the elements a vector load or store is about to
+// access, at the addresses the program uses for them
+void rv32i::model_vector_access(uint32_t insn)
+{
+    uint32_t eew;
+    bool strided;
+    if (!vector_memory(insn, eew, strided) || (this->vtype & vtype_vill))
+        return;
+
+    bool store = get_opcode(insn) == opcode_store_fp;
+    uint32_t size = eew / 8;
+    uint32_t base = this->regs.get(get_rs1(insn));
+    uint32_t stride = strided ? (uint32_t)this->regs.get(get_rs2(insn)) : size;
+    const uint8_t *v0 = this->vregs.reg(0);
+
+    if (unmasked(insn) && stride == size)
+    {
+        if (this->vl)
+            store ? this->caches->store(base, this->vl * size) : this->caches->load(base, this->vl * size);
+        return;
+    }
+    for (uint32_t i = 0; i < this->vl; i++)
+    {
+        if (unmasked(insn) || mask_bit(v0, i))
+            store ? this->caches->store(base + i * stride, size) : this->caches->load(base + i * stride, size);
+    }
+}
+
+template <class trace>
+void rv32i::exec_vload(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t eew;
+    bool strided;
+    vector_memory(d.insn, eew, strided);
+    uint32_t emul8 = vtype_lmul8(this->vtype) * eew / vtype_sew(this->vtype);
+    if (!vector_check(d.insn, d.rd, emul8))
+    {
+        this->halt = true;
+        return;
+    }
+
+    uint32_t size = eew / 8;
+    uint32_t base = this->regs.get(d.rs1);
+    uint32_t stride = strided ? (uint32_t)this->regs.get(d.rs2) : size;
+    uint8_t *vd = this->vregs.reg(d.rd);
+    const uint8_t *v0 = this->vregs.reg(0);
+
+    if (unmasked(d.insn) && stride == size && !this->paging && (uint64_t)base + this->vl * size <= this->mem->get_size())
+    {
+        // contiguous and all in memory: one copy
+        this->mem->read(base, vd, this->vl * size);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < this->vl; i++)
+        {
+            if (!unmasked(d.insn) && !mask_bit(v0, i))
+                continue;
+            uint32_t addr = base + i * stride;
+            if (this->paging && !translate(addr, access_load))
+                return;
+            set_elem(vd, eew, i, eew == 8 ? this->mem->get8(addr) : eew == 16 ? this->mem->get16(addr) : this->mem->get32(addr));
+        }
+    }
+
+    if (trace::enabled && pos)
+    {
+        std::string s = render_vector(d.insn);
+        s.resize(std::max<size_t>(s.size(), instruction_width), ' ');
+        // 00000008: 02056407 vle32.v v8,(x10) // v8 = 00000001 00000002 00000003 00000004
+        *pos << s << "          // "
+             << "v" << (uint32_t)d.rd << " = " << render_elems(vd, eew, this->vl);
+        *pos << std::endl;
+    }
+
+    this->pc = this->pc + d.len;
+}
+
+// vse8/16/32.v and vsse8/16/32.v
+template <class trace>
+void rv32i::exec_vstore(const decoded_insn &d, std::ostream *pos)
+{
+    uint32_t eew;
+    bool strided;
+    vector_memory(d.insn, eew, strided);
+    uint32_t emul8 = vtype_lmul8(this->vtype) * eew / vtype_sew(this->vtype);
+    // the register stored is in the rd field; it may overlap v0 when masked
+    if ((this->vtype & vtype_vill) || !vector_group(d.rd, emul8))
+    {
+        this->halt = true;
+        return;
+    }
+
+    uint32_t size = eew / 8;
+    uint32_t base = this->regs.get(d.rs1);
+    uint32_t stride = strided ? (uint32_t)this->regs.get(d.rs2) : size;
+    const uint8_t *vs3 = this->vregs.reg(d.rd);
+    const uint8_t *v0 = this->vregs.reg(0);
+
+    if (unmasked(d.insn) && stride == size && !this->paging && (uint64_t)base + this->vl * size <= this->mem->get_size())
+    {
+        this->mem->write(base, vs3, this->vl * size);
+        if (this->vl)
+            invalidate(base, this->vl * size);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < this->vl; i++)
+        {
+            if (!unmasked(d.insn) && !mask_bit(v0, i))
+                continue;
+            uint32_t addr = base + i * stride;
+            if (this->paging && !translate(addr, access_store))
+                return;
+            uint32_t e = get_elem(vs3, eew, i);
+            if (eew == 8)
+                this->mem->set8(addr, e);
+            else if (eew == 16)
+                this->mem->set16(addr, e);
+            else
+                this->mem->set32(addr, e);
+            invalidate(addr, size);
+        }
+    }
+
+    if (trace::enabled && pos)
+    {
+        std::string s = render_vector(d.insn);
+        s.resize(std::max<size_t>(s.size(), instruction_width), ' ');
+        // 00000010: 02056427 vse32.v v8,(x10) // m32(0x00000100 + 4 * i) = 00000001 00000002
+        *pos << s << "          // "
+             << "m" << eew << "(" << hex0x32(base) << " + " << std::dec << stride << " * i) = " << render_elems(vs3, eew, this->vl);
+        *pos << std::endl;
+    }
+
+    this->pc = this->pc + d.len;
+}
+
+// The OP-V arithmetic instructions; predecode() has put the operation in imm
+template <class trace>
+void rv32i::exec_vop(const decoded_insn &d, std::ostream *pos)
+{
+    vector_op op = (vector_op)d.imm;
+    uint32_t funct3 = get_funct3(d.insn);
+    uint32_t sew = vtype_sew(this->vtype);
+    uint32_t lmul8 = vtype_lmul8(this->vtype);
+    bool scalar_dest = op >= vop_redsum; // only element 0 of vd (or x[rd]) is written
+    bool masked = !unmasked(d.insn);
+
+    // the reductions and moves take vs1 and vd as single registers
+    bool ok = scalar_dest ? !(this->vtype & vtype_vill) : vector_check(d.insn, d.rd, lmul8);
+    if (op == vop_mv && masked)
+        ok = ok && vector_group(d.rs2, lmul8);
+    else if (op != vop_mv && op != vop_mv_s_x)
+        ok = ok && vector_group(d.rs2, op == vop_mv_x_s ? 8 : lmul8);
+    if ((funct3 == 0b000 || funct3 == 0b010) && op != vop_mv_x_s)
+        ok = ok && vector_group(d.rs1, scalar_dest ? 8 : lmul8);
+    if (!ok)
+    {
+        this->halt = true;
+        return;
+    }
+
+    uint8_t *vd = this->vregs.reg(d.rd);
+    const uint8_t *vs2 = this->vregs.reg(d.rs2);
+    const uint8_t *v0 = this->vregs.reg(0);
+    uint32_t vl = this->vl;
+
+    // the other operand: vs1, or the scalar (x[rs1] or the 5-bit immediate,
+    // unsigned for the shifts) repeated into every element
+    const uint8_t *b = this->vregs.reg(d.rs1);
+    uint32_t scalar = 0;
+    if (funct3 == 0b100 || funct3 == 0b110)
+        scalar = this->regs.get(d.rs1);
+    else if (funct3 == 0b011)
+        scalar = (op == vop_sll || op == vop_srl || op == vop_sra) ? d.rs1 : (uint32_t)sext_elem(d.rs1, 5);
+    if (funct3 & 0b100 || funct3 == 0b011)
+    {
+        if (!scalar_dest)
+            splat(this->vregs.scratch(0), sew, vl, scalar);
+        b = this->vregs.scratch(0);
+    }
+
+    if (op == vop_mv_x_s)
+        this->regs.set(d.rd, sext_elem(get_elem(vs2, sew, 0), sew));
+    else if (op == vop_mv_s_x)
+    {
+        if (vl)
+            set_elem(vd, sew, 0, scalar);
+    }
+    else if (scalar_dest)
+    {
+        // fold the active elements of vs2 into element 0 of vs1
+        if (vl)
+        {
+            vector_op fold = reduction_op(op);
+            uint8_t *t = this->vregs.scratch(1);
+            memcpy(t, vs2, vl * sew / 8);
+            if (masked)
+                for (uint32_t i = 0; i < vl; i++)
+                    if (!mask_bit(v0, i))
+                        set_elem(t, sew, i, reduction_identity(fold, sew));
+            uint32_t res = vector_fold(fold, sew, t, vl);
+            set_elem(vd, sew, 0, scalar_op(fold, sew, get_elem(b, sew, 0), res));
+        }
+    }
+    else if (!masked)
+        vector_kernel(op, sew, vd, vs2, b, vl);
+    else if (op == vop_mv)
+    {
+        // vmerge: b where v0 is set, otherwise vs2
+        for (uint32_t i = 0; i < vl; i++)
+            set_elem(vd, sew, i, get_elem(mask_bit(v0, i) ? b : vs2, sew, i));
+    }
+    else
+    {
+        // compute every element aside, then write the active ones
+        uint8_t *t = this->vregs.scratch(1);
+        vector_kernel(op, sew, t, vs2, b, vl);
+        for (uint32_t i = 0; i < vl; i++)
+            if (mask_bit(v0, i))
+                set_elem(vd, sew, i, get_elem(t, sew, i));
+    }
+
+    if (trace::enabled && pos)
+    {
+        std::string s = render_vector(d.insn);
+        s.resize(std::max<size_t>(s.size(), instruction_width), ' ');
+        // 00000018: 02860257 vadd.vv v4,v8,v12 // v4 = 00000006 00000008 0000000a 0000000c
+        *pos << s << "          // ";
+        if (op == vop_mv_x_s)
+            *pos << "x" << (uint32_t)d.rd << " = " << hex0x32(this->regs.get(d.rd));
+        else
+            *pos << "v" << (uint32_t)d.rd << " = " << render_elems(vd, sew, scalar_dest ? std::min(vl, 1u) : vl);
+        *pos << std::endl;
+    }
+
+    this->pc = this->pc + d.len;
+}
+
+// Choose the handler for an instruction with one of the vector opcodes, and
+// for an arithmetic one put its operation in imm. Returns false if it is
+// outside the subset.
+template <class trace>
+bool rv32i::predecode_vector(uint32_t insn, decoded_insn &d)
+{
+    uint32_t eew;
+    bool strided;
+    vector_op op;
+    std::string mnemonic;
+
+    switch (get_opcode(insn))
+    {
+    case opcode_load_fp:
+        d.handler = &rv32i::exec_vload<trace>;
+        return vector_memory(insn, eew, strided);
+    case opcode_store_fp:
+        d.handler = &rv32i::exec_vstore<trace>;
+        return vector_memory(insn, eew, strided);
+    default: // opcode_vector
+        if (get_funct3(insn) == 0b111)
+        {
+            d.handler = &rv32i::exec_vsetvl<trace>;
+            return true;
+        }
+        if (!vector_arith(insn, op, mnemonic))
+            return false;
+        d.handler = &rv32i::exec_vop<trace>;
+        d.imm = op;
+        return true;
+    }
+}
+
+// the vtype immediate of vsetvli and vsetivli, as "e32,m1,ta,ma"
+static std::string render_vtype(uint32_t vtype)
+{
+    static const char *const lmul[] = {"m1", "m2", "m4", "m8", "m?", "mf8", "mf4", "mf2"};
+    std::ostringstream os;
+    if (!vtype_valid(vtype))
+        return hex0x32(vtype);
+    os << "e" << vtype_sew(vtype) << "," << lmul[vtype & 7] << "," << ((vtype & 0x40) ? "ta" : "tu") << ","
+       << ((vtype & 0x80) ? "ma" : "mu");
+    return os.str();
+}
+
+// render an instruction with one of the vector opcodes, or as an illegal one
+// if it is outside the subset
+std::string rv32i::render_vector(uint32_t insn) const
+{
+    uint32_t vd = get_rd(insn);
+    uint32_t rs1 = get_rs1(insn);
+    uint32_t vs2 = get_rs2(insn);
+    std::string mask = unmasked(insn) ? "" : ",v0.t";
+    std::string mnemonic;
+    std::ostringstream ops;
+    uint32_t eew;
+    bool strided;
+    vector_op op;
+
+    switch (get_opcode(insn))
+    {
+    case opcode_load_fp:
+    case opcode_store_fp:
+        if (!vector_memory(insn, eew, strided))
+            return render_illegal_insn(insn);
+        mnemonic = std::string(get_opcode(insn) == opcode_load_fp ? "vl" : "vs") + (strided ? "se" : "e") + std::to_string(eew) + ".v";
+        ops << "v" << vd << ",(x" << rs1 << ")";
+        if (strided)
+            ops << ",x" << vs2;
+        ops << mask;
+        break;
+
+    default: // opcode_vector
+        if (get_funct3(insn) == 0b111)
+        {
+            if ((insn >> 31) == 0)
+            {
+                mnemonic = "vsetvli";
+                ops << "x" << vd << ",x" << rs1 << "," << render_vtype((insn >> 20) & 0x7ff);
+            }
+            else if ((insn >> 30) == 0b11)
+            {
+                mnemonic = "vsetivli";
+                ops << "x" << vd << "," << rs1 << "," << render_vtype((insn >> 20) & 0x3ff);
+            }
+            else
+            {
+                mnemonic = "vsetvl";
+                ops << "x" << vd << ",x" << rs1 << ",x" << vs2;
+            }
+            break;
+        }
+        if (!vector_arith(insn, op, mnemonic))
+            return render_illegal_insn(insn);
+
+        if (op == vop_mv_x_s)
+            ops << "x" << vd << ",v" << vs2;
+        else if (op == vop_mv_s_x)
+            ops << "v" << vd << ",x" << rs1;
+        else
+        {
+            ops << "v" << vd << ",";
+            if (op != vop_mv || !unmasked(insn))
+                ops << "v" << vs2 << ",";
+            switch (get_funct3(insn))
+            {
+            case 0b000:
+            case 0b010:
+                ops << "v" << rs1;
+                break;
+            case 0b011:
+                ops << ((op == vop_sll || op == vop_srl || op == vop_sra) ? (int32_t)rs1 : sext_elem(rs1, 5));
+                break;
+            default:
+                ops << "x" << rs1;
+                break;
+            }
+            ops << (op == vop_mv ? (unmasked(insn) ? "" : ",v0") : mask);
+        }
+        break;
+    }
+
+    std::ostringstream os;
+    os << hex32(insn) << " "; // the instruction hex value
+    std::string m = " " + mnemonic;
+    m.resize(std::max<size_t>(m.size(), 8), ' ');
+    os << m << " " << ops.str();
+    return os.str();
+}
+
+template bool rv32i::predecode_vector<trace_off>(uint32_t insn, decoded_insn &d);
+template bool rv32i::predecode_vector<trace_on>(uint32_t insn, decoded_insn &d);
+template void rv32i::exec_vsetvl<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_vsetvl<trace_on>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_vload<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_vload<trace_on>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_vstore<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_vstore<trace_on>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_vop<trace_off>(const decoded_insn &d, std::ostream *pos);
+template void rv32i::exec_vop<trace_on>(const decoded_insn &d, std::ostream *pos);
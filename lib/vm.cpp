@@ -0,0 +1,95 @@
+#include <iostream>
+
+#include "include/hex.h"
+#include "include/rv32i.h"
+
+/*****************************************
+ * Sv32 virtual memory
+ *
+ * Writing satp with MODE set turns on translation of every instruction
+ * fetch, load and store through the two-level page table at satp.PPN:
+ *
+ *     31        22 21        12 11           0
+ *     |  VPN[1]   |  VPN[0]   |    offset    |
+ *
+ * VPN[1] indexes the root table and VPN[0] the table its PTE points to, or
+ * a root PTE with R or X set maps a 4 MiB superpage. The walker sets the A
+ * bit, and the D bit for a store, in the leaf PTE itself. The simulator has
+ * no privilege modes or traps, so the U, G, SUM and MXR rules do not apply
+ * and a page fault halts the hart.
+ *
+ * Translations are cached per 4 KiB page in a direct-mapped TLB, which
+ * rv32i::translate() looks up inline. A page is only cached as writable
+ * once its D bit is set, so the first store to a clean page walks again.
+ * sfence.vma and every write to satp flush it.
+ * **************************************/
+
+// PTE bits
+static constexpr uint32_t pte_v = 1 << 0;
+static constexpr uint32_t pte_r = 1 << 1;
+static constexpr uint32_t pte_w = 1 << 2;
+static constexpr uint32_t pte_x = 1 << 3;
+static constexpr uint32_t pte_a = 1 << 6;
+static constexpr uint32_t pte_d = 1 << 7;
+
+// empty every TLB entry
+void rv32i::flush_tlb()
+{
+    for (tlb_entry &e : this->tlb)
+        e = tlb_entry{0, 0, 0};
+}
+
+// walk the page table for addr, filling the TLB; see translate()
+bool rv32i::walk(uint32_t &addr, access_type a)
+{
+    uint32_t va = addr;
+    uint32_t vpn[2] = {(va >> page_shift) & 0x3ff, va >> 22};
+    uint64_t table = (uint64_t)(this->satp & 0x3fffff) << page_shift;
+
+    for (int level = 1; level >= 0; level--)
+    {
+        uint64_t pte_addr = table + vpn[level] * 4;
+        if (pte_addr + 4 > this->mem->get_size())
+            break;
+        uint32_t pte = this->mem->get32(pte_addr);
+        if (!(pte & pte_v) || (!(pte & pte_r) && (pte & pte_w)))
+            break;
+
+        if (!(pte & (pte_r | pte_x)))
+        {
+            // a pointer to the next level
+            table = (uint64_t)(pte >> 10) << page_shift;
+            continue;
+        }
+
+        // a leaf: it must allow the access, and a superpage must be aligned
+        uint32_t ppn = pte >> 10;
+        if (!((pte >> 1) & a) || (level == 1 && (ppn & 0x3ff)) || ppn >> 20)
+            break;
+        if (level == 1)
+            ppn |= vpn[0];
+
+        uint32_t bits = pte_a | (a == access_store ? pte_d : 0);
+        if ((pte & bits) != bits)
+        {
+            // A and D are in the low byte
+            pte |= bits;
+            this->mem->set8(pte_addr, pte & 0xff);
+        }
+
+        tlb_entry &e = this->tlb[(va >> page_shift) % tlb_entries];
+        e.vpn = va >> page_shift;
+        e.ppn = ppn;
+        e.perms = (pte >> 1) & (access_load | access_store | access_fetch);
+        if (!(pte & pte_d))
+            e.perms &= ~access_store;
+
+        addr = (ppn << page_shift) | (va & ((1 << page_shift) - 1));
+        return true;
+    }
+
+    static const char *kinds[] = {"", "load", "store", "", "instruction fetch"};
+    *this->out << "Page fault: " << kinds[a] << " at " << hex0x32(va) << std::endl;
+    this->halt = true;
+    return false;
+}
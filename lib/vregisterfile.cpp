@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include "include/vregisterfile.h"
+#include "include/hex.h"
+
+// VLEN = 128 until set_vlen() says otherwise
+vregisterfile::vregisterfile()
+{
+    set_vlen(128);
+}
+
+// Set VLEN; the registers are resized and zeroed
+void vregisterfile::set_vlen(uint32_t bits)
+{
+    this->vlenb = bits / 8;
+    this->registers.assign(32 * this->vlenb, 0);
+    this->scratch_area.assign(2 * 8 * this->vlenb, 0);
+}
+
+uint32_t vregisterfile::get_vlenb() const
+{
+    return this->vlenb;
+}
+
+// Set every register to zero
+void vregisterfile::reset()
+{
+    std::fill(this->registers.begin(), this->registers.end(), 0);
+}
+
+uint8_t *vregisterfile::reg(uint32_t v)
+{
+    return &this->registers[v * this->vlenb];
+}
+
+const uint8_t *vregisterfile::reg(uint32_t v) const
+{
+    return &this->registers[v * this->vlenb];
+}
+
+uint8_t *vregisterfile::scratch(int i)
+{
+    return &this->scratch_area[i * 8 * this->vlenb];
+}
+
+// Dump each register as its 32-bit elements, the last one first
+void vregisterfile::dump(std::ostream &os) const
+{
+    for (uint32_t v = 0; v < 32; v++)
+    {
+        os << std::setfill(' ') << std::right << std::setw(3) << ("v" + std::to_string(v));
+        for (uint32_t i = this->vlenb / 4; i-- > 0;)
+        {
+            uint32_t e;
+            memcpy(&e, reg(v) + 4 * i, 4);
+            os << " " << hex32(e);
+        }
+        os << "\n";
+    }
+}
@@ -1,109 +1,702 @@
 #include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
+#include "include/aot.h"
+#include "include/device.h"
 #include "include/hex.h"
+#include "include/loader.h"
+#include "include/lockstep.h"
 #include "include/memory.h"
 #include "include/rv32i.h"
 
+/**
+ * Print the usage message to os.
+ *********************************************************************/
+static void print_usage(std::ostream &os)
+{
+    os << "Usage: rv32i [-m hex-mem-size] infile" << std::endl;
+    os << "       rv32i -b manifest [-j threads]" << std::endl;
+    os << "    infile is an ELF executable, or a raw image loaded and run at address 0" << std::endl;
+    os << "    -m specify memory size, up to 100000000 for all 4 GiB (default = 0x10000)" << std::endl;
+    os << "    -C run compressed (RV32C) instructions as well (on for an ELF file built for them)" << std::endl;
+    os << "    -v VLEN, the bits in each vector register (default = 128)" << std::endl;
+    os << "    -e execution engine: ref (default), threaded, block, jit, jitdiff or aot" << std::endl;
+    os << "    -a write a C++ translation of the image to the given file for -e aot, and exit" << std::endl;
+    os << "    -c resume from the given checkpoint file instead of the start of the program" << std::endl;
+    os << "    -s save a checkpoint to the given file when the run stops" << std::endl;
+    os << "    -p run the given number of harts on the shared memory, one thread each" << std::endl;
+    os << "    -k run the comma-separated engines (e.g. ref,jit) in lockstep, stopping at the first difference" << std::endl;
+    os << "    -n instructions between lockstep comparisons (default = 1)" << std::endl;
+    os << "    -w sample windows of the given length, and optionally ,instructions between them (default 99 windows)" << std::endl;
+    os << "    -t model the cycles of a five-stage pipeline with forwarding (-tnofwd: without)" << std::endl;
+    os << "    -x model L1I, L1D and L2 caches; -xl1d=8k:2:32:lru:wt,l2=... sets size:ways:line[:lru|fifo|random[:wb|wt]]" << std::endl;
+    os << "    -g model branch prediction with gshare (default), or -gstatic, -gbimodal or -gtage" << std::endl;
+    os << "    -u map a device at a hex address, one -u each: uart@addr[:input-file], timer@addr," << std::endl;
+    os << "       block@addr:disk-file or plugin@addr:shared-object[:args] (see include/device.h)" << std::endl;
+    os << "    -b run every line of the manifest (options, infile and optionally > logfile)" << std::endl;
+    os << "    -j number of threads running the manifest (default = one per core)" << std::endl;
+}
+
 /**
  * Print a usage message and abort the program.
  *********************************************************************/
 static void usage()
 {
-    std::cerr << "Usage: rv32i [-m hex-mem-size] infile" << std::endl;
-    std::cerr << "    -m specify memory size (default = 0x10000)" << std::endl;
+    print_usage(std::cerr);
     exit(1);
 }
 
 /**
- * Read a file of RV32I instructions and execute them.
- ********************************************************************/
-int main(int argc, char **argv)
+ * A device to map, from -u name@addr[:arg].
+ *********************************************************************/
+struct device_spec
 {
-    uint32_t memory_limit = 0x10000; // default memory size = 64k
+    std::string name;
+    uint32_t base;
+    std::string arg;
+};
+
+/**
+ * The options of one run, from the command line or a line of a manifest.
+ *********************************************************************/
+struct run_options
+{
+    uint64_t memory_limit = 0x10000; // default memory size = 64k
     uint64_t execution_limit = 0;    // 0 = run forever
-    int opt;
 
     bool show_disasm = false;
     bool show_insn = false;
     bool show_regs = false;
     bool show_dump = false;
+    bool compressed = false; // -C
+    uint32_t vlen = 128;     // -v
+    engine_type engine = engine_ref;
+    std::string aot_file;
+    std::string resume_file;
+    std::string save_file;
+    uint32_t harts = 1;
+    std::vector<engine_type> lockstep_engines; // -k
+    std::vector<std::string> lockstep_names;
+    uint64_t lockstep_interval = 1; // -n
+    uint64_t sample_window = 0;     // -w, 0 = no sampling
+    uint64_t sample_skip = 0;
+    bool timing = false; // -t
+    bool forwarding = true;
+    bool caches = false; // -x
+    cache_config l1i = {16 << 10, 4, 64, replace_lru, true};
+    cache_config l1d = {16 << 10, 4, 64, replace_lru, true};
+    cache_config l2 = {256 << 10, 8, 64, replace_lru, true};
+    std::string predictor; // -g, empty = no branch model
+    std::vector<device_spec> devices; // -u
+
+    std::string batch_file; // -b, command line only
+    unsigned batch_threads = 0; // -j, 0 = one per core
+
+    std::string infile;
+};
+
+/**
+ * Set e to the engine called name. Returns false if there is no such engine.
+ *********************************************************************/
+static bool parse_engine(const std::string &name, engine_type &e)
+{
+    if (name == "ref")
+        e = engine_ref;
+    else if (name == "threaded")
+        e = engine_threaded;
+    else if (name == "block")
+        e = engine_block;
+    else if (name == "jit")
+        e = engine_jit;
+    else if (name == "jitdiff")
+        e = engine_jitdiff;
+    else if (name == "aot")
+        e = engine_aot;
+    else
+        return false;
+    return true;
+}
 
-    while ((opt = getopt(argc, argv, "dil::m::rz")) != -1)
+/**
+ * Parse the options in argv into o. Returns false if they are not valid.
+ *********************************************************************/
+static bool parse_options(int argc, char **argv, run_options &o)
+{
+    int opt;
+
+    // start over, as a batch parses every line of its manifest. Only 0 makes
+    // glibc forget where it was in a cluster of options (like -zq) that the
+    // last line stopped partway through.
+#ifdef __GLIBC__
+    optind = 0;
+#else
+    optind = 1;
+#endif
+
+    while ((opt = getopt(argc, argv, "a:b:Cc:de:g::ij:k:l::m::n:p:rs:t::u:v:w:x::z")) != -1)
     {
         switch (opt)
         {
+        case 'a':
+            // translate ahead of time instead of running
+            o.aot_file = optarg;
+            break;
+        case 'b':
+            // manifest of runs to make
+            o.batch_file = optarg;
+            break;
+        case 'C':
+            // the C extension
+            o.compressed = true;
+            break;
+        case 'c':
+            // checkpoint to resume from
+            o.resume_file = optarg;
+            break;
         case 'd':
-            show_disasm = true;
+            o.show_disasm = true;
             // std::cout << " found d at \n";
             break;
+        case 'e':
+            // select the engine that executes the program
+            if (!parse_engine(optarg, o.engine))
+                return false;
+            break;
+        case 'g':
+        {
+            // branch prediction model
+            o.predictor = optarg ? optarg : "gshare";
+            std::unique_ptr<direction_predictor> p(make_predictor(o.predictor));
+            if (!p)
+                return false;
+            break;
+        }
         case 'i':
             // std::cout << " found i at \n";
-            show_insn = true;
+            o.show_insn = true;
+            break;
+        case 'j':
+            // threads running a batch
+            o.batch_threads = (unsigned)std::stoul(optarg, nullptr, 10);
+            break;
+        case 'k':
+        {
+            // engines to run in lockstep
+            std::istringstream names(optarg);
+            std::string name;
+            o.lockstep_engines.clear();
+            o.lockstep_names.clear();
+            while (std::getline(names, name, ','))
+            {
+                engine_type e;
+                if (!parse_engine(name, e))
+                    return false;
+                o.lockstep_engines.push_back(e);
+                o.lockstep_names.push_back(name);
+            }
+            if (o.lockstep_engines.size() < 2)
+                return false;
             break;
+        }
         case 'l':
             // std::cout << " found l at \n";
-            execution_limit = (uint32_t)std::stoul(optarg, nullptr, 10);
+            o.execution_limit = (uint32_t)std::stoul(optarg, nullptr, 10);
             // std::cout << " execution limit: " << execution_limit << "\n";
             break;
         case 'm':
             // hex_mem_size given as argument is assigned to memory limit
-            memory_limit = (uint32_t)std::stoul(optarg, nullptr, 16);
+            o.memory_limit = std::stoull(optarg, nullptr, 16);
+            if (o.memory_limit > (uint64_t)1 << 32)
+                return false;
             // std::cout << " found m at \n";
             // std::cout << " memory limit: " << memory_limit << "\n";
             break;
+        case 'n':
+            // instructions between lockstep comparisons
+            o.lockstep_interval = std::stoull(optarg, nullptr, 10);
+            if (o.lockstep_interval == 0)
+                return false;
+            break;
+        case 'p':
+            // number of harts
+            o.harts = (uint32_t)std::stoul(optarg, nullptr, 10);
+            if (o.harts == 0)
+                return false;
+            break;
         case 'r':
             // std::cout << " found r at \n";
-            show_regs = true;
+            o.show_regs = true;
+            break;
+        case 's':
+            // checkpoint to save when the run stops
+            o.save_file = optarg;
+            break;
+        case 't':
+            // pipeline timing model, with forwarding unless -tnofwd
+            o.timing = true;
+            o.forwarding = !optarg;
+            if (optarg && std::string(optarg) != "nofwd")
+                return false;
+            break;
+        case 'u':
+        {
+            // a device: name@hex-address, then :arg for those that take one
+            std::string spec(optarg);
+            size_t at = spec.find('@');
+            if (at == std::string::npos || at == 0)
+                return false;
+            size_t colon = spec.find(':', at);
+            std::string addr = spec.substr(at + 1, colon == std::string::npos ? std::string::npos : colon - at - 1);
+            size_t used = 0;
+            uint64_t base = addr.empty() ? 0 : std::stoull(addr, &used, 16);
+            if (addr.empty() || used != addr.size() || base >= (uint64_t)1 << 32)
+                return false;
+            o.devices.push_back({spec.substr(0, at), (uint32_t)base, colon == std::string::npos ? "" : spec.substr(colon + 1)});
+            break;
+        }
+        case 'v':
+        {
+            // vector register length: a power of two, at least ELEN (32)
+            o.vlen = (uint32_t)std::stoul(optarg, nullptr, 10);
+            if (o.vlen < 32 || o.vlen > 65536 || (o.vlen & (o.vlen - 1)))
+                return false;
+            break;
+        }
+        case 'w':
+        {
+            // sampled simulation: window length and the instructions run between windows
+            size_t comma;
+            o.sample_window = std::stoull(optarg, &comma, 10);
+            o.sample_skip = 99 * o.sample_window;
+            if (optarg[comma] == ',')
+                o.sample_skip = std::stoull(optarg + comma + 1, nullptr, 10);
+            if (o.sample_window == 0)
+                return false;
+            break;
+        }
+        case 'x':
+            // cache model, with the default geometry for any level not given
+            o.caches = true;
+            if (optarg && !cache_configure(optarg, o.l1i, o.l1d, o.l2))
+                return false;
             break;
         case 'z':
             // std::cout << " found z at \n";
-            show_dump = true;
+            o.show_dump = true;
             break;
 
         default:
             /* '?' */
-            usage();
+            return false;
         }
     }
 
     // std::cout << " reading instructions from: " << argv[argc - 1] << std::endl;
     // if (3 >= argc)
     //     usage(); // missing filename
+    o.infile = argv[argc - 1];
+    return true;
+}
+
+/**
+ * Make the devices o asks for and attach them to mem, with UART output to
+ * out. Returns false, with a message to err, if one can't be.
+ ********************************************************************/
+static bool attach_devices(const run_options &o, memory &mem, std::ostream &out, std::ostream &err)
+{
+    for (const device_spec &d : o.devices)
+    {
+        device *dev = make_device(d.name, d.arg, &out, err);
+        if (!dev)
+            return false;
+        if (!mem.attach(d.base, dev))
+        {
+            err << "Can't map " << d.name << " at " << hex0x32(d.base)
+                << " (it must start on a page and not overlap another device)" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
 
-    memory mem(memory_limit);
+/**
+ * Load and run one program as o says, printing to out and err. Returns the
+ * exit status of the run and adds the instructions executed to insns.
+ ********************************************************************/
+static int run(const run_options &o, std::ostream &out, std::ostream &err, uint64_t &insns)
+{
+    memory mem(o.memory_limit);
+    mem.set_output(&out, &err);
 
     // missing filename or file loading error
-    if (!mem.load_file(argv[argc - 1]))
-        usage();
+    program_info prog;
+    if (!load_program(o.infile, &mem, prog, err))
+    {
+        print_usage(err);
+        return 1;
+    }
+    // jitdiff runs each block twice, so devices would see every access twice
+    bool jitdiff = o.engine == engine_jitdiff;
+    for (engine_type e : o.lockstep_engines)
+        jitdiff = jitdiff || e == engine_jitdiff;
+    if (!o.devices.empty() && jitdiff)
+    {
+        err << "-u can't be used with -e jitdiff (or jitdiff in -k)" << std::endl;
+        return 1;
+    }
+    if (!attach_devices(o, mem, out, err))
+        return 1;
+    bool compressed = o.compressed || prog.compressed;
+
+    // a checkpoint holds one hart, traces of several would interleave, and
+    // jitdiff's second pass would see memory other harts have since changed
+    if (o.harts > 1 && (!o.resume_file.empty() || !o.save_file.empty() || o.show_insn || o.show_regs || o.engine == engine_jitdiff))
+    {
+        err << "-c, -s, -i, -r and -e jitdiff need a single hart" << std::endl;
+        return 1;
+    }
 
     rv32i sim(&mem);
+    sim.set_output(&out, &err);
+    sim.set_compressed(compressed);
+    sim.set_vlen(o.vlen);
+    sim.set_entry(prog.entry);
+    sim.set_symbols(&prog.symbols);
+
+    // write the ahead-of-time translation of the image if -a is given
+    if (!o.aot_file.empty())
+    {
+        std::ofstream aot(o.aot_file);
+        size_t blocks = aot_translate(sim, &mem, aot);
+        if (!aot)
+        {
+            err << "Can't write " << o.aot_file << std::endl;
+            return 1;
+        }
+        out << blocks << " blocks written to " << o.aot_file << std::endl;
+        return 0;
+    }
 
     // show disassembled instructions
     // before the simulation begins
-    if (show_disasm)
+    if (o.show_disasm)
         sim.disasm();
 
+    // sampling and the models measure one hart, untraced
+    bool modelled = o.timing || o.caches || !o.predictor.empty();
+    if ((o.sample_window || modelled) && (o.harts > 1 || !o.lockstep_engines.empty() || o.show_insn || o.show_regs))
+    {
+        err << "-w, -t, -x and -g can't be used with -p, -k, -i or -r" << std::endl;
+        return 1;
+    }
+    if (o.sample_window && modelled)
+    {
+        err << "-w can't be used with -t, -x or -g" << std::endl;
+        return 1;
+    }
+
+    // run the engines side by side if -k is given
+    if (!o.lockstep_engines.empty())
+    {
+        if (o.harts > 1 || !o.resume_file.empty() || !o.save_file.empty() || o.show_insn || o.show_regs)
+        {
+            err << "-k can't be used with -p, -c, -s, -i or -r" << std::endl;
+            return 1;
+        }
+
+        // each engine runs on a memory of its own, and only the first prints
+        std::ostream discard(nullptr);
+        std::vector<std::unique_ptr<memory>> mems;
+        std::vector<std::unique_ptr<rv32i>> cpus;
+        std::vector<lockstep_sim> sims;
+        for (size_t i = 0; i < o.lockstep_engines.size(); i++)
+        {
+            mems.emplace_back(new memory(o.memory_limit));
+            mems[i]->set_output(i ? &discard : &out, &err);
+            program_info p;
+            if (!load_program(o.infile, mems[i].get(), p, err) || !attach_devices(o, *mems[i], i ? discard : out, err))
+                return 1;
+            cpus.emplace_back(new rv32i(mems[i].get()));
+            cpus[i]->set_output(i ? &discard : &out, &err);
+            cpus[i]->set_compressed(compressed);
+            cpus[i]->set_vlen(o.vlen);
+            cpus[i]->set_entry(prog.entry);
+            cpus[i]->reset();
+            cpus[i]->set_engine(o.lockstep_engines[i]);
+            sims.push_back({o.lockstep_names[i], mems[i].get(), cpus[i].get()});
+        }
+
+        bool same = lockstep(sims, o.lockstep_interval, o.execution_limit, err);
+        out << cpus[0]->render_total_insn_exec(cpus[0]->get_insn_counter()) << std::endl;
+        insns += cpus[0]->get_insn_counter();
+
+        if (o.show_dump)
+        {
+            cpus[0]->dump();
+            mems[0]->dump();
+        }
+        return same ? 0 : 1;
+    }
+
+    // run each hart on its own thread if -p is given
+    if (o.harts > 1)
+    {
+        std::vector<std::unique_ptr<rv32i>> cpus;
+        for (uint32_t i = 0; i < o.harts; i++)
+        {
+            cpus.emplace_back(new rv32i(&mem));
+            cpus[i]->set_output(&out, &err);
+            cpus[i]->set_hartid(i);
+            cpus[i]->set_compressed(compressed);
+            cpus[i]->set_vlen(o.vlen);
+            cpus[i]->set_entry(prog.entry);
+            cpus[i]->reset();
+            cpus[i]->set_engine(o.engine);
+        }
+
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < o.harts; i++)
+            threads.emplace_back(&rv32i::execute, cpus[i].get(), o.execution_limit);
+        for (std::thread &t : threads)
+            t.join();
+
+        for (uint32_t i = 0; i < o.harts; i++)
+        {
+            out << "hart " << i << ": " << cpus[i]->render_total_insn_exec(cpus[i]->get_insn_counter()) << std::endl;
+            insns += cpus[i]->get_insn_counter();
+        }
+
+        if (o.show_dump)
+        {
+            for (uint32_t i = 0; i < o.harts; i++)
+            {
+                out << "hart " << i << ":" << std::endl;
+                cpus[i]->dump();
+            }
+            mem.dump();
+        }
+        return 0;
+    }
+
     // reset the simulator
-    // set program counter to zero
+    // set program counter to the entry point
     // set General Purpose registers to their default values
     sim.reset();
 
+    // continue from a checkpoint if -c is given
+    if (!o.resume_file.empty() && !sim.load_checkpoint(o.resume_file))
+        return 1;
+
     // print instructions if option -i is given
-    sim.set_show_instructions(show_insn);
+    sim.set_show_instructions(o.show_insn);
 
     // print register hart dump if option -r is given
-    sim.set_show_registers(show_regs);
+    sim.set_show_registers(o.show_regs);
+
+    // execute with the engine chosen by -e
+    sim.set_engine(o.engine);
+
+    // alternate with detailed windows if -w is given
+    sim.set_sampling(o.sample_window, o.sample_skip);
+
+    // model the pipeline if -t is given
+    sim.set_timing(o.timing, o.forwarding);
+
+    // model the caches if -x is given
+    if (o.caches)
+        sim.set_caches(new cache_hierarchy(o.l1i, o.l1d, o.l2));
+
+    // predict branches if -g is given
+    if (!o.predictor.empty())
+        sim.set_branches(new branch_model(o.predictor, make_predictor(o.predictor)));
 
     // run the simulated with fixed limit if -l flag has an argument
-    sim.run(execution_limit);
+    sim.run(o.execution_limit);
+    insns += sim.get_insn_counter();
+
+    // save a checkpoint if -s is given
+    if (!o.save_file.empty() && !sim.save_checkpoint(o.save_file))
+        return 1;
 
     // show memory dump if -z option is given
-    if (show_dump)
+    if (o.show_dump)
     {
         sim.dump();
         mem.dump();
     }
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * One line of a batch manifest, and how its run went.
+ *********************************************************************/
+struct batch_job
+{
+    unsigned line;       // line number in the manifest
+    std::string command; // the line, less any log redirection
+    std::string log;     // file the run prints to
+    bool parsed;         // false if the options are not valid
+    run_options options;
+
+    int status;
+    uint64_t insns;
+    double seconds;
+};
+
+/**
+ * Read the manifest fname into jobs. Each line that is not blank or a #
+ * comment holds the options and infile of one run, as on the command line,
+ * and may end with "> logfile"; without one the run prints to fname.N.log
+ * for line N. Returns false if the manifest can't be read.
+ *********************************************************************/
+static bool read_manifest(const std::string &fname, std::vector<batch_job> &jobs)
+{
+    std::ifstream in(fname);
+    if (!in)
+    {
+        std::cerr << "Can't open file " << fname << " for reading" << std::endl;
+        return false;
+    }
+
+    std::string text;
+    for (unsigned line = 1; std::getline(in, text); line++)
+    {
+        std::istringstream is(text);
+        std::vector<std::string> words;
+        std::string w;
+        while (is >> w)
+            words.push_back(w);
+        if (words.empty() || words[0][0] == '#')
+            continue;
+
+        batch_job job;
+        job.line = line;
+        job.log = fname + "." + std::to_string(line) + ".log";
+        if (words.size() >= 2 && words[words.size() - 2] == ">")
+        {
+            job.log = words.back();
+            words.resize(words.size() - 2);
+        }
+        for (const std::string &word : words)
+            job.command += (job.command.empty() ? "" : " ") + word;
+
+        // getopt wants the argv of a program
+        std::vector<char *> argv;
+        std::string program = "rv32i";
+        argv.push_back(&program[0]);
+        for (std::string &word : words)
+            argv.push_back(&word[0]);
+        argv.push_back(nullptr);
+        // a number that doesn't parse (-mzz), or is missing where the option
+        // takes it optionally (-m 10), throws from std::stoul and the like
+        try
+        {
+            job.parsed = words.size() >= 1 && parse_options(argv.size() - 1, argv.data(), job.options) &&
+                         job.options.batch_file.empty();
+        }
+        catch (const std::exception &)
+        {
+            job.parsed = false;
+        }
+        if (!job.parsed)
+            std::cerr << fname << ":" << line << ": invalid options, run not made" << std::endl;
+
+        job.status = 1;
+        job.insns = 0;
+        job.seconds = 0;
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+/**
+ * Run the manifest o.batch_file on o.batch_threads threads, each taking the
+ * next job not yet started when it finishes one, and print a summary.
+ * Returns 0 if every job succeeded.
+ *********************************************************************/
+static int run_batch(const run_options &o)
+{
+    std::vector<batch_job> jobs;
+    if (!read_manifest(o.batch_file, jobs))
+        return 1;
+
+    unsigned threads = o.batch_threads ? o.batch_threads : std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::atomic<size_t> next(0);
+    auto worker = [&jobs, &next]() {
+        size_t i;
+        while ((i = next++) < jobs.size())
+        {
+            batch_job &job = jobs[i];
+            auto job_start = std::chrono::steady_clock::now();
+
+            std::ofstream log(job.log);
+            if (!log)
+                continue;
+            if (job.parsed)
+                job.status = run(job.options, log, log, job.insns);
+            else
+                print_usage(log);
+
+            std::chrono::duration<double> t = std::chrono::steady_clock::now() - job_start;
+            job.seconds = t.count();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++)
+        pool.emplace_back(worker);
+    for (std::thread &t : pool)
+        t.join();
+
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+    // summary
+    unsigned failed = 0;
+    uint64_t insns = 0;
+    double seconds = 0;
+    std::cout << " line status  instructions    seconds  command" << std::endl;
+    for (const batch_job &job : jobs)
+    {
+        std::cout << std::setw(5) << job.line << " " << (job.status ? "FAILED" : "ok    ")
+                  << std::setw(14) << job.insns << " " << std::fixed << std::setprecision(3)
+                  << std::setw(10) << job.seconds << "  " << job.command << " > " << job.log << std::endl;
+        failed += job.status != 0;
+        insns += job.insns;
+        seconds += job.seconds;
+    }
+    std::cout << jobs.size() << " jobs, " << failed << " failed, " << insns << " instructions, "
+              << wall.count() << " s wall time (" << seconds << " s in jobs) on " << threads << " threads" << std::endl;
+
+    return failed ? 1 : 0;
+}
+
+/**
+ * Read a file of RV32I instructions and execute them.
+ ********************************************************************/
+int main(int argc, char **argv)
+{
+    run_options o;
+    if (!parse_options(argc, argv, o))
+        usage();
+
+    // run a manifest of programs if -b is given
+    if (!o.batch_file.empty())
+        return run_batch(o);
+
+    uint64_t insns = 0;
+    return run(o, std::cout, std::cerr, insns);
+}
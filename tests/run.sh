@@ -0,0 +1,265 @@
+#!/bin/sh
+# Regression tests, run by make test (or sh tests/run.sh path/to/rv32i).
+#
+# Each test is a small program, given as its 32-bit instruction words with
+# the assembly beside them, that ends with ebreak. It runs on every engine
+# and the registers it leaves are checked against the values expected.
+
+sim=${1:-./rv32i}
+engines="ref threaded block jit jitdiff"
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+# image file word...: write the words, little-endian, to file (a word of
+# four hex digits is a halfword, for compressed instructions)
+image()
+{
+    f=$1
+    shift
+    : >"$f"
+    for w; do
+        bits="0 8 16 24"
+        [ ${#w} = 4 ] && bits="0 8"
+        for s in $bits; do
+            printf "\\$(printf %o $(((0x$w >> s) & 255)))" >>"$f"
+        done
+    done
+}
+
+# reg log n: register xn from the register dump at the end of a run's log
+reg()
+{
+    awk -v row="x$(($2 / 8 * 8))" -v col=$(($2 % 8 + 2)) '$1 == row { v = $col } END { print v }' "$1"
+}
+
+# check name file options -- n=value...: run file with options on every
+# engine and check that each xn holds its value (in hex, as the dump has it)
+check()
+{
+    name=$1
+    file=$2
+    shift 2
+    opts=
+    while [ "$1" != "--" ]; do
+        opts="$opts $1"
+        shift
+    done
+    shift
+    for e in $engines; do
+        log="$dir/$name.$e.log"
+        "$sim" -e $e -z $opts "$file" >"$log" 2>&1
+        for want; do
+            got=$(reg "$log" ${want%%=*})
+            if [ "$got" != "${want#*=}" ]; then
+                echo "FAIL $name -e $e: x${want%%=*} is $got, expected ${want#*=}"
+                failed=1
+            fi
+        done
+    done
+    echo "done $name"
+}
+
+# same name file options...: run file with options on every engine and
+# check that each prints what the reference interpreter does
+same()
+{
+    name=$1
+    shift
+    "$sim" -e ref -z "$@" >"$dir/$name.want.log" 2>&1
+    for e in $engines; do
+        log="$dir/$name.$e.log"
+        "$sim" -e $e -z "$@" >"$log" 2>&1
+        if ! cmp -s "$log" "$dir/$name.want.log"; then
+            echo "FAIL $name -e $e: the output differs from -e ref"
+            failed=1
+        fi
+    done
+    echo "done $name"
+}
+
+# Stores write all of their bytes, aligned or not
+image "$dir/store.bin" \
+    10000413 `# li   s0, 0x100` \
+    112232b7 `# lui  t0, 0x11223` \
+    34428293 `# addi t0, t0, 0x344` \
+    00542023 `# sw   t0, 0(s0)` \
+    00042503 `# lw   a0, 0(s0)` \
+    0000c337 `# lui  t1, 0xc` \
+    eef30313 `# addi t1, t1, -0x111` \
+    00641223 `# sh   t1, 4(s0)` \
+    00445583 `# lhu  a1, 4(s0)` \
+    00441603 `# lh   a2, 4(s0)` \
+    00542423 `# sw   t0, 8(s0)` \
+    00641523 `# sh   t1, 10(s0)` \
+    00842683 `# lw   a3, 8(s0)` \
+    025420a3 `# sw   t0, 0x21(s0)` \
+    02142703 `# lw   a4, 0x21(s0)` \
+    00100073 `# ebreak`
+check store "$dir/store.bin" -m1000 -- 10=11223344 11=0000beef 12=ffffbeef 13=beef3344 14=11223344
+
+# The multiplies: mul, mulh and mulhu in a loop that the JIT compiles, and
+# mulhsu (which it leaves to the handlers) in another
+image "$dir/mul.bin" \
+    06400513 `# li     a0, 100` \
+    123455b7 `# lui    a1, 0x12345` \
+    67858593 `# addi   a1, a1, 0x678` \
+    ff900613 `# li     a2, -7` \
+    00000693 `# li     a3, 0` \
+    02c582b3 `# 1: mul t0, a1, a2` \
+    02c59333 `# mulh   t1, a1, a2` \
+    02c5be33 `# mulhu  t3, a1, a2` \
+    005686b3 `# add    a3, a3, t0` \
+    0066c6b3 `# xor    a3, a3, t1` \
+    01c686b3 `# add    a3, a3, t3` \
+    12358593 `# addi   a1, a1, 0x123` \
+    ffd60613 `# addi   a2, a2, -3` \
+    fff50513 `# addi   a0, a0, -1` \
+    fc051ee3 `# bnez   a0, 1b` \
+    06400513 `# li     a0, 100` \
+    00000713 `# li     a4, 0` \
+    02b623b3 `# 2: mulhsu t2, a2, a1` \
+    00770733 `# add    a4, a4, t2` \
+    12358593 `# addi   a1, a1, 0x123` \
+    00560613 `# addi   a2, a2, 5` \
+    fff50513 `# addi   a0, a0, -1` \
+    fe0516e3 `# bnez   a0, 2b` \
+    00028793 `# mv     a5, t0` \
+    00030813 `# mv     a6, t1` \
+    000e0893 `# mv     a7, t3` \
+    00100073 `# ebreak`
+check mul "$dir/mul.bin" -m1000 -- 13=aaee611a 14=fffffe27 15=6153aed0 16=ffffffea 17=1234c6eb
+
+# A vector instruction that halts (here on vill, before any vsetvli) is the
+# last instruction run, even in the middle of a block
+image "$dir/vhalt.bin" \
+    02056407 `# vle32.v v8, (a0)` \
+    00500593 `# li      a1, 5` \
+    00100073 `# ebreak`
+check vhalt "$dir/vhalt.bin" -m1000 -- 11=f0f0f0f0
+
+# Sv32: a page table with a 4 KiB page and a 4 MiB superpage, turned on by
+# csrw satp partway through the run (the engines leave the rest to the
+# reference loop), and the A and D bits that the walk sets in each leaf PTE
+image "$dir/sv32.bin" \
+    000022b7 `# lui  t0, 0x2          root table` \
+    00001337 `# lui  t1, 0x1` \
+    c0130313 `# addi t1, t1, -0x3ff` \
+    0062a023 `# sw   t1, 0(t0)        VA 0 -> table at 0x3000` \
+    00700313 `# li   t1, 7` \
+    0062a223 `# sw   t1, 4(t0)        VA 0x400000 -> PA 0, RW superpage` \
+    000032b7 `# lui  t0, 0x3` \
+    00f00313 `# li   t1, 15` \
+    0062a023 `# sw   t1, 0(t0)        VA 0 -> PA 0, RWX` \
+    00001337 `# lui  t1, 0x1` \
+    00730313 `# addi t1, t1, 7` \
+    0062aa23 `# sw   t1, 20(t0)       VA 0x5000 -> PA 0x4000, RW` \
+    000043b7 `# lui  t2, 0x4` \
+    05500313 `# li   t1, 0x55` \
+    0063a423 `# sw   t1, 8(t2)` \
+    00a00513 `# li   a0, 10` \
+    00000813 `# li   a6, 0` \
+    00680833 `# 1: add a6, a6, t1` \
+    fff50513 `# addi a0, a0, -1` \
+    fe051ce3 `# bnez a0, 1b` \
+    80000e37 `# lui  t3, 0x80000` \
+    002e0e13 `# addi t3, t3, 2` \
+    180e1073 `# csrw satp, t3` \
+    00005537 `# lui  a0, 0x5` \
+    00a00793 `# li   a5, 10` \
+    00000893 `# li   a7, 0` \
+    00852583 `# 2: lw a1, 8(a0)` \
+    00b888b3 `# add  a7, a7, a1` \
+    fff78793 `# addi a5, a5, -1` \
+    fe079ae3 `# bnez a5, 2b` \
+    00404637 `# lui  a2, 0x404` \
+    06600313 `# li   t1, 0x66` \
+    00662623 `# sw   t1, 12(a2)       through the superpage` \
+    00c52683 `# lw   a3, 12(a0)       and back through the 4 KiB page` \
+    00403eb7 `# lui  t4, 0x403` \
+    014ea703 `# lw   a4, 20(t4)       the PTEs, through the superpage` \
+    000ea903 `# lw   s2, 0(t4)` \
+    00402eb7 `# lui  t4, 0x402` \
+    004ea983 `# lw   s3, 4(t4)` \
+    00100073 `# ebreak`
+check sv32 "$dir/sv32.bin" -m10000 -- 11=00000055 13=00000066 14=00001047 16=00000352 17=00000352 \
+    18=0000004f 19=000000c7
+
+# The Zbb and Zba instructions, including clz and ctz of zero
+image "$dir/zb.bin" \
+    00f012b7 `# lui    t0, 0xf01` \
+    02028293 `# addi   t0, t0, 0x20` \
+    60029513 `# clz    a0, t0` \
+    60129593 `# ctz    a1, t0` \
+    60229613 `# cpop   a2, t0` \
+    6982d693 `# rev8   a3, t0` \
+    2872d713 `# orc.b  a4, t0` \
+    10000313 `# li     t1, 0x100` \
+    00300393 `# li     t2, 3` \
+    2063a7b3 `# sh1add a5, t2, t1` \
+    2063c833 `# sh2add a6, t2, t1` \
+    2063e8b3 `# sh3add a7, t2, t1` \
+    60001913 `# clz    s2, zero` \
+    60101993 `# ctz    s3, zero` \
+    00100073 `# ebreak`
+check zb "$dir/zb.bin" -m1000 -- 10=00000008 11=00000005 12=00000006 13=2010f000 14=00ffffff \
+    15=00000106 16=0000010c 17=00000118 18=00000020 19=00000020
+
+# Compressed instructions expand to what they stand for, between and around
+# 32-bit ones that are only halfword aligned
+image "$dir/rvc.bin" \
+    40000113 `# li         sp, 1024` \
+    123452b7 `# lui        t0, 0x12345` \
+    67828293 `# addi       t0, t0, 0x678` \
+    7139     `# c.addi16sp sp, -64` \
+    00512423 `# sw         t0, 8(sp)` \
+    4522     `# c.lwsp     a0, 8(sp)` \
+    0505     `# c.addi     a0, 1` \
+    c62a     `# c.swsp     a0, 12(sp)` \
+    00c12583 `# lw         a1, 12(sp)` \
+    00000317 `# auipc      t1, 0` \
+    00e30313 `# addi       t1, t1, 14` \
+    9302     `# c.jalr     t1` \
+    8686     `# c.mv       a3, ra` \
+    a019     `# c.j        2f` \
+    461d     `# c.li       a2, 7` \
+    8082     `# c.ret` \
+    870a     `# 2: c.mv    a4, sp` \
+    00100073 `# ebreak`
+check rvc "$dir/rvc.bin" -C -m1000 -- 10=12345679 11=12345679 12=00000007 13=00000026 14=000003c0
+
+# A 32-bit instruction that starts in the last halfword of memory can't be
+# fetched; every engine reports it as the reference interpreter does
+image "$dir/split.bin" \
+    a039 `# c.j   1f` \
+    0001 `# c.nop` \
+    0000 0000 0000 0000 0000 \
+    0013 `# 1: (first half of a nop)`
+same split -C -m10 "$dir/split.bin"
+
+# A manifest line that stops partway through a cluster of options (at the
+# unknown -q) leaves nothing behind for the next line to parse, and one with
+# a number that doesn't parse, or is missing, fails alone
+printf '%s\n' "-zqi -m1000 $dir/store.bin" "-mzz $dir/store.bin" "-m 1000 $dir/store.bin" \
+    "-z -m1000 $dir/store.bin > $dir/batch.4.log" >"$dir/batch"
+"$sim" -b "$dir/batch" -j1 >"$dir/batch.log" 2>&1
+"$sim" -z -m1000 "$dir/store.bin" >"$dir/batch.want.log" 2>&1
+if ! grep -q "^ *1 FAILED" "$dir/batch.log" || ! grep -q "^ *2 FAILED" "$dir/batch.log" ||
+    ! grep -q "^ *3 FAILED" "$dir/batch.log" || ! grep -q "^ *4 ok" "$dir/batch.log" ||
+    ! cmp -s "$dir/batch.4.log" "$dir/batch.want.log"; then
+    echo "FAIL batch: a bad line stopped the batch, or the line after it did not run as given"
+    failed=1
+fi
+echo "done batch"
+
+# An image too big for even a 4 GiB memory is refused with a warning at the
+# first address past its end (a sparse file, so it takes no space)
+truncate -s 4294967297 "$dir/huge.bin" &&
+    "$sim" -m100000000 "$dir/huge.bin" >"$dir/huge.log" 2>&1
+if ! grep -q "WARNING: Address out of range: 0x100000000" "$dir/huge.log" || ! grep -q "Program too big" "$dir/huge.log"; then
+    echo "FAIL huge: an image bigger than 4 GiB was not refused with a warning"
+    failed=1
+fi
+echo "done huge"
+
+exit $failed